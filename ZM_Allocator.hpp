@@ -0,0 +1,211 @@
+/*****************************************************************
+* Copyright (C) 2021 zm. All rights reserved.                    *
+******************************************************************
+* ZM_Allocator.hpp
+*
+* DESCRIPTION:
+*     zm allocator adaptors for C++ containers, header only.
+*     zm::allocator<T> plugs into std containers, zm::memory_resource
+*     into std::pmr ones (C++17). Both bind to a heap, NULL for the
+*     memory behind zm_malloc, and free with the size.
+* AUTHOR:
+*     zm
+* CREATED DATE:
+*     2023/3/3
+* REVISION:
+*     v0.1
+*
+* MODIFICATION HISTORY
+* --------------------
+* $Log:$
+*
+*****************************************************************/
+#ifndef __ZM_ALLOCATOR_HPP__
+#define __ZM_ALLOCATOR_HPP__
+
+/*************************************************************************************************************************
+ *                                                       INCLUDES                                                        *
+ *************************************************************************************************************************/
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#if (__cplusplus >= 201703L) && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define ZM_ALLOCATOR_PMR        1
+#endif
+#endif
+#include "ZM_Memory.h"
+
+/*************************************************************************************************************************
+ *                                                        MACROS                                                         *
+ *************************************************************************************************************************/
+#ifndef ZM_ALLOCATOR_PMR
+#define ZM_ALLOCATOR_PMR        0
+#endif
+
+namespace zm
+{
+/*************************************************************************************************************************
+ *                                                   PUBLIC FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+
+/*****************************************************************
+* FUNCTION: heapAllocate
+*
+* DESCRIPTION:
+*     Allocate from a heap for the adaptors below.
+* INPUTS:
+*     heap : The heap, NULL for zm_malloc.
+*     size : The number of bytes.
+*     alignment : Power of two.
+* RETURNS:
+*     The memory, never NULL.
+* NOTE:
+*     Throws std::bad_alloc when out of memory. zm_memalign only for
+*     alignments above ZM_ALIGN_SIZE.
+*****************************************************************/
+inline void *heapAllocate(zm_heap_t *heap, std::size_t size, std::size_t alignment)
+{
+    void *ptr;
+    
+    if(size == 0) size = 1;
+    if(size > (std::size_t)(zm_size_t)-1) throw std::bad_alloc();
+    
+    if(alignment <= ZM_ALIGN_SIZE)
+    {
+        ptr = heap ? zm_heapMalloc(heap, (zm_size_t)size) : zm_malloc((zm_size_t)size);
+    }
+    else
+    {
+        ptr = heap ? zm_heapMemalign(heap, (zm_size_t)alignment, (zm_size_t)size)
+                   : zm_memalign((zm_size_t)alignment, (zm_size_t)size);
+    }
+    if(ptr == NULL) throw std::bad_alloc();
+    
+    return ptr;
+}
+/*****************************************************************
+* FUNCTION: heapDeallocate
+*
+* DESCRIPTION:
+*     Give back memory of heapAllocate.
+* INPUTS:
+*     heap : The heap it came from, NULL for zm_malloc.
+*     ptr : The memory.
+*     size : The size it was allocated with.
+* RETURNS:
+*     null
+* NOTE:
+*     null
+*****************************************************************/
+inline void heapDeallocate(zm_heap_t *heap, void *ptr, std::size_t size) noexcept
+{
+    if(size == 0) size = 1;
+    
+    if(heap)
+    {
+        zm_heapFreeSized(heap, ptr, (zm_size_t)size);
+    }
+    else
+    {
+        zm_freeSized(ptr, (zm_size_t)size);
+    }
+}
+
+/** std allocator on a zm heap, copies and rebinds share the heap. */
+template<class T>
+class allocator
+{
+public:
+    typedef T value_type;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+    // a container keeps the heap of the one it was moved or copied from.
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    typedef std::false_type is_always_equal;
+    
+    template<class U>
+    struct rebind
+    {
+        typedef allocator<U> other;
+    };
+    
+    allocator() noexcept : heap_(NULL) {}
+    explicit allocator(zm_heap_t *heap) noexcept : heap_(heap) {}
+    template<class U>
+    allocator(const allocator<U> &other) noexcept : heap_(other.heap()) {}
+    
+    T *allocate(std::size_t n)
+    {
+        if(n > (std::size_t)-1 / sizeof(T)) throw std::bad_alloc();
+        
+        return static_cast<T *>(heapAllocate(heap_, n * sizeof(T), alignof(T)));
+    }
+    
+    void deallocate(T *ptr, std::size_t n) noexcept
+    {
+        heapDeallocate(heap_, ptr, n * sizeof(T));
+    }
+    
+    zm_heap_t *heap() const noexcept
+    {
+        return heap_;
+    }
+    
+private:
+    zm_heap_t *heap_;
+};
+
+template<class T, class U>
+inline bool operator==(const allocator<T> &a, const allocator<U> &b) noexcept
+{
+    return a.heap() == b.heap();
+}
+
+template<class T, class U>
+inline bool operator!=(const allocator<T> &a, const allocator<U> &b) noexcept
+{
+    return a.heap() != b.heap();
+}
+
+#if ZM_ALLOCATOR_PMR
+/** std::pmr resource on a zm heap, equal to any other on the same heap. */
+class memory_resource : public std::pmr::memory_resource
+{
+public:
+    explicit memory_resource(zm_heap_t *heap = NULL) noexcept : heap_(heap) {}
+    
+    zm_heap_t *heap() const noexcept
+    {
+        return heap_;
+    }
+    
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        return heapAllocate(heap_, bytes, alignment);
+    }
+    
+    void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override
+    {
+        (void)alignment;
+        heapDeallocate(heap_, ptr, bytes);
+    }
+    
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        const memory_resource *zmOther = dynamic_cast<const memory_resource *>(&other);
+        
+        return zmOther && zmOther->heap_ == heap_;
+    }
+    
+    zm_heap_t *heap_;
+};
+#endif
+
+}
+
+#endif /* ZM_Allocator.hpp */
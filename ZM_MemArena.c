@@ -0,0 +1,336 @@
+/*****************************************************************
+* Copyright (C) 2021 zm. All rights reserved.                    *
+******************************************************************
+* ZM_MemArena.c
+*
+* DESCRIPTION:
+*     zm arena (bump) allocator for request-scoped memory.
+* AUTHOR:
+*     zm
+* CREATED DATE:
+*     2023/3/3
+* REVISION:
+*     v0.1
+*
+* MODIFICATION HISTORY
+* --------------------
+* $Log:$
+*
+*****************************************************************/
+
+/*************************************************************************************************************************
+ *                                                       INCLUDES                                                        *
+ *************************************************************************************************************************/
+#include <stddef.h>
+#include "ZM_MemArena.h"
+
+/*************************************************************************************************************************
+ *                                                        MACROS                                                         *
+ *************************************************************************************************************************/
+#define ZM_ARENA_CHUNK_HEAD     ZM_ALIGN(sizeof(zmArenaChunk_t), ZM_ARENA_ALIGN_SIZE)
+#define ZM_ARENA_HEAD           ZM_ALIGN(sizeof(zm_arena_t), ZM_ARENA_ALIGN_SIZE)
+/** chunk start, the heap may align less than the pointers in the headers */
+#define ZM_ARENA_CHUNK_ALIGN    (ZM_ARENA_ALIGN_SIZE > sizeof(void *) ? ZM_ARENA_ALIGN_SIZE : sizeof(void *))
+/*************************************************************************************************************************
+ *                                                      CONSTANTS                                                        *
+ *************************************************************************************************************************/
+
+/*************************************************************************************************************************
+ *                                                       TYPEDEFS                                                        *
+ *************************************************************************************************************************/
+
+/*************************************************************************************************************************
+ *                                                   GLOBAL VARIABLES                                                    *
+ *************************************************************************************************************************/
+
+/*************************************************************************************************************************
+ *                                                  EXTERNAL VARIABLES                                                   *
+ *************************************************************************************************************************/
+
+/*************************************************************************************************************************
+ *                                                    LOCAL VARIABLES                                                    *
+ *************************************************************************************************************************/
+
+/*************************************************************************************************************************
+ *                                                 FUNCTION DECLARATIONS                                                 *
+ *************************************************************************************************************************/
+
+/*************************************************************************************************************************
+ *                                                    LOCAL FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+static zmArenaChunk_t *zm_arenaChunkNew(zm_heap_t *heap, zm_size_t size)
+{
+    zmArenaChunk_t *chunk;
+    
+    if(size > ~(zm_size_t)0 - ZM_ARENA_CHUNK_HEAD) return NULL;
+    size += ZM_ARENA_CHUNK_HEAD;
+    
+    chunk = (zmArenaChunk_t *)(heap ? zm_heapMemalign(heap, ZM_ARENA_CHUNK_ALIGN, size) :
+                                      zm_memalign(ZM_ARENA_CHUNK_ALIGN, size));
+    if(chunk == NULL) return NULL;
+    
+    chunk->prev = NULL;
+    chunk->begin = (zm_uint8_t *)chunk + ZM_ARENA_CHUNK_HEAD;
+    chunk->end = (zm_uint8_t *)chunk + size;
+    chunk->used = 0;
+    chunk->size = size;
+    
+    return chunk;
+}
+
+static void zm_arenaChunkDelete(zm_heap_t *heap, zmArenaChunk_t *chunk)
+{
+    if(heap)
+    {
+        zm_heapFree(heap, chunk);
+    }
+    else
+    {
+        zm_free(chunk);
+    }
+}
+
+#if ZM_MEM_STATS
+static void zm_arenaUpdateMax(zm_arena_t *arena)
+{
+    zm_size_t used = zm_arenaGetUsed(arena);
+    
+    if(arena->maxUsedSize < used)
+    {
+        arena->maxUsedSize = used;
+    }
+}
+#endif
+
+/* give back every chunk newer than keep */
+static void zm_arenaDrop(zm_arena_t *arena, zmArenaChunk_t *keep)
+{
+    zmArenaChunk_t *chunk = arena->chunk;
+    
+#if ZM_MEM_STATS
+    zm_arenaUpdateMax(arena);
+#endif
+    
+    while(chunk != keep)
+    {
+        zmArenaChunk_t *prev = chunk->prev;
+    
+        arena->totalSize -= chunk->size;
+        zm_arenaChunkDelete(arena->heap, chunk);
+        chunk = prev;
+    }
+    
+    arena->chunk = keep;
+    arena->end = keep->end;
+}
+/*************************************************************************************************************************
+ *                                                   PUBLIC FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+
+/*****************************************************************
+* FUNCTION: zm_arenaCreate
+*
+* DESCRIPTION:
+*     Create an arena, control block and first chunk are one region.
+* INPUTS:
+*     heap : Heap the chunks come from, NULL for zm_malloc.
+*     chunkSize : Usable size of each chunk.
+* RETURNS:
+*     The arena.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     Requests larger than chunkSize get a chunk of their own.
+*****************************************************************/
+zm_arena_t *zm_arenaCreate(zm_heap_t *heap, zm_size_t chunkSize)
+{
+    zmArenaChunk_t *chunk;
+    zm_arena_t *arena;
+    
+    if(chunkSize > ~(zm_size_t)0 - (ZM_ARENA_ALIGN_SIZE - 1)) return NULL;
+    chunkSize = ZM_ALIGN(chunkSize, ZM_ARENA_ALIGN_SIZE);
+    if(chunkSize > ~(zm_size_t)0 - ZM_ARENA_HEAD) return NULL;
+    
+    chunk = zm_arenaChunkNew(heap, ZM_ARENA_HEAD + chunkSize);
+    if(chunk == NULL) return NULL;
+    
+    // the control block lives at the start of the first chunk.
+    arena = (zm_arena_t *)chunk->begin;
+    chunk->begin += ZM_ARENA_HEAD;
+    
+    arena->cur = chunk->begin;
+    arena->end = chunk->end;
+    arena->chunk = chunk;
+    arena->heap = heap;
+    arena->chunkSize = chunkSize;
+    arena->totalSize = chunk->size;
+    arena->maxUsedSize = 0;
+    
+    return arena;
+}
+/*****************************************************************
+* FUNCTION: zm_arenaDelete
+*
+* DESCRIPTION:
+*     Release an arena and all its chunks.
+* INPUTS:
+*     arena : The arena.
+* RETURNS:
+*     null
+* NOTE:
+*     null
+*****************************************************************/
+void zm_arenaDelete(zm_arena_t *arena)
+{
+    zmArenaChunk_t *chunk;
+    
+    if(arena == NULL) return;
+    
+    chunk = arena->chunk;
+    while(chunk->prev)
+    {
+        zmArenaChunk_t *prev = chunk->prev;
+    
+        zm_arenaChunkDelete(arena->heap, chunk);
+        chunk = prev;
+    }
+    
+    // the first chunk holds the control block.
+    zm_arenaChunkDelete(arena->heap, chunk);
+}
+/*****************************************************************
+* FUNCTION: zm_arenaAllocSlow
+*
+* DESCRIPTION:
+*     Get a new chunk and allocate from it, called by zm_arenaAlloc.
+* INPUTS:
+*     arena : The arena.
+*     size : Size aligned to ZM_ARENA_ALIGN_SIZE.
+* RETURNS:
+*     The memory.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     The rest of the current chunk is left unused.
+*****************************************************************/
+void *zm_arenaAllocSlow(zm_arena_t *arena, zm_size_t size)
+{
+    zmArenaChunk_t *chunk;
+    
+    chunk = zm_arenaChunkNew(arena->heap, size > arena->chunkSize ? size : arena->chunkSize);
+    if(chunk == NULL) return NULL;
+    
+    arena->chunk->used = (zm_size_t)(arena->cur - arena->chunk->begin);
+    
+    chunk->prev = arena->chunk;
+    arena->chunk = chunk;
+    arena->cur = chunk->begin + size;
+    arena->end = chunk->end;
+    arena->totalSize += chunk->size;
+    
+    return chunk->begin;
+}
+/*****************************************************************
+* FUNCTION: zm_arenaRewind
+*
+* DESCRIPTION:
+*     Release everything allocated since a mark.
+* INPUTS:
+*     arena : The arena.
+*     mark : Returned by zm_arenaMark on this arena.
+* RETURNS:
+*     null
+* NOTE:
+*     Chunks taken since the mark go back to the heap. Marks taken
+*     after this one become invalid.
+*****************************************************************/
+void zm_arenaRewind(zm_arena_t *arena, zm_arenaMark_t mark)
+{
+    zm_arenaDrop(arena, mark.chunk);
+    arena->cur = mark.cur;
+}
+/*****************************************************************
+* FUNCTION: zm_arenaReset
+*
+* DESCRIPTION:
+*     Release everything allocated from the arena.
+* INPUTS:
+*     arena : The arena.
+* RETURNS:
+*     null
+* NOTE:
+*     Only the first chunk is kept, ready for the next request.
+*****************************************************************/
+void zm_arenaReset(zm_arena_t *arena)
+{
+    zmArenaChunk_t *first = arena->chunk;
+    
+    while(first->prev)
+    {
+        first = first->prev;
+    }
+    
+    zm_arenaDrop(arena, first);
+    arena->cur = first->begin;
+}
+/*****************************************************************
+* FUNCTION: zm_arenaGetTotal
+*
+* DESCRIPTION:
+*       Get arena footprint, all chunks with their headers.
+* INPUTS:
+*     arena : The arena.
+* RETURNS:
+*     arena total size.
+* NOTE:
+*     The chunks are heap blocks, zm_getMemUsed/zm_heapGetUsed count them too.
+*****************************************************************/
+zm_size_t zm_arenaGetTotal(zm_arena_t *arena)
+{
+    return arena->totalSize;
+}
+/*****************************************************************
+* FUNCTION: zm_arenaGetUsed
+*
+* DESCRIPTION:
+*       Get arena used size.
+* INPUTS:
+*     arena : The arena.
+* RETURNS:
+*     arena used size.
+* NOTE:
+*     Walks the chunks.
+*****************************************************************/
+zm_size_t zm_arenaGetUsed(zm_arena_t *arena)
+{
+    zmArenaChunk_t *chunk;
+    zm_size_t used = (zm_size_t)(arena->cur - arena->chunk->begin);
+    
+    for(chunk = arena->chunk->prev; chunk; chunk = chunk->prev)
+    {
+        used += chunk->used;
+    }
+    return used;
+}
+/*****************************************************************
+* FUNCTION: zm_arenaGetMaxUsed
+*
+* DESCRIPTION:
+*       Get arena max used size.
+* INPUTS:
+*     arena : The arena.
+* RETURNS:
+*     arena max used size.
+* NOTE:
+*     If no set ZM_MEM_STATS to 1, It always returns 0.
+*****************************************************************/
+zm_size_t zm_arenaGetMaxUsed(zm_arena_t *arena)
+{
+#if ZM_MEM_STATS
+    zm_arenaUpdateMax(arena);
+    
+    return arena->maxUsedSize;
+#else
+    (void)arena;
+    return 0;
+#endif
+}
+/****************************************************** END OF FILE ******************************************************/
@@ -0,0 +1,240 @@
+/*****************************************************************
+* Copyright (C) 2021 zm. All rights reserved.                    *
+******************************************************************
+* ZM_MemArena.h
+*
+* DESCRIPTION:
+*     zm arena (bump) allocator for request-scoped memory.
+* AUTHOR:
+*     zm
+* CREATED DATE:
+*     2023/3/3
+* REVISION:
+*     v0.1
+*
+* MODIFICATION HISTORY
+* --------------------
+* $Log:$
+*
+*****************************************************************/
+#ifndef __ZM_MEMARENA_H__
+#define __ZM_MEMARENA_H__
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+/*************************************************************************************************************************
+ *                                                       INCLUDES                                                        *
+ *************************************************************************************************************************/
+#include "ZM_Memory.h"
+/*************************************************************************************************************************
+ *                                                        MACROS                                                         *
+ *************************************************************************************************************************/
+/** alignment of every arena allocation, same as zm_malloc */
+#define ZM_ARENA_ALIGN_SIZE     ZM_ALIGN_SIZE
+/*************************************************************************************************************************
+ *                                                      CONSTANTS                                                        *
+ *************************************************************************************************************************/
+
+/*************************************************************************************************************************
+ *                                                       TYPEDEFS                                                        *
+ *************************************************************************************************************************/
+/** Chunk header, chunks are linked newest first. */
+typedef struct zmArenaChunk
+{
+    struct zmArenaChunk *prev;  //!< older chunk, NULL for the first one
+    zm_uint8_t *begin;          //!< first usable byte
+    zm_uint8_t *end;            //!< past the last usable byte
+    zm_size_t used;             //!< bytes used, set when the chunk stops being current
+    zm_size_t size;             //!< whole chunk size, header included
+}zmArenaChunk_t;
+
+typedef struct zmArena
+{
+    zm_uint8_t *cur;            //!< next free byte of the current chunk
+    zm_uint8_t *end;            //!< end of the current chunk
+    zmArenaChunk_t *chunk;      //!< current chunk
+    zm_heap_t *heap;            //!< heap the chunks come from, NULL for zm_malloc
+    zm_size_t chunkSize;        //!< usable size of a new chunk
+    zm_size_t totalSize;        //!< bytes of all chunks held
+    zm_size_t maxUsedSize;      //!< high water mark, updated when memory is given back
+}zm_arena_t;
+
+/** Arena position, see zm_arenaMark. */
+typedef struct
+{
+    zmArenaChunk_t *chunk;
+    zm_uint8_t *cur;
+}zm_arenaMark_t;
+/*************************************************************************************************************************
+ *                                                   PUBLIC FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+
+/*****************************************************************
+* FUNCTION: zm_arenaCreate
+*
+* DESCRIPTION:
+*     Create an arena, control block and first chunk are one region.
+* INPUTS:
+*     heap : Heap the chunks come from, NULL for zm_malloc.
+*     chunkSize : Usable size of each chunk.
+* RETURNS:
+*     The arena.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     Requests larger than chunkSize get a chunk of their own.
+*****************************************************************/
+zm_arena_t *zm_arenaCreate(zm_heap_t *heap, zm_size_t chunkSize);
+/*****************************************************************
+* FUNCTION: zm_arenaDelete
+*
+* DESCRIPTION:
+*     Release an arena and all its chunks.
+* INPUTS:
+*     arena : The arena.
+* RETURNS:
+*     null
+* NOTE:
+*     null
+*****************************************************************/
+void zm_arenaDelete(zm_arena_t *arena);
+/*****************************************************************
+* FUNCTION: zm_arenaAllocSlow
+*
+* DESCRIPTION:
+*     Get a new chunk and allocate from it, called by zm_arenaAlloc.
+* INPUTS:
+*     arena : The arena.
+*     size : Size aligned to ZM_ARENA_ALIGN_SIZE.
+* RETURNS:
+*     The memory.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     null
+*****************************************************************/
+void *zm_arenaAllocSlow(zm_arena_t *arena, zm_size_t size);
+/*****************************************************************
+* FUNCTION: zm_arenaAlloc
+*
+* DESCRIPTION:
+*     Allocate from an arena.
+* INPUTS:
+*     arena : The arena.
+*     size : The number of bytes.
+* RETURNS:
+*     The memory, aligned to ZM_ARENA_ALIGN_SIZE.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     Never freed one by one, see zm_arenaRewind and zm_arenaReset.
+*     Inline, a pointer bump unless the chunk is full.
+*****************************************************************/
+static __inline void *zm_arenaAlloc(zm_arena_t *arena, zm_size_t size)
+{
+    zm_uint8_t *ptr = arena->cur;
+    
+    if(size > ~(zm_size_t)0 - (ZM_ARENA_ALIGN_SIZE - 1)) return NULL;
+    
+    size = ZM_ALIGN(size, ZM_ARENA_ALIGN_SIZE);
+    if(size > (zm_size_t)(arena->end - ptr))
+    {
+        return zm_arenaAllocSlow(arena, size);
+    }
+    arena->cur = ptr + size;
+    
+    return ptr;
+}
+/*****************************************************************
+* FUNCTION: zm_arenaMark
+*
+* DESCRIPTION:
+*     Remember the current arena position.
+* INPUTS:
+*     arena : The arena.
+* RETURNS:
+*     The position, for zm_arenaRewind.
+* NOTE:
+*     null
+*****************************************************************/
+static __inline zm_arenaMark_t zm_arenaMark(zm_arena_t *arena)
+{
+    zm_arenaMark_t mark;
+    
+    mark.chunk = arena->chunk;
+    mark.cur = arena->cur;
+    
+    return mark;
+}
+/*****************************************************************
+* FUNCTION: zm_arenaRewind
+*
+* DESCRIPTION:
+*     Release everything allocated since a mark.
+* INPUTS:
+*     arena : The arena.
+*     mark : Returned by zm_arenaMark on this arena.
+* RETURNS:
+*     null
+* NOTE:
+*     Chunks taken since the mark go back to the heap. Marks taken
+*     after this one become invalid.
+*****************************************************************/
+void zm_arenaRewind(zm_arena_t *arena, zm_arenaMark_t mark);
+/*****************************************************************
+* FUNCTION: zm_arenaReset
+*
+* DESCRIPTION:
+*     Release everything allocated from the arena.
+* INPUTS:
+*     arena : The arena.
+* RETURNS:
+*     null
+* NOTE:
+*     Only the first chunk is kept, ready for the next request.
+*****************************************************************/
+void zm_arenaReset(zm_arena_t *arena);
+/*****************************************************************
+* FUNCTION: zm_arenaGetTotal
+*
+* DESCRIPTION:
+*       Get arena footprint, all chunks with their headers.
+* INPUTS:
+*     arena : The arena.
+* RETURNS:
+*     arena total size.
+* NOTE:
+*     The chunks are heap blocks, zm_getMemUsed/zm_heapGetUsed count them too.
+*****************************************************************/
+zm_size_t zm_arenaGetTotal(zm_arena_t *arena);
+/*****************************************************************
+* FUNCTION: zm_arenaGetUsed
+*
+* DESCRIPTION:
+*       Get arena used size.
+* INPUTS:
+*     arena : The arena.
+* RETURNS:
+*     arena used size.
+* NOTE:
+*     Walks the chunks.
+*****************************************************************/
+zm_size_t zm_arenaGetUsed(zm_arena_t *arena);
+/*****************************************************************
+* FUNCTION: zm_arenaGetMaxUsed
+*
+* DESCRIPTION:
+*       Get arena max used size.
+* INPUTS:
+*     arena : The arena.
+* RETURNS:
+*     arena max used size.
+* NOTE:
+*     If no set ZM_MEM_STATS to 1, It always returns 0.
+*****************************************************************/
+zm_size_t zm_arenaGetMaxUsed(zm_arena_t *arena);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* ZM_MemArena.h */
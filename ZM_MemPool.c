@@ -0,0 +1,287 @@
+/*****************************************************************
+* Copyright (C) 2021 zm. All rights reserved.                    *
+******************************************************************
+* ZM_MemPool.c
+*
+* DESCRIPTION:
+*     zm fixed-size memory pool.
+* AUTHOR:
+*     zm
+* CREATED DATE:
+*     2023/2/24
+* REVISION:
+*     v0.1
+*
+* MODIFICATION HISTORY
+* --------------------
+* $Log:$
+*
+*****************************************************************/
+ 
+/*************************************************************************************************************************
+ *                                                       INCLUDES                                                        *
+ *************************************************************************************************************************/
+#include <stddef.h>
+#include "ZM_MemPool.h"
+
+/*************************************************************************************************************************
+ *                                                        MACROS                                                         *
+ *************************************************************************************************************************/
+#define ZM_POOL_ALIGN_SIZE      sizeof(void *)
+
+/** next free slot, stored in the first word of a free slot */
+#define ZM_POOL_NEXT(slot)      (*(void **)(slot))
+/*************************************************************************************************************************
+ *                                                      CONSTANTS                                                        *
+ *************************************************************************************************************************/
+ 
+/*************************************************************************************************************************
+ *                                                       TYPEDEFS                                                        *
+ *************************************************************************************************************************/
+
+/*************************************************************************************************************************
+ *                                                   GLOBAL VARIABLES                                                    *
+ *************************************************************************************************************************/
+
+/*************************************************************************************************************************
+ *                                                  EXTERNAL VARIABLES                                                   *
+ *************************************************************************************************************************/
+ 
+/*************************************************************************************************************************
+ *                                                    LOCAL VARIABLES                                                    *
+ *************************************************************************************************************************/
+ 
+/*************************************************************************************************************************
+ *                                                 FUNCTION DECLARATIONS                                                 *
+ *************************************************************************************************************************/
+
+/*************************************************************************************************************************
+ *                                                   PUBLIC FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+ 
+/*****************************************************************
+* FUNCTION: zm_poolInit
+*
+* DESCRIPTION: 
+*     Build a pool of equal-size slots in a caller-supplied buffer.
+* INPUTS:
+*     pool : Pool control block.
+*     buffer : Memory carved into slots, owned by the caller.
+*     bufSize : Size of buffer in bytes.
+*     blockSize : Size of one slot.
+* RETURNS:
+*     Number of slots, 0 if buffer can not hold one slot.
+* NOTE:
+*     Slots have no header, blockSize is only rounded up to pointer size.
+*****************************************************************/
+zm_size_t zm_poolInit(zm_pool_t *pool, void *buffer, zm_size_t bufSize, zm_size_t blockSize)
+{
+    zm_uint8_t *slot;
+    zm_size_t pad;
+    zm_size_t idx;
+    
+    if(pool == NULL || buffer == NULL) return 0;
+    
+    pad = (zm_size_t)(ZM_ALIGN((size_t)buffer, ZM_POOL_ALIGN_SIZE) - (size_t)buffer);
+    
+    if(blockSize < sizeof(void *)) blockSize = sizeof(void *);
+    blockSize = ZM_ALIGN(blockSize, ZM_POOL_ALIGN_SIZE);
+    
+    pool->blockSize = blockSize;
+    pool->blockNum = bufSize > pad ? (bufSize - pad) / blockSize : 0;
+    pool->usedNum = 0;
+    pool->maxUsedNum = 0;
+    pool->region = NULL;
+    pool->begin = (zm_uint8_t *)buffer + pad;
+    pool->end = pool->begin + pool->blockNum * blockSize;
+    pool->freeList = NULL;
+    
+    // link from the last slot so the first alloc returns the lowest one.
+    for(idx = pool->blockNum; idx > 0; idx--)
+    {
+        slot = pool->begin + (idx - 1) * blockSize;
+        ZM_POOL_NEXT(slot) = pool->freeList;
+        pool->freeList = slot;
+    }
+    
+    return pool->blockNum;
+}
+/*****************************************************************
+* FUNCTION: zm_poolCreate
+*
+* DESCRIPTION: 
+*     Create a pool of blockNum slots, control block and slots are
+*     one pointer aligned region from zm_memalign.
+* INPUTS:
+*     blockSize : Size of one slot.
+*     blockNum : Number of slots.
+* RETURNS:
+*     The pool.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     null
+*****************************************************************/
+zm_pool_t *zm_poolCreate(zm_size_t blockSize, zm_size_t blockNum)
+{
+    zm_pool_t *pool;
+    zm_size_t head;
+    
+    if(blockNum == 0) return NULL;
+    
+    if(blockSize < sizeof(void *)) blockSize = sizeof(void *);
+    blockSize = ZM_ALIGN(blockSize, ZM_POOL_ALIGN_SIZE);
+    // the heap may align less than a pointer, control block and slots hold pointers.
+    head = ZM_ALIGN(sizeof(zm_pool_t), ZM_POOL_ALIGN_SIZE);
+    
+    if(blockNum > ((zm_size_t)~0UL - head) / blockSize) return NULL;
+    
+    pool = (zm_pool_t *)zm_memalign(ZM_POOL_ALIGN_SIZE, head + blockSize * blockNum);
+    if(pool == NULL) return NULL;
+    
+    zm_poolInit(pool, (zm_uint8_t *)pool + head, blockSize * blockNum, blockSize);
+    pool->region = pool;
+    
+    return pool;
+}
+/*****************************************************************
+* FUNCTION: zm_poolDelete
+*
+* DESCRIPTION: 
+*     Release a pool made by zm_poolCreate.
+* INPUTS:
+*     pool : The pool.
+* RETURNS:
+*     null
+* NOTE:
+*     Slots still in use become invalid.
+*****************************************************************/
+void zm_poolDelete(zm_pool_t *pool)
+{
+    if(pool == NULL) return;
+    
+    if(pool->region)
+    {
+        zm_free(pool->region);
+    }
+}
+/*****************************************************************
+* FUNCTION: zm_poolAlloc
+*
+* DESCRIPTION: 
+*     Take one slot from the pool.
+* INPUTS:
+*     pool : The pool.
+* RETURNS:
+*     The slot.
+*     NULL : faild, all slots are in use.
+* NOTE:
+*     null
+*****************************************************************/
+void *zm_poolAlloc(zm_pool_t *pool)
+{
+    void *slot = pool->freeList;
+    
+    if(slot == NULL) return NULL;
+    
+    pool->freeList = ZM_POOL_NEXT(slot);
+    
+#if ZM_MEM_STATS
+    pool->usedNum++;
+    if(pool->maxUsedNum < pool->usedNum)
+    {
+        pool->maxUsedNum = pool->usedNum;
+    }
+#endif
+    
+    return slot;
+}
+/*****************************************************************
+* FUNCTION: zm_poolFree
+*
+* DESCRIPTION: 
+*     Give a slot back to its pool.
+* INPUTS:
+*     pool : The pool the slot came from.
+*     ptr : The slot returned by zm_poolAlloc().
+* RETURNS:
+*     null
+* NOTE:
+*     null
+*****************************************************************/
+void zm_poolFree(zm_pool_t *pool, void *ptr)
+{
+    if(ptr == NULL) return;
+    
+    if((zm_uint8_t *)ptr < pool->begin || (zm_uint8_t *)ptr >= pool->end ||
+       ((zm_uint8_t *)ptr - pool->begin) % pool->blockSize != 0)
+    {
+        //illegal memory
+        return;
+    }
+    
+    ZM_POOL_NEXT(ptr) = pool->freeList;
+    pool->freeList = ptr;
+    
+#if ZM_MEM_STATS
+    pool->usedNum--;
+#endif
+}
+/*****************************************************************
+* FUNCTION: zm_poolGetTotal
+*
+* DESCRIPTION: 
+*       Get pool total size, slot size times slot count.
+* INPUTS:
+*     pool : The pool.
+* RETURNS:
+*     pool total size.
+* NOTE:
+*     null
+*****************************************************************/
+zm_size_t zm_poolGetTotal(zm_pool_t *pool)
+{
+    return pool->blockSize * pool->blockNum;
+}
+/*****************************************************************
+* FUNCTION: zm_poolGetUsed
+*
+* DESCRIPTION: 
+*       Get pool used size.
+* INPUTS:
+*     pool : The pool.
+* RETURNS:
+*     pool used size.
+* NOTE:
+*     If no set ZM_MEM_STATS to 1, It always returns 0.
+*****************************************************************/
+zm_size_t zm_poolGetUsed(zm_pool_t *pool)
+{
+#if ZM_MEM_STATS
+    return pool->blockSize * pool->usedNum;
+#else
+    (void)pool;
+    return 0;
+#endif
+}
+/*****************************************************************
+* FUNCTION: zm_poolGetMaxUsed
+*
+* DESCRIPTION: 
+*       Get pool max used size.
+* INPUTS:
+*     pool : The pool.
+* RETURNS:
+*     pool max used size.
+* NOTE:
+*     If no set ZM_MEM_STATS to 1, It always returns 0.
+*****************************************************************/
+zm_size_t zm_poolGetMaxUsed(zm_pool_t *pool)
+{
+#if ZM_MEM_STATS
+    return pool->blockSize * pool->maxUsedNum;
+#else
+    (void)pool;
+    return 0;
+#endif
+}
+/****************************************************** END OF FILE ******************************************************/
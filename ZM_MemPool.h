@@ -0,0 +1,174 @@
+/*****************************************************************
+* Copyright (C) 2021 zm. All rights reserved.                    *
+******************************************************************
+* ZM_MemPool.h
+*
+* DESCRIPTION:
+*     zm fixed-size memory pool.
+* AUTHOR:
+*     zm
+* CREATED DATE:
+*     2023/2/24
+* REVISION:
+*     v0.1
+*
+* MODIFICATION HISTORY
+* --------------------
+* $Log:$
+*
+*****************************************************************/
+#ifndef __ZM_MEMPOOL_H__
+#define __ZM_MEMPOOL_H__
+ 
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+/*************************************************************************************************************************
+ *                                                       INCLUDES                                                        *
+ *************************************************************************************************************************/
+#include "ZM_Memory.h"
+/*************************************************************************************************************************
+ *                                                        MACROS                                                         *
+ *************************************************************************************************************************/ 
+
+/*************************************************************************************************************************
+ *                                                      CONSTANTS                                                        *
+ *************************************************************************************************************************/
+ 
+/*************************************************************************************************************************
+ *                                                       TYPEDEFS                                                        *
+ *************************************************************************************************************************/
+typedef struct zmPool
+{
+    zm_uint8_t *begin;          //!< first slot
+    zm_uint8_t *end;            //!< past the last slot
+    void *freeList;             //!< LIFO list of free slots, linked through the slots
+    zm_size_t blockSize;        //!< slot size, pointer aligned
+    zm_size_t blockNum;         //!< number of slots
+    zm_size_t usedNum;          //!< slots handed out
+    zm_size_t maxUsedNum;       //!< high water mark of usedNum
+    void *region;               //!< zm_memalign region to release, NULL for a caller buffer
+}zm_pool_t;
+/*************************************************************************************************************************
+ *                                                   PUBLIC FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+
+/*****************************************************************
+* FUNCTION: zm_poolInit
+*
+* DESCRIPTION: 
+*     Build a pool of equal-size slots in a caller-supplied buffer.
+* INPUTS:
+*     pool : Pool control block.
+*     buffer : Memory carved into slots, owned by the caller.
+*     bufSize : Size of buffer in bytes.
+*     blockSize : Size of one slot.
+* RETURNS:
+*     Number of slots, 0 if buffer can not hold one slot.
+* NOTE:
+*     Slots have no header, blockSize is only rounded up to pointer size.
+*****************************************************************/
+zm_size_t zm_poolInit(zm_pool_t *pool, void *buffer, zm_size_t bufSize, zm_size_t blockSize);
+/*****************************************************************
+* FUNCTION: zm_poolCreate
+*
+* DESCRIPTION: 
+*     Create a pool of blockNum slots, control block and slots are
+*     one pointer aligned region from zm_memalign.
+* INPUTS:
+*     blockSize : Size of one slot.
+*     blockNum : Number of slots.
+* RETURNS:
+*     The pool.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     null
+*****************************************************************/
+zm_pool_t *zm_poolCreate(zm_size_t blockSize, zm_size_t blockNum);
+/*****************************************************************
+* FUNCTION: zm_poolDelete
+*
+* DESCRIPTION: 
+*     Release a pool made by zm_poolCreate.
+* INPUTS:
+*     pool : The pool.
+* RETURNS:
+*     null
+* NOTE:
+*     Slots still in use become invalid.
+*****************************************************************/
+void zm_poolDelete(zm_pool_t *pool);
+/*****************************************************************
+* FUNCTION: zm_poolAlloc
+*
+* DESCRIPTION: 
+*     Take one slot from the pool.
+* INPUTS:
+*     pool : The pool.
+* RETURNS:
+*     The slot.
+*     NULL : faild, all slots are in use.
+* NOTE:
+*     null
+*****************************************************************/
+void *zm_poolAlloc(zm_pool_t *pool);
+/*****************************************************************
+* FUNCTION: zm_poolFree
+*
+* DESCRIPTION: 
+*     Give a slot back to its pool.
+* INPUTS:
+*     pool : The pool the slot came from.
+*     ptr : The slot returned by zm_poolAlloc().
+* RETURNS:
+*     null
+* NOTE:
+*     null
+*****************************************************************/
+void zm_poolFree(zm_pool_t *pool, void *ptr);
+/*****************************************************************
+* FUNCTION: zm_poolGetTotal
+*
+* DESCRIPTION: 
+*       Get pool total size, slot size times slot count.
+* INPUTS:
+*     pool : The pool.
+* RETURNS:
+*     pool total size.
+* NOTE:
+*     null
+*****************************************************************/
+zm_size_t zm_poolGetTotal(zm_pool_t *pool);
+/*****************************************************************
+* FUNCTION: zm_poolGetUsed
+*
+* DESCRIPTION: 
+*       Get pool used size.
+* INPUTS:
+*     pool : The pool.
+* RETURNS:
+*     pool used size.
+* NOTE:
+*     If no set ZM_MEM_STATS to 1, It always returns 0.
+*****************************************************************/
+zm_size_t zm_poolGetUsed(zm_pool_t *pool);
+/*****************************************************************
+* FUNCTION: zm_poolGetMaxUsed
+*
+* DESCRIPTION: 
+*       Get pool max used size.
+* INPUTS:
+*     pool : The pool.
+* RETURNS:
+*     pool max used size.
+* NOTE:
+*     If no set ZM_MEM_STATS to 1, It always returns 0.
+*****************************************************************/
+zm_size_t zm_poolGetMaxUsed(zm_pool_t *pool);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* ZM_MemPool.h */
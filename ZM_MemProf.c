@@ -0,0 +1,581 @@
+/*****************************************************************
+* Copyright (C) 2021 zm. All rights reserved.                    *
+******************************************************************
+* ZM_MemProf.c
+*
+* DESCRIPTION:
+*     zm sampling heap profiler.
+* AUTHOR:
+*     zm
+* CREATED DATE:
+*     2023/3/6
+* REVISION:
+*     v0.1
+*
+* MODIFICATION HISTORY
+* --------------------
+* $Log:$
+*
+*****************************************************************/
+
+/*************************************************************************************************************************
+ *                                                       INCLUDES                                                        *
+ *************************************************************************************************************************/
+#include <stdio.h>
+#include "ZM_MemProf.h"
+#if defined(__GLIBC__)
+#include <execinfo.h>
+#endif
+#if ZM_MEM_THREAD_CACHE
+#include <pthread.h>
+#endif
+
+#if ZM_MEM_PROF
+/*************************************************************************************************************************
+ *                                                        MACROS                                                         *
+ *************************************************************************************************************************/
+#if (ZM_MEM_PROF_LIVE % 8) || (ZM_MEM_PROF_SITES > 65535)
+#error "ZM_MEM_PROF_LIVE must be a multiple of 8, ZM_MEM_PROF_SITES at most 65535"
+#endif
+
+/** interval drawn while sampling is stopped, to look at the rate again */
+#define ZM_PROF_IDLE            ((ptrdiff_t)64 << 20)
+/** longest interval, a sample at least every 1 GiB */
+#define ZM_PROF_MAX             ((ptrdiff_t)1 << 30)
+
+#if ZM_MEM_THREAD_CACHE
+#define ZM_PROF_LOCK()          pthread_mutex_lock(&profLock)
+#define ZM_PROF_UNLOCK()        pthread_mutex_unlock(&profLock)
+#define ZM_PROF_LOAD(slot)      __atomic_load_n(&(slot), __ATOMIC_ACQUIRE)
+#define ZM_PROF_STORE(slot, v)  __atomic_store_n(&(slot), v, __ATOMIC_RELEASE)
+#else
+#define ZM_PROF_LOCK()
+#define ZM_PROF_UNLOCK()
+#define ZM_PROF_LOAD(slot)      (slot)
+#define ZM_PROF_STORE(slot, v)  ((slot) = (v))
+#endif
+/*************************************************************************************************************************
+ *                                                      CONSTANTS                                                        *
+ *************************************************************************************************************************/
+
+/*************************************************************************************************************************
+ *                                                       TYPEDEFS                                                        *
+ *************************************************************************************************************************/
+/** Samples of one call stack. */
+typedef struct
+{
+    void *pc[ZM_MEM_PROF_DEPTH];
+    /** frames in pc, 0: entry not used */
+    zm_uint32_t depth;
+    zm_uint32_t hash;
+    /** every sample taken, for the pprof alloc columns */
+    zm_size_t allocCount;
+    zm_size_t allocBytes;
+    /** samples not freed yet */
+    zm_size_t liveCount;
+    zm_size_t liveBytes;
+    /** liveBytes scaled by the sampling probability, estimated live bytes of the site */
+    zm_size_t liveWeight;
+}zmProfSite_t;
+/*************************************************************************************************************************
+ *                                                   GLOBAL VARIABLES                                                    *
+ *************************************************************************************************************************/
+ZM_PROF_TLS ptrdiff_t zmProfCountdown;
+zm_uint32_t zmProfLiveNum;
+/*************************************************************************************************************************
+ *                                                  EXTERNAL VARIABLES                                                   *
+ *************************************************************************************************************************/
+
+/*************************************************************************************************************************
+ *                                                    LOCAL VARIABLES                                                    *
+ *************************************************************************************************************************/
+static zmProfSite_t profSite[ZM_MEM_PROF_SITES];
+
+/** sampled blocks, a block lives in the group of 8 slots its address hashes to */
+static void *profLive[ZM_MEM_PROF_LIVE];
+static zm_uint16_t profLiveSite[ZM_MEM_PROF_LIVE];
+static zm_size_t profLiveSize[ZM_MEM_PROF_LIVE];
+static zm_size_t profLiveWeight[ZM_MEM_PROF_LIVE];
+
+static zm_size_t profRate = ZM_MEM_PROF_RATE;
+
+/** xorshift state of this thread, 0 before its first sample */
+static ZM_PROF_TLS unsigned long long profRandom;
+
+#if ZM_MEM_THREAD_CACHE
+static pthread_mutex_t profLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+/*************************************************************************************************************************
+ *                                                 FUNCTION DECLARATIONS                                                 *
+ *************************************************************************************************************************/
+
+/*************************************************************************************************************************
+ *                                                    LOCAL FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+
+/* -ln(u) for u in (0, 1], no libm: u = m * 2^-e with m in [0.5, 1), then atanh series of m */
+static double zm_profLogNeg(double u)
+{
+    double t;
+    double t2;
+    zm_uint32_t e = 0;
+    
+    while(u < 0.5)
+    {
+        u *= 2;
+        e++;
+    }
+    t = (u - 1) / (u + 1);
+    t2 = t * t;
+    
+    return e * 0.6931471805599453 - 2 * t * (1 + t2 * (1.0 / 3 + t2 * (1.0 / 5 + t2 * (1.0 / 7 + t2 / 9))));
+}
+
+/* 1 - e^-x for x >= 0, the chance an allocation of x times the rate is sampled */
+static double zm_profProb(double x)
+{
+    double e;
+    zm_uint32_t k = 0;
+    
+    if(x > 40) return 1;
+    
+    while(x > 0.5)
+    {
+        x /= 2;
+        k++;
+    }
+    if(k == 0) return x * (1 - x / 2 * (1 - x / 3 * (1 - x / 4 * (1 - x / 5 * (1 - x / 6)))));
+    
+    e = 1 - x * (1 - x / 2 * (1 - x / 3 * (1 - x / 4 * (1 - x / 5 * (1 - x / 6)))));
+    while(k--)
+    {
+        e *= e;
+    }
+    return 1 - e;
+}
+
+/* bytes to the next sample, exponential with mean rate */
+static ptrdiff_t zm_profNext(zm_size_t rate)
+{
+    unsigned long long r = profRandom;
+    double next;
+    
+    if(rate == 0) return ZM_PROF_IDLE;
+    
+    r ^= r >> 12;
+    r ^= r << 25;
+    r ^= r >> 27;
+    profRandom = r;
+    
+    // 53 random bits, u in (0, 1]
+    next = zm_profLogNeg(((r * 2685821657736338717ULL >> 11) + 1) * (1.0 / 9007199254740992.0)) * rate;
+    
+    return next < (double)ZM_PROF_MAX ? (ptrdiff_t)next : ZM_PROF_MAX;
+}
+
+/* first slot of the group of ptr */
+static zm_uint32_t zm_profGroup(void *ptr)
+{
+    zm_uint32_t hash = (zm_uint32_t)((zm_uintptr_t)ptr / ZM_ALIGN_SIZE) * 2654435761u;
+    
+    return (zm_uint32_t)(((unsigned long long)hash * (ZM_MEM_PROF_LIVE / 8)) >> 32) * 8;
+}
+
+/*****************************************************************
+* FUNCTION: zm_profSite
+*
+* DESCRIPTION: 
+*     Find or add the site of a call stack.
+* INPUTS:
+*     pc : Return addresses, innermost first.
+*     depth : Frames in pc, at least 1.
+* RETURNS:
+*     Index of the site.
+*     ZM_MEM_PROF_SITES : the table is full.
+* NOTE:
+*     Profiler lock held.
+*****************************************************************/
+static zm_uint32_t zm_profSite(void **pc, zm_uint32_t depth)
+{
+    zm_uint32_t hash = 2166136261u;
+    zm_uint32_t idx;
+    zm_uint32_t n;
+    zm_uint32_t i;
+    
+    for(i = 0; i < depth; i++)
+    {
+        hash = (hash ^ (zm_uint32_t)((zm_uintptr_t)pc[i] >> 2)) * 16777619u;
+    }
+    
+    idx = hash % ZM_MEM_PROF_SITES;
+    for(n = 0; n < ZM_MEM_PROF_SITES; n++)
+    {
+        zmProfSite_t *site = &profSite[idx];
+        
+        if(site->depth == 0)
+        {
+            for(i = 0; i < depth; i++)
+            {
+                site->pc[i] = pc[i];
+            }
+            site->depth = depth;
+            site->hash = hash;
+            return idx;
+        }
+        if(site->hash == hash && site->depth == depth)
+        {
+            for(i = 0; i < depth && site->pc[i] == pc[i]; i++);
+            
+            if(i == depth) return idx;
+        }
+        if(++idx == ZM_MEM_PROF_SITES) idx = 0;
+    }
+    return ZM_MEM_PROF_SITES;
+}
+
+/*****************************************************************
+* FUNCTION: zm_profRecord
+*
+* DESCRIPTION: 
+*     Add a sampled block to its site and to the live table.
+* INPUTS:
+*     size : Requested size.
+*     ptr : The block.
+*     pc : Its call stack, innermost first.
+*     depth : Frames in pc.
+*     rate : Sampling rate it was taken at.
+* RETURNS:
+*     null
+* NOTE:
+*     The sample is counted as allocated but not kept live when the
+*     group of ptr is full.
+*****************************************************************/
+static void zm_profRecord(zm_size_t size, void *ptr, void **pc, zm_uint32_t depth, zm_size_t rate)
+{
+    zm_uint32_t slot = zm_profGroup(ptr);
+    zm_uint32_t end = slot + 8;
+    zm_size_t weight = (zm_size_t)(size / zm_profProb((double)size / rate));
+    zm_uint32_t idx;
+    zmProfSite_t *site;
+    
+    ZM_PROF_LOCK();
+    
+    idx = zm_profSite(pc, depth);
+    if(idx == ZM_MEM_PROF_SITES)
+    {
+        ZM_PROF_UNLOCK();
+        return;
+    }
+    site = &profSite[idx];
+    site->allocCount++;
+    site->allocBytes += size;
+    
+    while(slot < end && profLive[slot]) slot++;
+    
+    if(slot < end)
+    {
+        site->liveCount++;
+        site->liveBytes += size;
+        site->liveWeight += weight;
+        
+        profLiveSite[slot] = (zm_uint16_t)idx;
+        profLiveSize[slot] = size;
+        profLiveWeight[slot] = weight;
+        ZM_PROF_STORE(profLive[slot], ptr);
+        zmProfLiveNum++;
+    }
+    
+    ZM_PROF_UNLOCK();
+}
+
+/* one pprof record or folded stack line, 0 when there is nothing to write */
+static int zm_profLine(char *line, zm_size_t len, zm_uint8_t format, const zmProfSite_t *site)
+{
+    int n;
+    zm_uint32_t i;
+    
+    if(format == ZM_PROF_FOLDED)
+    {
+        if(site->liveCount == 0) return 0;
+        
+        n = 0;
+        for(i = site->depth; i-- > 0;)
+        {
+            n += snprintf(line + n, len - n, i ? "0x%llx;" : "0x%llx", (unsigned long long)(zm_uintptr_t)site->pc[i]);
+        }
+        n += snprintf(line + n, len - n, " %lu\n", (unsigned long)site->liveWeight);
+    }
+    else
+    {
+        n = snprintf(line, len, "%6lu: %8lu [%6lu: %8lu] @", (unsigned long)site->liveCount,
+                     (unsigned long)site->liveBytes, (unsigned long)site->allocCount,
+                     (unsigned long)site->allocBytes);
+        for(i = 0; i < site->depth; i++)
+        {
+            n += snprintf(line + n, len - n, " 0x%llx", (unsigned long long)(zm_uintptr_t)site->pc[i]);
+        }
+        n += snprintf(line + n, len - n, "\n");
+    }
+    return n;
+}
+
+#if ZM_MEM_PROF_FILE
+static void zm_profFileWrite(void *ctx, const char *text, zm_size_t len)
+{
+    fwrite(text, 1, len, (FILE *)ctx);
+}
+#endif
+/*************************************************************************************************************************
+ *                                                   PUBLIC FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+
+/*****************************************************************
+* FUNCTION: zm_profSample
+*
+* DESCRIPTION: 
+*     Slow path of ZM_MEM_PROF_ALLOC, the countdown ran out.
+* INPUTS:
+*     size : Requested size.
+*     ptr : Block returned, NULL when the allocation faild.
+*     caller : Return address of the zm_malloc family call.
+* RETURNS:
+*     null
+* NOTE:
+*     Records the call stack of ptr and draws the next interval.
+*     caller stands for the stack when zm_profBacktrace gives none.
+*****************************************************************/
+void zm_profSample(zm_size_t size, void *ptr, void *caller)
+{
+    void *pc[ZM_MEM_PROF_DEPTH];
+    zm_size_t rate = profRate;
+    zm_uint32_t depth;
+    
+    if(profRandom == 0)
+    {
+        // first allocation of this thread, the countdown starts here
+        profRandom = ((unsigned long long)(zm_uintptr_t)&zmProfCountdown << 16) ^ 0x9E3779B97F4A7C15ULL;
+        zmProfCountdown += zm_profNext(rate);
+        
+        if(zmProfCountdown >= 0) return;
+    }
+    zmProfCountdown = zm_profNext(rate);
+    
+    if(rate == 0 || ptr == NULL) return;
+    
+    // leave out this function and the zm_malloc family one
+    depth = zm_profBacktrace(pc, ZM_MEM_PROF_DEPTH, 2);
+    if(depth == 0)
+    {
+        pc[0] = caller;
+        depth = 1;
+    }
+    zm_profRecord(size, ptr, pc, depth, rate);
+}
+/*****************************************************************
+* FUNCTION: zm_profFree
+*
+* DESCRIPTION: 
+*     Drop the sample of a block that is freed.
+* INPUTS:
+*     ptr : The block.
+* RETURNS:
+*     null
+* NOTE:
+*     One hash and a scan of 8 slots when ptr was not sampled.
+*****************************************************************/
+void zm_profFree(void *ptr)
+{
+    zm_uint32_t slot;
+    zm_uint32_t end;
+    
+    if(ptr == NULL) return;
+    
+    slot = zm_profGroup(ptr);
+    end = slot + 8;
+    while(slot < end && ZM_PROF_LOAD(profLive[slot]) != ptr) slot++;
+    
+    if(slot == end) return;
+    
+    ZM_PROF_LOCK();
+    if(profLive[slot] == ptr)
+    {
+        zmProfSite_t *site = &profSite[profLiveSite[slot]];
+        
+        site->liveCount--;
+        site->liveBytes -= profLiveSize[slot];
+        site->liveWeight -= profLiveWeight[slot];
+        
+        ZM_PROF_STORE(profLive[slot], NULL);
+        zmProfLiveNum--;
+    }
+    ZM_PROF_UNLOCK();
+}
+/*****************************************************************
+* FUNCTION: zm_profSetRate
+*
+* DESCRIPTION: 
+*     Change the mean sampling interval.
+* INPUTS:
+*     rate : Bytes, 0 stops sampling.
+* RETURNS:
+*     null
+* NOTE:
+*     Each thread picks it up at its next sample, while stopped it
+*     looks again every 64 MiB it allocates. Samples already taken
+*     are kept.
+*****************************************************************/
+void zm_profSetRate(zm_size_t rate)
+{
+    profRate = rate;
+}
+/*****************************************************************
+* FUNCTION: zm_profWrite
+*
+* DESCRIPTION: 
+*     Write the live samples, summed per call stack.
+* INPUTS:
+*     format : ZM_PROF_PPROF or ZM_PROF_FOLDED.
+*     write : Called with each piece of text.
+*     ctx : Passed to write.
+* RETURNS:
+*     null
+* NOTE:
+*     ZM_PROF_PPROF counts are the samples as taken, pprof scales them
+*     by the rate in the header. ZM_PROF_FOLDED values are estimated
+*     live bytes. Frames are return addresses in hex, symbolize them
+*     with the binary (pprof, addr2line). write may allocate.
+*****************************************************************/
+void zm_profWrite(zm_uint8_t format, zm_memWrite_t write, void *ctx)
+{
+    char line[ZM_MEM_PROF_DEPTH * 20 + 128];
+    zmProfSite_t site;
+    zm_uint32_t idx;
+    int n;
+    
+    if(format == ZM_PROF_PPROF)
+    {
+        zm_size_t total[4] = {0, 0, 0, 0};
+        
+        ZM_PROF_LOCK();
+        for(idx = 0; idx < ZM_MEM_PROF_SITES; idx++)
+        {
+            total[0] += profSite[idx].liveCount;
+            total[1] += profSite[idx].liveBytes;
+            total[2] += profSite[idx].allocCount;
+            total[3] += profSite[idx].allocBytes;
+        }
+        ZM_PROF_UNLOCK();
+        
+        n = snprintf(line, sizeof(line), "heap profile: %6lu: %8lu [%6lu: %8lu] @ heap_v2/%lu\n",
+                     (unsigned long)total[0], (unsigned long)total[1], (unsigned long)total[2],
+                     (unsigned long)total[3], (unsigned long)profRate);
+        write(ctx, line, (zm_size_t)n);
+    }
+    
+    for(idx = 0; idx < ZM_MEM_PROF_SITES; idx++)
+    {
+        // copy out, write may allocate and sample
+        ZM_PROF_LOCK();
+        site = profSite[idx];
+        ZM_PROF_UNLOCK();
+        
+        if(site.depth == 0) continue;
+        
+        n = zm_profLine(line, sizeof(line), format, &site);
+        if(n > 0) write(ctx, line, (zm_size_t)n);
+    }
+}
+/*****************************************************************
+* FUNCTION: zm_profBacktrace
+*
+* DESCRIPTION: 
+*     Call stack source of the profiler.
+* INPUTS:
+*     pc : Filled with return addresses, innermost first.
+*     depth : Size of pc.
+*     skip : Innermost frames to leave out, the profiler's own.
+* RETURNS:
+*     Number of addresses filled.
+* NOTE:
+*     It's weak functions, you can redefine it. The default uses
+*     backtrace() with glibc and gives nothing elsewhere, the caller
+*     of the zm function is used then.
+*****************************************************************/
+__ZM_WEAK zm_uint32_t zm_profBacktrace(void **pc, zm_uint32_t depth, zm_uint32_t skip)
+{
+#if defined(__GLIBC__)
+    void *frame[ZM_MEM_PROF_DEPTH + 8];
+    zm_uint32_t got;
+    zm_uint32_t i;
+    
+    // this function too
+    skip++;
+    if(depth + skip > ZM_MEM_PROF_DEPTH + 8) depth = ZM_MEM_PROF_DEPTH + 8 - skip;
+    
+    got = (zm_uint32_t)backtrace(frame, (int)(depth + skip));
+    if(got <= skip) return 0;
+    
+    for(i = skip; i < got; i++)
+    {
+        pc[i - skip] = frame[i];
+    }
+    return got - skip;
+#else
+    (void)pc;
+    (void)depth;
+    (void)skip;
+    
+    return 0;
+#endif
+}
+
+#if ZM_MEM_PROF_FILE
+/*****************************************************************
+* FUNCTION: zm_profDump
+*
+* DESCRIPTION: 
+*     Write the profile to a file.
+* INPUTS:
+*     path : File to create.
+*     format : ZM_PROF_PPROF or ZM_PROF_FOLDED.
+* RETURNS:
+*     0 : success.
+*     -1 : the file can not be created.
+* NOTE:
+*     ZM_PROF_PPROF ends with the memory map of the process on Linux,
+*     so pprof can symbolize a position independent binary.
+*****************************************************************/
+zm_int32_t zm_profDump(const char *path, zm_uint8_t format)
+{
+    FILE *file = fopen(path, "w");
+    
+    if(file == NULL) return -1;
+    
+    zm_profWrite(format, zm_profFileWrite, file);
+
+#if defined(__linux__)
+    if(format == ZM_PROF_PPROF)
+    {
+        FILE *maps = fopen("/proc/self/maps", "r");
+        char buf[512];
+        size_t len;
+        
+        if(maps)
+        {
+            fputs("\nMAPPED_LIBRARIES:\n", file);
+            while((len = fread(buf, 1, sizeof(buf), maps)) > 0)
+            {
+                fwrite(buf, 1, len, file);
+            }
+            fclose(maps);
+        }
+    }
+#endif
+
+    fclose(file);
+    return 0;
+}
+#endif
+
+#endif
+/****************************************************** END OF FILE ******************************************************/
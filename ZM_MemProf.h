@@ -0,0 +1,211 @@
+/*****************************************************************
+* Copyright (C) 2021 zm. All rights reserved.                    *
+******************************************************************
+* ZM_MemProf.h
+*
+* DESCRIPTION:
+*     zm sampling heap profiler.
+*     About one allocation of the default memory in every
+*     ZM_MEM_PROF_RATE bytes is sampled: its call stack is recorded
+*     and it stays in a table of live samples until it is freed.
+*     Samples are summed per call stack and written on demand as a
+*     pprof heap profile or as folded stacks.
+* AUTHOR:
+*     zm
+* CREATED DATE:
+*     2023/3/6
+* REVISION:
+*     v0.1
+*
+* MODIFICATION HISTORY
+* --------------------
+* $Log:$
+*
+*****************************************************************/
+#ifndef __ZM_MEMPROF_H__
+#define __ZM_MEMPROF_H__
+ 
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+/*************************************************************************************************************************
+ *                                                       INCLUDES                                                        *
+ *************************************************************************************************************************/
+#include "ZM_Memory.h"
+/*************************************************************************************************************************
+ *                                                        MACROS                                                         *
+ *************************************************************************************************************************/
+/** mean bytes allocated between two samples, the interval is drawn from an exponential distribution */
+#ifndef ZM_MEM_PROF_RATE
+#define ZM_MEM_PROF_RATE        (512u * 1024)
+#endif
+/** frames kept per sample */
+#ifndef ZM_MEM_PROF_DEPTH
+#define ZM_MEM_PROF_DEPTH       16
+#endif
+/** distinct call stacks, samples from more are dropped */
+#ifndef ZM_MEM_PROF_SITES
+#define ZM_MEM_PROF_SITES       512
+#endif
+/** live samples, a multiple of 8, a sample whose group of 8 slots is full is dropped */
+#ifndef ZM_MEM_PROF_LIVE
+#define ZM_MEM_PROF_LIVE        4096
+#endif
+/** 1: zm_profDump writes the profile to a file (hosted targets) */
+#ifndef ZM_MEM_PROF_FILE
+#define ZM_MEM_PROF_FILE        1
+#endif
+
+#if ZM_MEM_THREAD_CACHE
+#define ZM_PROF_TLS             __thread
+#else
+#define ZM_PROF_TLS
+#endif
+
+/**
+ * Called by the zm_malloc family after each allocation of the default
+ * memory. All it costs when the sample is not hit is the decrement.
+ */
+#define ZM_MEM_PROF_ALLOC(size, ptr)                                \
+do{                                                                 \
+    if((zmProfCountdown -= (ptrdiff_t)(size)) < 0)                  \
+    {                                                               \
+        zm_profSample(size, ptr, __builtin_return_address(0));      \
+    }                                                               \
+}while(0)
+
+/** Called by the zm_free family before a block goes back. */
+#define ZM_MEM_PROF_FREE(ptr)                                       \
+do{                                                                 \
+    if(zmProfLiveNum)                                               \
+    {                                                               \
+        zm_profFree(ptr);                                           \
+    }                                                               \
+}while(0)
+/*************************************************************************************************************************
+ *                                                      CONSTANTS                                                        *
+ *************************************************************************************************************************/
+/** pprof legacy heap profile, "heap profile: ... @ heap_v2/rate" */
+#define ZM_PROF_PPROF           1
+/** one "frame;frame;... bytes" line per call stack, outermost frame first */
+#define ZM_PROF_FOLDED          2
+/*************************************************************************************************************************
+ *                                                       TYPEDEFS                                                        *
+ *************************************************************************************************************************/
+
+/*************************************************************************************************************************
+ *                                                  EXTERNAL VARIABLES                                                   *
+ *************************************************************************************************************************/
+/** bytes left to the next sample of this thread */
+extern ZM_PROF_TLS ptrdiff_t zmProfCountdown;
+/** live samples, frees look the block up only when not 0 */
+extern zm_uint32_t zmProfLiveNum;
+/*************************************************************************************************************************
+ *                                                   PUBLIC FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+
+/*****************************************************************
+* FUNCTION: zm_profSample
+*
+* DESCRIPTION: 
+*     Slow path of ZM_MEM_PROF_ALLOC, the countdown ran out.
+* INPUTS:
+*     size : Requested size.
+*     ptr : Block returned, NULL when the allocation faild.
+*     caller : Return address of the zm_malloc family call.
+* RETURNS:
+*     null
+* NOTE:
+*     Records the call stack of ptr and draws the next interval.
+*     caller stands for the stack when zm_profBacktrace gives none.
+*****************************************************************/
+void zm_profSample(zm_size_t size, void *ptr, void *caller);
+/*****************************************************************
+* FUNCTION: zm_profFree
+*
+* DESCRIPTION: 
+*     Drop the sample of a block that is freed.
+* INPUTS:
+*     ptr : The block.
+* RETURNS:
+*     null
+* NOTE:
+*     One hash and a scan of 8 slots when ptr was not sampled.
+*****************************************************************/
+void zm_profFree(void *ptr);
+/*****************************************************************
+* FUNCTION: zm_profSetRate
+*
+* DESCRIPTION: 
+*     Change the mean sampling interval.
+* INPUTS:
+*     rate : Bytes, 0 stops sampling.
+* RETURNS:
+*     null
+* NOTE:
+*     Each thread picks it up at its next sample, while stopped it
+*     looks again every 64 MiB it allocates. Samples already taken
+*     are kept.
+*****************************************************************/
+void zm_profSetRate(zm_size_t rate);
+/*****************************************************************
+* FUNCTION: zm_profWrite
+*
+* DESCRIPTION: 
+*     Write the live samples, summed per call stack.
+* INPUTS:
+*     format : ZM_PROF_PPROF or ZM_PROF_FOLDED.
+*     write : Called with each piece of text.
+*     ctx : Passed to write.
+* RETURNS:
+*     null
+* NOTE:
+*     ZM_PROF_PPROF counts are the samples as taken, pprof scales them
+*     by the rate in the header. ZM_PROF_FOLDED values are estimated
+*     live bytes. Frames are return addresses in hex, symbolize them
+*     with the binary (pprof, addr2line). write may allocate.
+*****************************************************************/
+void zm_profWrite(zm_uint8_t format, zm_memWrite_t write, void *ctx);
+/*****************************************************************
+* FUNCTION: zm_profBacktrace
+*
+* DESCRIPTION: 
+*     Call stack source of the profiler.
+* INPUTS:
+*     pc : Filled with return addresses, innermost first.
+*     depth : Size of pc.
+*     skip : Innermost frames to leave out, the profiler's own.
+* RETURNS:
+*     Number of addresses filled.
+* NOTE:
+*     It's weak functions, you can redefine it. The default uses
+*     backtrace() with glibc and gives nothing elsewhere, the caller
+*     of the zm function is used then.
+*****************************************************************/
+zm_uint32_t zm_profBacktrace(void **pc, zm_uint32_t depth, zm_uint32_t skip);
+
+#if ZM_MEM_PROF_FILE
+/*****************************************************************
+* FUNCTION: zm_profDump
+*
+* DESCRIPTION: 
+*     Write the profile to a file.
+* INPUTS:
+*     path : File to create.
+*     format : ZM_PROF_PPROF or ZM_PROF_FOLDED.
+* RETURNS:
+*     0 : success.
+*     -1 : the file can not be created.
+* NOTE:
+*     ZM_PROF_PPROF ends with the memory map of the process on Linux,
+*     so pprof can symbolize a position independent binary.
+*****************************************************************/
+zm_int32_t zm_profDump(const char *path, zm_uint8_t format);
+#endif
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* ZM_MemProf.h */
@@ -0,0 +1,285 @@
+/*****************************************************************
+* Copyright (C) 2021 zm. All rights reserved.                    *
+******************************************************************
+* ZM_MemTrace.c
+*
+* DESCRIPTION:
+*     zm memory allocation trace recorder.
+* AUTHOR:
+*     zm
+* CREATED DATE:
+*     2023/2/24
+* REVISION:
+*     v0.1
+*
+* MODIFICATION HISTORY
+* --------------------
+* $Log:$
+*
+*****************************************************************/
+ 
+/*************************************************************************************************************************
+ *                                                       INCLUDES                                                        *
+ *************************************************************************************************************************/
+#include <stddef.h>
+#include "ZM_MemTrace.h"
+#if ZM_MEM_TRACE_FILE
+#include <stdio.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <time.h>
+#endif
+#if ZM_MEM_THREAD_CACHE
+#include <pthread.h>
+#endif
+
+#if ZM_MEM_TRACE
+/*************************************************************************************************************************
+ *                                                        MACROS                                                         *
+ *************************************************************************************************************************/
+#define ZM_TRACE_ID(ptr)        ((zm_uint32_t)((size_t)(ptr) / ZM_ALIGN_SIZE))
+
+#if ZM_MEM_THREAD_CACHE
+#define ZM_TRACE_LOCK()         pthread_mutex_lock(&traceLock)
+#define ZM_TRACE_UNLOCK()       pthread_mutex_unlock(&traceLock)
+#else
+#define ZM_TRACE_LOCK()
+#define ZM_TRACE_UNLOCK()
+#endif
+/*************************************************************************************************************************
+ *                                                      CONSTANTS                                                        *
+ *************************************************************************************************************************/
+ 
+/*************************************************************************************************************************
+ *                                                       TYPEDEFS                                                        *
+ *************************************************************************************************************************/
+
+/*************************************************************************************************************************
+ *                                                   GLOBAL VARIABLES                                                    *
+ *************************************************************************************************************************/
+
+/*************************************************************************************************************************
+ *                                                  EXTERNAL VARIABLES                                                   *
+ *************************************************************************************************************************/
+ 
+/*************************************************************************************************************************
+ *                                                    LOCAL VARIABLES                                                    *
+ *************************************************************************************************************************/
+static zmTraceRec_t traceBuf[ZM_MEM_TRACE_DEPTH];
+/** next slot to write */
+static zm_size_t traceHead;
+/** records in traceBuf */
+static zm_size_t traceCount;
+
+#if ZM_MEM_TRACE_FILE
+static FILE *traceFile;
+#endif
+
+#if ZM_MEM_THREAD_CACHE
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+/*************************************************************************************************************************
+ *                                                 FUNCTION DECLARATIONS                                                 *
+ *************************************************************************************************************************/
+
+/*************************************************************************************************************************
+ *                                                    LOCAL FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+
+/*****************************************************************
+* FUNCTION: zm_traceTake
+*
+* DESCRIPTION: 
+*     Copy and drop the oldest buffered records.
+* INPUTS:
+*     rec : Destination array.
+*     num : Size of rec.
+* RETURNS:
+*     Number of records copied.
+* NOTE:
+*     Trace lock held.
+*****************************************************************/
+static zm_size_t zm_traceTake(zmTraceRec_t *rec, zm_size_t num)
+{
+    zm_size_t tail = (traceHead + ZM_MEM_TRACE_DEPTH - traceCount) % ZM_MEM_TRACE_DEPTH;
+    zm_size_t idx;
+    
+    if(num > traceCount) num = traceCount;
+    
+    for(idx = 0; idx < num; idx++)
+    {
+        rec[idx] = traceBuf[(tail + idx) % ZM_MEM_TRACE_DEPTH];
+    }
+    traceCount -= num;
+    
+    return num;
+}
+
+#if ZM_MEM_TRACE_FILE
+static void zm_traceFlush(void)
+{
+    zm_size_t tail = (traceHead + ZM_MEM_TRACE_DEPTH - traceCount) % ZM_MEM_TRACE_DEPTH;
+    zm_size_t first = ZM_MEM_TRACE_DEPTH - tail;
+    
+    if(first > traceCount) first = traceCount;
+    
+    fwrite(&traceBuf[tail], sizeof(zmTraceRec_t), first, traceFile);
+    fwrite(&traceBuf[0], sizeof(zmTraceRec_t), traceCount - first, traceFile);
+    traceCount = 0;
+}
+#endif
+/*************************************************************************************************************************
+ *                                                   PUBLIC FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+
+/*****************************************************************
+* FUNCTION: zm_traceRecord
+*
+* DESCRIPTION: 
+*     Record one allocator call.
+* INPUTS:
+*     op : ZM_TRACE_xxx.
+*     size : Requested size.
+*     ptr : Block returned or freed.
+*     oldPtr : Realloc input block, else NULL.
+* RETURNS:
+*     null
+* NOTE:
+*     Called by zm_malloc, zm_calloc, zm_realloc and zm_free when
+*     ZM_MEM_TRACE is set. When the buffer is full the oldest record
+*     is lost, unless a file is open.
+*****************************************************************/
+void zm_traceRecord(zm_uint8_t op, zm_size_t size, void *ptr, void *oldPtr)
+{
+    zmTraceRec_t *rec;
+    
+    ZM_TRACE_LOCK();
+    
+    if(traceCount == ZM_MEM_TRACE_DEPTH)
+    {
+#if ZM_MEM_TRACE_FILE
+        if(traceFile)
+        {
+            zm_traceFlush();
+        }
+        else
+#endif
+        {
+            traceCount--;
+        }
+    }
+    
+    rec = &traceBuf[traceHead];
+    rec->time = zm_traceClock();
+    rec->size = (zm_uint32_t)size;
+    rec->id = ZM_TRACE_ID(ptr);
+    rec->oldId = ZM_TRACE_ID(oldPtr);
+    rec->op = op;
+    rec->reserved[0] = rec->reserved[1] = rec->reserved[2] = 0;
+    
+    traceHead = (traceHead + 1) % ZM_MEM_TRACE_DEPTH;
+    traceCount++;
+    
+    ZM_TRACE_UNLOCK();
+}
+/*****************************************************************
+* FUNCTION: zm_traceRead
+*
+* DESCRIPTION: 
+*     Take buffered records, oldest first.
+* INPUTS:
+*     rec : Destination array.
+*     num : Size of rec.
+* RETURNS:
+*     Number of records copied.
+* NOTE:
+*     null
+*****************************************************************/
+zm_size_t zm_traceRead(zmTraceRec_t *rec, zm_size_t num)
+{
+    ZM_TRACE_LOCK();
+    num = zm_traceTake(rec, num);
+    ZM_TRACE_UNLOCK();
+    
+    return num;
+}
+/*****************************************************************
+* FUNCTION: zm_traceClock
+*
+* DESCRIPTION: 
+*     Timestamp source of the trace.
+* INPUTS:
+*     null
+* RETURNS:
+*     Microseconds, wrapping.
+* NOTE:
+*     It's weak functions, you can redefine it. The default uses
+*     clock_gettime on POSIX targets and returns 0 elsewhere.
+*****************************************************************/
+__ZM_WEAK zm_uint32_t zm_traceClock(void)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (zm_uint32_t)(ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+#else
+    return 0;
+#endif
+}
+
+#if ZM_MEM_TRACE_FILE
+/*****************************************************************
+* FUNCTION: zm_traceOpen
+*
+* DESCRIPTION: 
+*     Start writing the trace to a file.
+* INPUTS:
+*     path : File to create.
+* RETURNS:
+*     0 : success.
+*     -1 : the file can not be created.
+* NOTE:
+*     null
+*****************************************************************/
+zm_int32_t zm_traceOpen(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    
+    if(file == NULL) return -1;
+    
+    ZM_TRACE_LOCK();
+    if(traceFile) fclose(traceFile);
+    traceFile = file;
+    traceCount = 0;
+    ZM_TRACE_UNLOCK();
+    
+    return 0;
+}
+/*****************************************************************
+* FUNCTION: zm_traceClose
+*
+* DESCRIPTION: 
+*     Write the buffered records and close the trace file.
+* INPUTS:
+*     null
+* RETURNS:
+*     null
+* NOTE:
+*     null
+*****************************************************************/
+void zm_traceClose(void)
+{
+    ZM_TRACE_LOCK();
+    if(traceFile)
+    {
+        zm_traceFlush();
+        fclose(traceFile);
+        traceFile = NULL;
+    }
+    ZM_TRACE_UNLOCK();
+}
+#endif
+
+#endif
+/****************************************************** END OF FILE ******************************************************/
@@ -0,0 +1,151 @@
+/*****************************************************************
+* Copyright (C) 2021 zm. All rights reserved.                    *
+******************************************************************
+* ZM_MemTrace.h
+*
+* DESCRIPTION:
+*     zm memory allocation trace recorder.
+* AUTHOR:
+*     zm
+* CREATED DATE:
+*     2023/2/24
+* REVISION:
+*     v0.1
+*
+* MODIFICATION HISTORY
+* --------------------
+* $Log:$
+*
+*****************************************************************/
+#ifndef __ZM_MEMTRACE_H__
+#define __ZM_MEMTRACE_H__
+ 
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+/*************************************************************************************************************************
+ *                                                       INCLUDES                                                        *
+ *************************************************************************************************************************/
+#include "ZM_Memory.h"
+/*************************************************************************************************************************
+ *                                                        MACROS                                                         *
+ *************************************************************************************************************************/ 
+/** records kept in RAM, when a file is open they are written each time the buffer is full */
+#ifndef ZM_MEM_TRACE_DEPTH
+#define ZM_MEM_TRACE_DEPTH      1024
+#endif
+/** 1: zm_traceOpen/zm_traceClose write the trace to a file (hosted targets) */
+#ifndef ZM_MEM_TRACE_FILE
+#define ZM_MEM_TRACE_FILE       1
+#endif
+/*************************************************************************************************************************
+ *                                                      CONSTANTS                                                        *
+ *************************************************************************************************************************/
+#define ZM_TRACE_MALLOC         1
+#define ZM_TRACE_CALLOC         2
+#define ZM_TRACE_REALLOC        3
+#define ZM_TRACE_FREE           4
+/*************************************************************************************************************************
+ *                                                       TYPEDEFS                                                        *
+ *************************************************************************************************************************/
+/**
+ * One traced call, 20 bytes, written to the file as is (host byte order).
+ * A pointer id is the address divided by ZM_ALIGN_SIZE, truncated to 32
+ * bits. Ids are unique among live blocks, which is all a replay needs.
+ */
+typedef struct zmTraceRec
+{
+    zm_uint32_t time;           //!< zm_traceClock() at the call, microseconds
+    zm_uint32_t size;           //!< requested size, count * size for calloc
+    zm_uint32_t id;             //!< returned block, or freed block, 0 for NULL
+    zm_uint32_t oldId;          //!< realloc input block, else 0
+    zm_uint8_t op;              //!< ZM_TRACE_xxx
+    zm_uint8_t reserved[3];
+}zmTraceRec_t;
+/*************************************************************************************************************************
+ *                                                   PUBLIC FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+
+/*****************************************************************
+* FUNCTION: zm_traceRecord
+*
+* DESCRIPTION: 
+*     Record one allocator call.
+* INPUTS:
+*     op : ZM_TRACE_xxx.
+*     size : Requested size.
+*     ptr : Block returned or freed.
+*     oldPtr : Realloc input block, else NULL.
+* RETURNS:
+*     null
+* NOTE:
+*     Called by zm_malloc, zm_calloc, zm_realloc and zm_free when
+*     ZM_MEM_TRACE is set. When the buffer is full the oldest record
+*     is lost, unless a file is open.
+*****************************************************************/
+void zm_traceRecord(zm_uint8_t op, zm_size_t size, void *ptr, void *oldPtr);
+/*****************************************************************
+* FUNCTION: zm_traceRead
+*
+* DESCRIPTION: 
+*     Take buffered records, oldest first.
+* INPUTS:
+*     rec : Destination array.
+*     num : Size of rec.
+* RETURNS:
+*     Number of records copied.
+* NOTE:
+*     null
+*****************************************************************/
+zm_size_t zm_traceRead(zmTraceRec_t *rec, zm_size_t num);
+/*****************************************************************
+* FUNCTION: zm_traceClock
+*
+* DESCRIPTION: 
+*     Timestamp source of the trace.
+* INPUTS:
+*     null
+* RETURNS:
+*     Microseconds, wrapping.
+* NOTE:
+*     It's weak functions, you can redefine it. The default uses
+*     clock_gettime on POSIX targets and returns 0 elsewhere.
+*****************************************************************/
+zm_uint32_t zm_traceClock(void);
+
+#if ZM_MEM_TRACE_FILE
+/*****************************************************************
+* FUNCTION: zm_traceOpen
+*
+* DESCRIPTION: 
+*     Start writing the trace to a file.
+* INPUTS:
+*     path : File to create.
+* RETURNS:
+*     0 : success.
+*     -1 : the file can not be created.
+* NOTE:
+*     null
+*****************************************************************/
+zm_int32_t zm_traceOpen(const char *path);
+/*****************************************************************
+* FUNCTION: zm_traceClose
+*
+* DESCRIPTION: 
+*     Write the buffered records and close the trace file.
+* INPUTS:
+*     null
+* RETURNS:
+*     null
+* NOTE:
+*     null
+*****************************************************************/
+void zm_traceClose(void);
+#endif
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* ZM_MemTrace.h */
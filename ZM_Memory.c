@@ -24,20 +24,196 @@
 #include <stdlib.h>
 #include <string.h>
 #include "ZM_Memory.h"
+#if ZM_MEM_THREAD_CACHE
+#include <pthread.h>
+#endif
+#if ZM_MEM_USE_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#if ZM_MEM_PURGE || ZM_MEM_LATENCY
+#include <time.h>
+#endif
+#if ZM_MEM_TRACE
+#include "ZM_MemTrace.h"
+#endif
+#if ZM_MEM_PROF
+#include "ZM_MemProf.h"
+#endif
 
 #if ZM_USE_MEM_MGR
 /*************************************************************************************************************************
  *                                                        MACROS                                                         *
  *************************************************************************************************************************/
 #define ZM_MEM_ALIGN_SIZE       ZM_ALIGN_SIZE
+
+#if (ZM_MEM_ALIGN_SIZE != 4) && (ZM_MEM_ALIGN_SIZE != 8) && (ZM_MEM_ALIGN_SIZE != 16)
+#error "ZM_ALIGN_SIZE must be 4, 8 or 16"
+#endif
+#if ZM_MEM_PURGE && !ZM_MEM_USE_MMAP
+#error "ZM_MEM_PURGE needs ZM_MEM_USE_MMAP"
+#endif
+#if ZM_MEM_HUGE && !ZM_MEM_USE_MMAP
+#error "ZM_MEM_HUGE needs ZM_MEM_USE_MMAP"
+#endif
+#if ZM_MEM_BEST_FIT && (ZM_MEM_BEST_FIT < 64)
+#error "ZM_MEM_BEST_FIT must be 0 or at least 64, a tree node lives in the block"
+#endif
+#if (ZM_MEM_LIST_ORDER != ZM_MEM_ORDER_LIFO) && (ZM_MEM_LIST_ORDER != ZM_MEM_ORDER_ADDRESS)
+#error "Unknown ZM_MEM_LIST_ORDER"
+#endif
+#if ZM_MEM_FAST_MAX > 1024
+#error "ZM_MEM_FAST_MAX must be at most 1024"
+#endif
+#if ZM_MEM_64BIT && (ZM_MEM_ALIGN_SIZE < 8)
+#error "ZM_MEM_64BIT needs ZM_ALIGN_SIZE 8 or 16"
+#endif
      
 #define ZM_HEAP_MAGIC           0x1EA0
 
 #define ZM_ALIGN_GET(size)      ZM_ALIGN(size, ZM_MEM_ALIGN_SIZE)
 
-#define MIN_SIZE_ALIGNED        ZM_ALIGN(ZM_MIN_SIZE, ZM_MEM_ALIGN_SIZE)
+#if ZM_MEM_COMPACT
+/** a free block holds its links and a footer */
+#define ZM_MEM_FREE_MIN         (sizeof(zmMemFree_t) + sizeof(zm_size_t))
+#else
+#define ZM_MEM_FREE_MIN         sizeof(zmMemFree_t)
+#endif
+
+#define MIN_SIZE_ALIGNED        ZM_ALIGN(ZM_MIN_SIZE > ZM_MEM_FREE_MIN ? ZM_MIN_SIZE : ZM_MEM_FREE_MIN, \
+                                         ZM_MEM_ALIGN_SIZE)
 #define MEM_STRUCT_SIZE         ZM_ALIGN(sizeof(zmMem_t), ZM_MEM_ALIGN_SIZE)
 
+#define ZM_MEM_SIZE_BITS        (sizeof(zm_size_t) * 8)
+
+#define ZM_MEM_ALIGN_SHIFT      (ZM_MEM_ALIGN_SIZE >= 16 ? 4 : ZM_MEM_ALIGN_SIZE >= 8 ? 3 : \
+                                 ZM_MEM_ALIGN_SIZE >= 4 ? 2 : ZM_MEM_ALIGN_SIZE >= 2 ? 1 : 0)
+
+#if (ZM_MEM_POLICY == ZM_MEM_POLICY_SEGFIT)
+/**
+ * Segregated free lists.
+ * Sizes below ZM_MEM_SMALL_MAX get one exact bin per ZM_MEM_ALIGN_SIZE step,
+ * larger sizes get one bin per power of two, split in ZM_MEM_SUB_BINS sub-ranges.
+ */
+#define ZM_MEM_SMALL_SHIFT      8
+#define ZM_MEM_SMALL_MAX        (1UL << ZM_MEM_SMALL_SHIFT)
+#define ZM_MEM_SMALL_BINS       (ZM_MEM_SMALL_MAX / ZM_MEM_ALIGN_SIZE)
+#define ZM_MEM_SUB_SHIFT        2
+#define ZM_MEM_SUB_BINS         (1UL << ZM_MEM_SUB_SHIFT)
+#define ZM_MEM_LARGE_BINS       ((ZM_MEM_SIZE_BITS - ZM_MEM_SMALL_SHIFT) * ZM_MEM_SUB_BINS)
+#define ZM_MEM_BIN_NUM          (ZM_MEM_SMALL_BINS + ZM_MEM_LARGE_BINS)
+#define ZM_MEM_BITMAP_WORDS     ((ZM_MEM_BIN_NUM + 31) / 32)
+
+#elif (ZM_MEM_POLICY == ZM_MEM_POLICY_TLSF)
+/**
+ * Two-level segregated fit.
+ * The first level is the power of two of the size, the second level splits
+ * it in ZM_TLSF_SL_COUNT linear sub-ranges. Sizes below ZM_TLSF_SMALL all
+ * live in first level 0, one list per ZM_MEM_ALIGN_SIZE step.
+ */
+#define ZM_TLSF_SL_SHIFT        4
+#define ZM_TLSF_SL_COUNT        (1UL << ZM_TLSF_SL_SHIFT)
+#define ZM_TLSF_FL_SHIFT        (ZM_TLSF_SL_SHIFT + ZM_MEM_ALIGN_SHIFT)
+#define ZM_TLSF_SMALL           (1UL << ZM_TLSF_FL_SHIFT)
+#define ZM_TLSF_FL_COUNT        (ZM_MEM_SIZE_BITS - ZM_TLSF_FL_SHIFT + 1)
+#define ZM_MEM_BIN_NUM          (ZM_TLSF_FL_COUNT * ZM_TLSF_SL_COUNT)
+
+#else
+#error "Unknown ZM_MEM_POLICY"
+#endif
+
+/** end of a free list */
+#define ZM_MEM_FREE_NIL         (~(zm_size_t)0)
+
+/** largest heap the offsets can address */
+#define ZM_MEM_SIZE_MAX         ZM_ALIGN_DOWN((zm_uintptr_t)ZM_MEM_FREE_NIL - 4 * MEM_STRUCT_SIZE, \
+                                              (zm_uintptr_t)ZM_MEM_ALIGN_SIZE)
+
+#define ZM_MEM_PTR(heap, idx)           ((zmMem_t *)&(heap)->memHeap[idx])
+#define ZM_MEM_IDX(heap, pMem)          ((zm_size_t)((zm_uint8_t *)(pMem) - (heap)->memHeap))
+#define ZM_MEM_FREE_NODE(heap, idx)     ((zmMemFree_t *)&(heap)->memHeap[(idx) + MEM_STRUCT_SIZE])
+#define ZM_MEM_TREE_NODE(heap, idx)     ((zmMemTree_t *)&(heap)->memHeap[(idx) + MEM_STRUCT_SIZE])
+
+#if ZM_MEM_FAST_MAX
+/** fast bin n holds blocks of n * ZM_MEM_ALIGN_SIZE payload bytes */
+#define ZM_MEM_FAST_BINS        (ZM_MEM_FAST_MAX / ZM_MEM_ALIGN_SIZE + 1)
+#endif
+
+/** bytes of a free payload taken by its links */
+#if ZM_MEM_BEST_FIT
+#define ZM_MEM_LINK_SIZE        sizeof(zmMemTree_t)
+#else
+#define ZM_MEM_LINK_SIZE        sizeof(zmMemFree_t)
+#endif
+#define ZM_MEM_BLOCK_SIZE(heap, idx)    (zm_blkNext(heap, idx) - (idx) - MEM_STRUCT_SIZE)
+
+#if ZM_MEM_COMPACT
+/** low bits of zmMem_t.head, sizes are multiples of ZM_MEM_ALIGN_SIZE */
+#define ZM_MEM_FLAG_USED        1
+#define ZM_MEM_FLAG_PREV_USED   2
+#define ZM_MEM_FLAG_MASK        3
+/** size of the free block ending at offset next, kept in its last word */
+#define ZM_MEM_FOOT(heap, next)         (*(zm_size_t *)&(heap)->memHeap[(next) - sizeof(zm_size_t)])
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ZM_INLINE               static __inline__
+#else
+#define ZM_INLINE               static __inline
+#endif
+
+
+#if ZM_MEM_THREAD_CACHE
+#define ZM_MEM_LOCK(heap)       pthread_mutex_lock(&(heap)->lock)
+#define ZM_MEM_TRYLOCK(heap)    (pthread_mutex_trylock(&(heap)->lock) == 0)
+#define ZM_MEM_UNLOCK(heap)     pthread_mutex_unlock(&(heap)->lock)
+
+/** thread cache class n holds blocks of (n + 1) * ZM_MEM_TCACHE_STEP bytes */
+#define ZM_MEM_TCACHE_STEP      16
+#define ZM_MEM_TCACHE_CLASSES   (ZM_MEM_TCACHE_MAX / ZM_MEM_TCACHE_STEP)
+/** next cached block, stored in the first word of the payload */
+#define ZM_MEM_TCACHE_NEXT(ptr) (*(void **)(ptr))
+#else
+#define ZM_MEM_LOCK(heap)
+#define ZM_MEM_UNLOCK(heap)
+#endif
+
+#if ZM_MEM_PURGE
+/** purged ranges remembered per heap, one that does not fit is forgotten */
+#define ZM_MEM_PURGE_SLOTS      16
+#if ZM_MEM_PURGE_LAZY
+#define ZM_MEM_PURGE_ADVICE     MADV_FREE
+#else
+#define ZM_MEM_PURGE_ADVICE     MADV_DONTNEED
+#endif
+#endif
+
+#if ZM_MEM_TRACE
+#define ZM_MEM_TRACE_CALL(op, size, ptr, oldPtr)    zm_traceRecord(op, size, ptr, oldPtr)
+#else
+#define ZM_MEM_TRACE_CALL(op, size, ptr, oldPtr)
+#endif
+
+#if !ZM_MEM_PROF
+#define ZM_MEM_PROF_ALLOC(size, ptr)
+#define ZM_MEM_PROF_FREE(ptr)
+#endif
+
+#if ZM_MEM_LATENCY
+/** time a call: BEGIN after the declarations, END once it is done */
+#define ZM_MEM_LAT_BEGIN()              unsigned long long latBegin = zm_latClock()
+#define ZM_MEM_LAT_END(hist)            zm_latRecord(hist, zm_latClock() - latBegin)
+/** per call work counters of a heap, its lock is held */
+#define ZM_MEM_LAT_ZERO(heap, counter)  ((heap)->counter = 0)
+#define ZM_MEM_LAT_ADD(heap, counter)   ((heap)->counter++)
+#define ZM_MEM_LAT_PUT(hist, value)     zm_latRecord(hist, value)
+#else
+#define ZM_MEM_LAT_BEGIN()
+#define ZM_MEM_LAT_END(hist)
+#define ZM_MEM_LAT_ZERO(heap, counter)
+#define ZM_MEM_LAT_ADD(heap, counter)
+#define ZM_MEM_LAT_PUT(hist, value)
+#endif
 
 #define ZM_MEM_ASSERT(EX)       \
 if(!(EX))                       \
@@ -52,6 +228,13 @@ if(!(EX))                       \
  *                                                       TYPEDEFS                                                        *
  *************************************************************************************************************************/
 
+#if ZM_MEM_COMPACT
+typedef struct zmMem
+{
+    /** size up to the next header | ZM_MEM_FLAG_USED | ZM_MEM_FLAG_PREV_USED */
+    zm_size_t head;
+}zmMem_t;
+#else
 typedef struct zmMem
 {
     zm_uint16_t magic;
@@ -59,16 +242,158 @@ typedef struct zmMem
     zm_size_t prev;
     zm_size_t next;
 }zmMem_t;
+#endif
+
+/** Free list links, stored in the payload of a free block. */
+typedef struct zmMemFree
+{
+    zm_size_t prevFree;
+    zm_size_t nextFree;
+}zmMemFree_t;
+
+#if ZM_MEM_BEST_FIT
+/** AVL node of a free block of at least ZM_MEM_BEST_FIT bytes, in place of the list links. */
+typedef struct zmMemTree
+{
+    zm_size_t left;
+    zm_size_t right;
+    /** payload size, the key, the offset breaks ties */
+    zm_size_t size;
+    zm_size_t height;
+}zmMemTree_t;
+#endif
+
+#if ZM_MEM_PURGE
+/** Whole pages purged and not written since, offsets into memHeap. */
+typedef struct
+{
+    zm_size_t begin;
+    zm_size_t end;
+}zmMemRange_t;
+#endif
 
 typedef struct
 {
     zm_size_t usedSize;
     zm_size_t maxSize;
+    /** largest free payload, stale while largestDirty is set */
+    zm_size_t largestFree;
+    zm_size_t freeBlocks;
+    zm_size_t freeHist[ZM_MEM_HIST_NUM];
+    zm_size_t mallocCount;
+    zm_size_t freeCount;
+    zm_size_t reallocCount;
+    zm_uint8_t largestDirty;
 }zmMemStats_t;
+
+struct zmHeap
+{
+    /** pointer to the heap: for alignment, heap_ptr is now a pointer instead of an array */
+    zm_uint8_t *memHeap;
+    /** the last entry, always unused! */
+    zmMem_t *memEnd;
+    
+    zm_size_t memSize;
+    
+    /** range given to zm_heapInit, kept for zm_heapReset, endAddr moves as a mmap heap grows */
+    void *beginAddr;
+    void *endAddr;
+    
+    /** head of each free list */
+    zm_size_t binHead[ZM_MEM_BIN_NUM];
+#if (ZM_MEM_POLICY == ZM_MEM_POLICY_SEGFIT)
+    /** bit n set when binHead[n] is not empty */
+    zm_uint32_t binMap[ZM_MEM_BITMAP_WORDS];
+#else
+    /** bit fl set when one of the second level lists of fl is not empty */
+    zm_size_t flMap;
+    /** bit sl of slMap[fl] set when binHead[fl * ZM_TLSF_SL_COUNT + sl] is not empty */
+    zm_uint32_t slMap[ZM_TLSF_FL_COUNT];
+#endif
+#if ZM_MEM_BEST_FIT
+    /** root of the tree of large free blocks */
+    zm_size_t treeRoot;
+#endif
+#if ZM_MEM_FAST_MAX
+    /** freed blocks of each small size, still marked used, linked through nextFree */
+    zm_size_t fastHead[ZM_MEM_FAST_BINS];
+    /** bytes held by the fast bins, headers included */
+    zm_size_t fastSize;
+#endif
+
+#if ZM_MEM_STATS
+    zmMemStats_t memStats;
+#endif
+
+#if ZM_MEM_THREAD_CACHE
+    pthread_mutex_t lock;
+    /** blocks freed while the lock was busy, drained by the next lock holder */
+    void *remoteFree;
+#endif
+
+#if ZM_MEM_USE_MMAP
+    /** end of the reserved range, endAddr is the end of the committed part, NULL: fixed heap */
+    zm_uint8_t *reserveEnd;
+    /** purge granularity, ZM_MEM_HUGE_SIZE with huge pages */
+    zm_uintptr_t pageSize;
+    zm_uint32_t hugeMode;
+#endif
+
+#if ZM_MEM_PURGE
+    /** ranges inside free blocks, not resident, zero filled unless ZM_MEM_PURGE_LAZY */
+    zmMemRange_t purged[ZM_MEM_PURGE_SLOTS];
+    zm_uint32_t purgedNum;
+    /** 1 once a free run of ZM_MEM_PURGE_MIN waits, since purgeSince (ms) */
+    zm_uint32_t purgePending;
+    zm_uint32_t purgeSince;
+    zm_uint32_t purgeTicks;
+    /** largest purged part of the last block handed out, for zm_calloc */
+    zm_size_t zeroBegin;
+    zm_size_t zeroEnd;
+#endif
+
+#if ZM_MEM_LATENCY
+    /** free blocks examined by the malloc and merges done by the free in progress */
+    zm_uint32_t latScan;
+    zm_uint32_t latMerge;
+#endif
+};
+
+#if ZM_MEM_THREAD_CACHE
+/** Per thread cache of freed blocks. */
+typedef struct zmTCache
+{
+    void *list[ZM_MEM_TCACHE_CLASSES];
+    zm_uint32_t count[ZM_MEM_TCACHE_CLASSES];
+    /** arena this thread allocates from, index + 1, 0 before first use */
+    zm_uint32_t arena;
+}zmTCache_t;
+#endif
+
+/** State of zm_heapDump between two blocks. */
+typedef struct
+{
+    zm_memWrite_t write;
+    void *ctx;
+    zm_uint8_t format;
+    /** map: bytes per character, bytes in the current one and how many are used */
+    zm_size_t unit;
+    zm_size_t fill;
+    zm_size_t used;
+    /** map: offset of the next character, characters on the line */
+    zm_size_t offset;
+    zm_uint32_t cells;
+    zm_uint32_t len;
+    char line[96];
+}zmMemDump_t;
+
+#define HEAP_STRUCT_SIZE        ZM_ALIGN(sizeof(zm_heap_t), ZM_MEM_ALIGN_SIZE)
 /*************************************************************************************************************************
  *                                                   GLOBAL VARIABLES                                                    *
  *************************************************************************************************************************/
-#if ZM_MEM_USE_HEAP
+#if ZM_MEM_USE_MMAP
+
+#elif ZM_MEM_USE_HEAP
      
 #define ZM_MEM_HEAP_BEGIN         ZM_HEAP_BEGIN
 #define ZM_MEM_HEAP_END           ZM_HEAP_END
@@ -81,17 +406,30 @@ typedef struct
 static zm_uint8_t zm_pool[ZM_MEM_SIZE];
 #endif
 
-/** pointer to the heap: for alignment, heap_ptr is now a pointer instead of an array */
-static zm_uint8_t *zmMemHeap;
-/** the last entry, always unused! */
-static zmMem_t *zmMemEnd;
-/** pointer to the lowest free block */
-static zmMem_t *lfree;
+/** heap behind zm_malloc, zm_free... */
+static zm_heap_t *zmMemDefault;
+
+#if ZM_MEM_USE_MMAP
+static zm_uintptr_t zmMemPageSize;
+#endif
+
+#if ZM_MEM_THREAD_CACHE
+/** heaps the default memory is split in */
+static zm_heap_t *zmMemArena[ZM_MEM_ARENA_NUM];
+static zm_uint32_t zmMemArenaNum;
+/** round robin arena assignment of new threads */
+static zm_uint32_t zmMemArenaNext;
 
-static zm_size_t zmMemSize;
+static pthread_key_t zmTCacheKey;
+static pthread_once_t zmTCacheOnce = PTHREAD_ONCE_INIT;
+static __thread zmTCache_t zmTCache;
+#endif
 
-#if ZM_MEM_STATS
-static zmMemStats_t memStats;
+#if ZM_MEM_LATENCY
+static zm_uint32_t zmMemLat[ZM_LAT_NUM][ZM_LAT_BUCKETS];
+/** ticks and CLOCK_MONOTONIC at zm_memoryMgrInit, to measure the tick rate */
+static unsigned long long zmMemLatTick;
+static unsigned long long zmMemLatNs;
 #endif
 /*************************************************************************************************************************
  *                                                  EXTERNAL VARIABLES                                                   *
@@ -104,7 +442,7 @@ static zmMemStats_t memStats;
 /*************************************************************************************************************************
  *                                                 FUNCTION DECLARATIONS                                                 *
  *************************************************************************************************************************/
-static void zm_mem_free(void *ptr);
+static void zm_mem_free(zm_heap_t *heap, void *ptr);
 /*************************************************************************************************************************
  *                                                   PUBLIC FUNCTIONS                                                    *
  *************************************************************************************************************************/
@@ -113,185 +451,3954 @@ static void zm_mem_free(void *ptr);
  *                                                    LOCAL FUNCTIONS                                                    *
  *************************************************************************************************************************/
 
-static void zm_putTogether(zmMem_t *pMem)
+ZM_INLINE zm_uint32_t zm_ffs32(zm_uint32_t word)
 {
-    zmMem_t *nextMem;
-    zmMem_t *prevMem;
+#if defined(__GNUC__) || defined(__clang__)
+    return (zm_uint32_t)__builtin_ctz(word);
+#else
+    zm_uint32_t bit = 0;
     
-    nextMem = (zmMem_t *)&zmMemHeap[pMem->next];
+    while(!(word & 1))
+    {
+        word >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+ZM_INLINE zm_uint32_t zm_flsSize(zm_size_t size)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    if(sizeof(zm_size_t) > sizeof(unsigned int))
+    {
+        return (zm_uint32_t)(ZM_MEM_SIZE_BITS - 1 - __builtin_clzll((unsigned long long)size));
+    }
+    return (zm_uint32_t)(ZM_MEM_SIZE_BITS - 1 - __builtin_clz((unsigned int)size));
+#else
+    zm_uint32_t bit = 0;
     
-    if(nextMem->magic == ZM_HEAP_MAGIC && nextMem != pMem &&
-       nextMem->used == 0 && nextMem != zmMemEnd)
+    while(size >>= 1)
     {
-        if(lfree == nextMem)
-        {
-            lfree = pMem;
-        }
-        pMem->next = nextMem->next;
-        ((zmMem_t *)&zmMemHeap[nextMem->next])->prev = (zm_uint8_t *)pMem - zmMemHeap;
+        bit++;
     }
+    return bit;
+#endif
+}
+
+ZM_INLINE zm_uint32_t zm_ffsSize(zm_size_t word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    if(sizeof(zm_size_t) > sizeof(unsigned int))
+    {
+        return (zm_uint32_t)__builtin_ctzll((unsigned long long)word);
+    }
+    return (zm_uint32_t)__builtin_ctz((unsigned int)word);
+#else
+    zm_uint32_t bit = 0;
+    
+    while(!(word & 1))
+    {
+        word >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+#if ZM_MEM_LATENCY
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+ZM_INLINE unsigned long long zm_latClock(void)
+{
+    return __builtin_ia32_rdtsc();
+}
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+ZM_INLINE unsigned long long zm_latClock(void)
+{
+    unsigned long long tick;
     
-    prevMem = (zmMem_t *)&zmMemHeap[pMem->prev];
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(tick));
+    return tick;
+}
+#else
+#define zm_latClock()           zm_latencyClock()
+#endif
+
+/** histogram bucket of a value, see ZM_LAT_SUB_BITS */
+ZM_INLINE zm_uint32_t zm_latBucket(unsigned long long value)
+{
+    zm_uint32_t bit;
+    
+    if(value < (1u << ZM_LAT_SUB_BITS)) return (zm_uint32_t)value;
+    if(value > 0xFFFFFFFFu) value = 0xFFFFFFFFu;
+    
+    bit = zm_flsSize((zm_size_t)value);
+    
+    return ((bit - ZM_LAT_SUB_BITS + 1) << ZM_LAT_SUB_BITS) +
+           (zm_uint32_t)((value >> (bit - ZM_LAT_SUB_BITS)) & ((1u << ZM_LAT_SUB_BITS) - 1));
+}
+
+ZM_INLINE void zm_latRecord(zm_uint32_t hist, unsigned long long value)
+{
+#if ZM_MEM_THREAD_CACHE
+    __atomic_fetch_add(&zmMemLat[hist][zm_latBucket(value)], 1, __ATOMIC_RELAXED);
+#else
+    zmMemLat[hist][zm_latBucket(value)]++;
+#endif
+}
+
+/* CLOCK_MONOTONIC in ns, 0 where there is none */
+static unsigned long long zm_latNs(void)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000u + (unsigned long long)ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+#endif
+
+/*****************************************************************
+* Block header access.
+* A block is named by the offset of its header. Only the functions
+* below know the header format (ZM_MEM_COMPACT).
+*****************************************************************/
+
+/** offset of the block after idx */
+ZM_INLINE zm_size_t zm_blkNext(zm_heap_t *heap, zm_size_t idx)
+{
+#if ZM_MEM_COMPACT
+    return idx + (ZM_MEM_PTR(heap, idx)->head & ~(zm_size_t)ZM_MEM_FLAG_MASK);
+#else
+    return ZM_MEM_PTR(heap, idx)->next;
+#endif
+}
+
+ZM_INLINE zm_uint32_t zm_blkUsed(zm_heap_t *heap, zm_size_t idx)
+{
+#if ZM_MEM_COMPACT
+    return (zm_uint32_t)(ZM_MEM_PTR(heap, idx)->head & ZM_MEM_FLAG_USED);
+#else
+    return ZM_MEM_PTR(heap, idx)->used;
+#endif
+}
+
+/** 1 if there is a block before idx and it is free */
+ZM_INLINE zm_uint32_t zm_blkPrevFree(zm_heap_t *heap, zm_size_t idx)
+{
+#if ZM_MEM_COMPACT
+    return !(ZM_MEM_PTR(heap, idx)->head & ZM_MEM_FLAG_PREV_USED);
+#else
+    zmMem_t *prevMem = ZM_MEM_PTR(heap, ZM_MEM_PTR(heap, idx)->prev);
+    
+    return prevMem != ZM_MEM_PTR(heap, idx) && prevMem->magic == ZM_HEAP_MAGIC && !prevMem->used;
+#endif
+}
+
+/** offset of the block before idx, only valid if zm_blkPrevFree */
+ZM_INLINE zm_size_t zm_blkPrev(zm_heap_t *heap, zm_size_t idx)
+{
+#if ZM_MEM_COMPACT
+    return idx - ZM_MEM_FOOT(heap, idx);
+#else
+    return ZM_MEM_PTR(heap, idx)->prev;
+#endif
+}
+
+/**
+ * Make idx a block up to next, used or free, and tell next about it.
+ * The header of next must already be written.
+ */
+ZM_INLINE void zm_blkSet(zm_heap_t *heap, zm_size_t idx, zm_size_t next, zm_uint32_t used)
+{
+    zmMem_t *pMem = ZM_MEM_PTR(heap, idx);
+    zmMem_t *nextMem = ZM_MEM_PTR(heap, next);
     
-    if(prevMem->magic == ZM_HEAP_MAGIC &&
-       nextMem != pMem && prevMem->used == 0)
+#if ZM_MEM_COMPACT
+    pMem->head = (next - idx) | (pMem->head & ZM_MEM_FLAG_PREV_USED) | (used ? ZM_MEM_FLAG_USED : 0);
+    if(used)
     {
-        if(lfree == pMem)
-        {
-            lfree = prevMem;
-        }
-        prevMem->next = pMem->next;
-        ((zmMem_t *)&zmMemHeap[pMem->next])->prev = (zm_uint8_t *)prevMem - zmMemHeap;
+        nextMem->head |= ZM_MEM_FLAG_PREV_USED;
+    }
+    else
+    {
+        ZM_MEM_FOOT(heap, next) = next - idx;
+        nextMem->head &= ~(zm_size_t)ZM_MEM_FLAG_PREV_USED;
+    }
+#else
+    pMem->magic = ZM_HEAP_MAGIC;
+    pMem->used = (zm_uint16_t)used;
+    pMem->next = next;
+    nextMem->prev = idx;
+#endif
+}
+
+/** the first block of a heap has no block before it */
+ZM_INLINE void zm_blkSetFirst(zm_heap_t *heap)
+{
+#if ZM_MEM_COMPACT
+    ZM_MEM_PTR(heap, 0)->head = ZM_MEM_FLAG_PREV_USED;
+#else
+    ZM_MEM_PTR(heap, 0)->prev = 0;
+#endif
+}
+
+#if ZM_MEM_CHECK
+/** 1 if idx looks like a block handed out by malloc */
+ZM_INLINE zm_uint32_t zm_blkValid(zm_heap_t *heap, zm_size_t idx)
+{
+#if ZM_MEM_COMPACT
+    zm_size_t next = zm_blkNext(heap, idx);
+    
+    return zm_blkUsed(heap, idx) && next > idx && next <= heap->memSize + MEM_STRUCT_SIZE &&
+           (ZM_MEM_PTR(heap, next)->head & ZM_MEM_FLAG_PREV_USED);
+#else
+    return ZM_MEM_PTR(heap, idx)->magic == ZM_HEAP_MAGIC && ZM_MEM_PTR(heap, idx)->used;
+#endif
+}
+
+/** 0 if a sized free names more than the payload of the block at ptr */
+ZM_INLINE zm_uint32_t zm_sizeValid(zm_heap_t *heap, void *ptr, zm_size_t size)
+{
+    if((zm_uint8_t *)ptr < heap->memHeap + MEM_STRUCT_SIZE || (zm_uint8_t *)ptr >= (zm_uint8_t *)heap->memEnd)
+    {
+        // not this heap's, zm_heapFree rejects it.
+        return 1;
     }
+    
+    return size <= ZM_MEM_BLOCK_SIZE(heap, ZM_MEM_IDX(heap, (zm_uint8_t *)ptr - MEM_STRUCT_SIZE));
 }
+#endif
 
+#if (ZM_MEM_POLICY == ZM_MEM_POLICY_SEGFIT)
 /*****************************************************************
-* FUNCTION: zm_mem_init
+* FUNCTION: zm_binIndex
 *
 * DESCRIPTION: 
-*     zm dynamic memory init.
+*     Map a block payload size to its free list.
 * INPUTS:
-*     beginAddr : The beginning address of system heap memory.
-*     endAddr   : The end address of system heap memory.
+*     size : Block payload size, aligned.
 * RETURNS:
-*     null
+*     Free list index.
 * NOTE:
 *     null
 *****************************************************************/
-static void zm_mem_init(void *beginAddr, void *endAddr)
+ZM_INLINE zm_size_t zm_binIndex(zm_size_t size)
 {
-    zmMem_t *pMem;
-    
-    zm_size_t beginAlign = ZM_ALIGN((zm_size_t)beginAddr, ZM_MEM_ALIGN_SIZE);
-    zm_size_t endAlign = ZM_ALIGN_DOWN((zm_size_t)endAddr, ZM_MEM_ALIGN_SIZE);
+    zm_uint32_t fl;
     
-    if(endAlign > (2 * MEM_STRUCT_SIZE) &&
-       (endAlign - 2 * MEM_STRUCT_SIZE) >= beginAlign)
+    if(size < ZM_MEM_SMALL_MAX)
     {
-        zmMemSize = endAlign - beginAlign - 2 * MEM_STRUCT_SIZE;
+        return size / ZM_MEM_ALIGN_SIZE;
     }
-    else
-    {
-        //memory error begin address and end address.
-        return;
-    }
-    
-    zmMemHeap = (zm_uint8_t *)beginAlign;
-    
-    pMem = (zmMem_t *)zmMemHeap;
-    pMem->magic = ZM_HEAP_MAGIC;
-    pMem->used = 0;
-    pMem->next = zmMemSize + MEM_STRUCT_SIZE;
-    pMem->prev = 0;
     
-    zmMemEnd = (zmMem_t *)&zmMemHeap[pMem->next];
-    zmMemEnd->magic = ZM_HEAP_MAGIC;
-    zmMemEnd->used = 1;
-    zmMemEnd->next = zmMemSize + MEM_STRUCT_SIZE;
-    zmMemEnd->prev = zmMemSize + MEM_STRUCT_SIZE;
+    fl = zm_flsSize(size);
     
-    lfree = pMem;
+    return ZM_MEM_SMALL_BINS + (fl - ZM_MEM_SMALL_SHIFT) * ZM_MEM_SUB_BINS +
+           ((size >> (fl - ZM_MEM_SUB_SHIFT)) & (ZM_MEM_SUB_BINS - 1));
+}
 
-#if ZM_MEM_STATS
-    memStats.maxSize = 0;
-    memStats.usedSize = 0;
-#endif
+ZM_INLINE void zm_binMark(zm_heap_t *heap, zm_size_t bin)
+{
+    heap->binMap[bin >> 5] |= (zm_uint32_t)1 << (bin & 31);
+}
+
+ZM_INLINE void zm_binClear(zm_heap_t *heap, zm_size_t bin)
+{
+    heap->binMap[bin >> 5] &= ~((zm_uint32_t)1 << (bin & 31));
 }
 
 /*****************************************************************
-* FUNCTION: zm_mem_malloc
+* FUNCTION: zm_binFind
 *
 * DESCRIPTION: 
-*     zm dynamic memory allocation.
+*     Find a free block of at least size bytes.
 * INPUTS:
-*     size : The number of bytes to allocate from the HEAP.
+*     size : Payload size, aligned.
 * RETURNS:
-*     The first address of the allocated memory space.
-*     NULL : faild, It may be out of memory.
+*     Offset of the free block, ZM_MEM_FREE_NIL if none.
 * NOTE:
-*     null
+*     Only the head of the exact list is tested, then the bitmap gives
+*     the first non-empty larger list, any block there is big enough.
+*     The cost does not depend on the number of blocks in the heap.
 *****************************************************************/
-static void *zm_mem_malloc(zm_size_t size)
+static zm_size_t zm_binFind(zm_heap_t *heap, zm_size_t size)
 {
-    zm_size_t idx;
-    zmMem_t *pMem;
+    zm_size_t bin = zm_binIndex(size);
+    zm_size_t word;
+    zm_uint32_t map;
     
-    if(size == 0) return NULL;
+    if(heap->binHead[bin] != ZM_MEM_FREE_NIL)
+    {
+        ZM_MEM_LAT_ADD(heap, latScan);
+        if(ZM_MEM_BLOCK_SIZE(heap, heap->binHead[bin]) >= size) return heap->binHead[bin];
+    }
     
-    size = ZM_ALIGN_GET(size);
+    bin++;
+    word = bin >> 5;
+    if(word >= ZM_MEM_BITMAP_WORDS) return ZM_MEM_FREE_NIL;
     
-    if(size > zmMemSize) return NULL;
+    map = heap->binMap[word] & (~(zm_uint32_t)0 << (bin & 31));
+    while(!map)
+    {
+        if(++word >= ZM_MEM_BITMAP_WORDS) return ZM_MEM_FREE_NIL;
+        map = heap->binMap[word];
+    }
     
-    if(size < MIN_SIZE_ALIGNED) size = MIN_SIZE_ALIGNED;
+    ZM_MEM_LAT_ADD(heap, latScan);
+    return heap->binHead[(word << 5) + zm_ffs32(map)];
+}
+
+#if ZM_MEM_STATS
+/*****************************************************************
+* FUNCTION: zm_binLargest
+*
+* DESCRIPTION: 
+*     Find the largest free block payload.
+* INPUTS:
+*     heap : The heap handle.
+* RETURNS:
+*     Largest free payload, 0 if none.
+* NOTE:
+*     Only the highest non-empty list is walked.
+*****************************************************************/
+static zm_size_t zm_binLargest(zm_heap_t *heap)
+{
+    zm_size_t largest = 0;
+    zm_size_t word = ZM_MEM_BITMAP_WORDS;
+    zm_size_t idx;
     
-    for(idx = (zm_uint8_t *)lfree - zmMemHeap;
-        idx < (zmMemSize - size);
-        idx = ((zmMem_t *)&zmMemHeap[idx])->next)
+    while(word--)
     {
-        pMem = (zmMem_t *)&zmMemHeap[idx];
-        
-        if(!pMem->used && (pMem->next - idx - MEM_STRUCT_SIZE) >= size)
+        if(heap->binMap[word])
         {
-            zmMem_t *mem;
-            if((pMem->next - idx - MEM_STRUCT_SIZE) >= (size + MEM_STRUCT_SIZE + MIN_SIZE_ALIGNED))
+            idx = heap->binHead[(word << 5) + zm_flsSize(heap->binMap[word])];
+            for(; idx != ZM_MEM_FREE_NIL; idx = ZM_MEM_FREE_NODE(heap, idx)->nextFree)
             {
-                zm_size_t ptr = idx + MEM_STRUCT_SIZE + size;
-                
-                mem = (zmMem_t *)&zmMemHeap[ptr];
-                mem->magic = ZM_HEAP_MAGIC;
-                mem->used = 0;
-                mem->next = pMem->next;
-                mem->prev = idx;
-                
-                pMem->next = ptr;
-                pMem->used = 1;
-                
-                if(mem->next != (zmMemSize + MEM_STRUCT_SIZE))
-                {
-                    ((zmMem_t *)&zmMemHeap[mem->next])->prev = ptr;
-                }
-#if ZM_MEM_STATS
-                memStats.usedSize += (size + MEM_STRUCT_SIZE);
-                if(memStats.maxSize < memStats.usedSize)
+                if(ZM_MEM_BLOCK_SIZE(heap, idx) > largest)
                 {
-                    memStats.maxSize = memStats.usedSize;
+                    largest = ZM_MEM_BLOCK_SIZE(heap, idx);
                 }
-#endif
             }
-            else
-            {
-                pMem->used = 1;
-#if ZM_MEM_STATS
-                memStats.usedSize += (pMem->next - idx);
-                if(memStats.maxSize < memStats.usedSize)
+            break;
+        }
+    }
+    return largest;
+}
+#endif
+
+#else
+/*****************************************************************
+* FUNCTION: zm_binIndex
+*
+* DESCRIPTION: 
+*     Map a block payload size to its TLSF list (mapping_insert).
+* INPUTS:
+*     size : Block payload size, aligned.
+* RETURNS:
+*     Free list index, fl * ZM_TLSF_SL_COUNT + sl.
+* NOTE:
+*     null
+*****************************************************************/
+ZM_INLINE zm_size_t zm_binIndex(zm_size_t size)
+{
+    zm_uint32_t fl;
+    
+    if(size < ZM_TLSF_SMALL)
+    {
+        return size >> ZM_MEM_ALIGN_SHIFT;
+    }
+    
+    fl = zm_flsSize(size);
+    
+    return (fl - ZM_TLSF_FL_SHIFT + 1) * ZM_TLSF_SL_COUNT +
+           ((size >> (fl - ZM_TLSF_SL_SHIFT)) ^ ZM_TLSF_SL_COUNT);
+}
+
+ZM_INLINE void zm_binMark(zm_heap_t *heap, zm_size_t bin)
+{
+    heap->slMap[bin >> ZM_TLSF_SL_SHIFT] |= (zm_uint32_t)1 << (bin & (ZM_TLSF_SL_COUNT - 1));
+    heap->flMap |= (zm_size_t)1 << (bin >> ZM_TLSF_SL_SHIFT);
+}
+
+ZM_INLINE void zm_binClear(zm_heap_t *heap, zm_size_t bin)
+{
+    heap->slMap[bin >> ZM_TLSF_SL_SHIFT] &= ~((zm_uint32_t)1 << (bin & (ZM_TLSF_SL_COUNT - 1)));
+    if(!heap->slMap[bin >> ZM_TLSF_SL_SHIFT])
+    {
+        heap->flMap &= ~((zm_size_t)1 << (bin >> ZM_TLSF_SL_SHIFT));
+    }
+}
+
+/*****************************************************************
+* FUNCTION: zm_binFind
+*
+* DESCRIPTION: 
+*     Find a free block of at least size bytes (mapping_search).
+* INPUTS:
+*     size : Payload size, aligned.
+* RETURNS:
+*     Offset of the free block, ZM_MEM_FREE_NIL if none.
+* NOTE:
+*     The size is rounded up to the next list boundary, so the head of
+*     any list found is big enough. No loop: two ffs on the bitmaps.
+*****************************************************************/
+static zm_size_t zm_binFind(zm_heap_t *heap, zm_size_t size)
+{
+    zm_size_t bin;
+    zm_size_t fl;
+    zm_size_t flBits;
+    zm_uint32_t slBits;
+    
+    if(size >= ZM_TLSF_SMALL)
+    {
+        zm_size_t round = ((zm_size_t)1 << (zm_flsSize(size) - ZM_TLSF_SL_SHIFT)) - 1;
+        
+        if(size + round < size) return ZM_MEM_FREE_NIL;
+        size += round;
+    }
+    
+    bin = zm_binIndex(size);
+    fl = bin >> ZM_TLSF_SL_SHIFT;
+    
+    slBits = heap->slMap[fl] & (~(zm_uint32_t)0 << (bin & (ZM_TLSF_SL_COUNT - 1)));
+    if(!slBits)
+    {
+        if(fl + 1 >= ZM_TLSF_FL_COUNT) return ZM_MEM_FREE_NIL;
+        
+        flBits = heap->flMap & (~(zm_size_t)0 << (fl + 1));
+        if(!flBits) return ZM_MEM_FREE_NIL;
+        
+        fl = zm_ffsSize(flBits);
+        slBits = heap->slMap[fl];
+    }
+    
+    ZM_MEM_LAT_ADD(heap, latScan);
+    return heap->binHead[(fl << ZM_TLSF_SL_SHIFT) + zm_ffs32(slBits)];
+}
+#if ZM_MEM_STATS
+/*****************************************************************
+* FUNCTION: zm_binLargest
+*
+* DESCRIPTION: 
+*     Find the largest free block payload.
+* INPUTS:
+*     heap : The heap handle.
+* RETURNS:
+*     Largest free payload, 0 if none.
+* NOTE:
+*     Only the highest non-empty list is walked.
+*****************************************************************/
+static zm_size_t zm_binLargest(zm_heap_t *heap)
+{
+    zm_size_t largest = 0;
+    zm_size_t fl;
+    zm_size_t idx;
+    
+    if(heap->flMap == 0) return 0;
+    
+    fl = zm_flsSize(heap->flMap);
+    idx = heap->binHead[(fl << ZM_TLSF_SL_SHIFT) + zm_flsSize(heap->slMap[fl])];
+    for(; idx != ZM_MEM_FREE_NIL; idx = ZM_MEM_FREE_NODE(heap, idx)->nextFree)
+    {
+        if(ZM_MEM_BLOCK_SIZE(heap, idx) > largest)
+        {
+            largest = ZM_MEM_BLOCK_SIZE(heap, idx);
+        }
+    }
+    return largest;
+}
+#endif
+#endif
+
+#if ZM_MEM_BEST_FIT
+/*****************************************************************
+* Best fit tree.
+* An AVL tree of the free blocks of at least ZM_MEM_BEST_FIT bytes,
+* keyed by payload size then offset, linked by offsets like the lists.
+* Its height stays below 1.44 log2(n), so does the recursion.
+*****************************************************************/
+
+ZM_INLINE zm_size_t zm_treeHeight(zm_heap_t *heap, zm_size_t node)
+{
+    return node == ZM_MEM_FREE_NIL ? 0 : ZM_MEM_TREE_NODE(heap, node)->height;
+}
+
+/** 1 if the block (size, idx) sorts before node */
+ZM_INLINE zm_uint32_t zm_treeBefore(zm_heap_t *heap, zm_size_t size, zm_size_t idx, zm_size_t node)
+{
+    zmMemTree_t *n = ZM_MEM_TREE_NODE(heap, node);
+    
+    return size < n->size || (size == n->size && idx < node);
+}
+
+static zm_size_t zm_treeRotate(zm_heap_t *heap, zm_size_t node, zm_uint32_t toLeft)
+{
+    zmMemTree_t *n = ZM_MEM_TREE_NODE(heap, node);
+    zm_size_t top = toLeft ? n->right : n->left;
+    zmMemTree_t *t = ZM_MEM_TREE_NODE(heap, top);
+    zm_size_t l, r;
+    
+    if(toLeft)
+    {
+        n->right = t->left;
+        t->left = node;
+    }
+    else
+    {
+        n->left = t->right;
+        t->right = node;
+    }
+    
+    l = zm_treeHeight(heap, n->left);
+    r = zm_treeHeight(heap, n->right);
+    n->height = (l > r ? l : r) + 1;
+    
+    l = zm_treeHeight(heap, t->left);
+    r = zm_treeHeight(heap, t->right);
+    t->height = (l > r ? l : r) + 1;
+    
+    return top;
+}
+
+/** restore the height and the balance of node after one of its subtrees changed, returns the new subtree root */
+static zm_size_t zm_treeBalance(zm_heap_t *heap, zm_size_t node)
+{
+    zmMemTree_t *n = ZM_MEM_TREE_NODE(heap, node);
+    zm_size_t l = zm_treeHeight(heap, n->left);
+    zm_size_t r = zm_treeHeight(heap, n->right);
+    
+    if(l > r + 1)
+    {
+        zmMemTree_t *c = ZM_MEM_TREE_NODE(heap, n->left);
+        
+        if(zm_treeHeight(heap, c->left) < zm_treeHeight(heap, c->right))
+        {
+            n->left = zm_treeRotate(heap, n->left, 1);
+        }
+        return zm_treeRotate(heap, node, 0);
+    }
+    if(r > l + 1)
+    {
+        zmMemTree_t *c = ZM_MEM_TREE_NODE(heap, n->right);
+        
+        if(zm_treeHeight(heap, c->right) < zm_treeHeight(heap, c->left))
+        {
+            n->right = zm_treeRotate(heap, n->right, 0);
+        }
+        return zm_treeRotate(heap, node, 1);
+    }
+    
+    n->height = (l > r ? l : r) + 1;
+    return node;
+}
+
+static zm_size_t zm_treeInsert(zm_heap_t *heap, zm_size_t root, zm_size_t idx, zm_size_t size)
+{
+    zmMemTree_t *r;
+    
+    if(root == ZM_MEM_FREE_NIL)
+    {
+        r = ZM_MEM_TREE_NODE(heap, idx);
+        r->left = ZM_MEM_FREE_NIL;
+        r->right = ZM_MEM_FREE_NIL;
+        r->size = size;
+        r->height = 1;
+        return idx;
+    }
+    
+    r = ZM_MEM_TREE_NODE(heap, root);
+    if(zm_treeBefore(heap, size, idx, root))
+    {
+        r->left = zm_treeInsert(heap, r->left, idx, size);
+    }
+    else
+    {
+        r->right = zm_treeInsert(heap, r->right, idx, size);
+    }
+    return zm_treeBalance(heap, root);
+}
+
+/** unlink the smallest node of the subtree, it is left in *min */
+static zm_size_t zm_treeRemoveMin(zm_heap_t *heap, zm_size_t root, zm_size_t *min)
+{
+    zmMemTree_t *r = ZM_MEM_TREE_NODE(heap, root);
+    
+    if(r->left == ZM_MEM_FREE_NIL)
+    {
+        *min = root;
+        return r->right;
+    }
+    
+    r->left = zm_treeRemoveMin(heap, r->left, min);
+    return zm_treeBalance(heap, root);
+}
+
+static zm_size_t zm_treeRemove(zm_heap_t *heap, zm_size_t root, zm_size_t idx, zm_size_t size)
+{
+    zmMemTree_t *r = ZM_MEM_TREE_NODE(heap, root);
+    
+    if(root == idx)
+    {
+        zm_size_t min;
+        
+        if(r->left == ZM_MEM_FREE_NIL) return r->right;
+        if(r->right == ZM_MEM_FREE_NIL) return r->left;
+        
+        // the successor takes the place of the node.
+        r->right = zm_treeRemoveMin(heap, r->right, &min);
+        ZM_MEM_TREE_NODE(heap, min)->left = r->left;
+        ZM_MEM_TREE_NODE(heap, min)->right = r->right;
+        return zm_treeBalance(heap, min);
+    }
+    
+    if(zm_treeBefore(heap, size, idx, root))
+    {
+        r->left = zm_treeRemove(heap, r->left, idx, size);
+    }
+    else
+    {
+        r->right = zm_treeRemove(heap, r->right, idx, size);
+    }
+    return zm_treeBalance(heap, root);
+}
+
+/*****************************************************************
+* FUNCTION: zm_treeFind
+*
+* DESCRIPTION: 
+*     Find the smallest tree block of at least size bytes.
+* INPUTS:
+*     size : Payload size, aligned.
+* RETURNS:
+*     Offset of the free block, ZM_MEM_FREE_NIL if none.
+* NOTE:
+*     Of blocks of the same size the lowest one is taken.
+*****************************************************************/
+static zm_size_t zm_treeFind(zm_heap_t *heap, zm_size_t size)
+{
+    zm_size_t node = heap->treeRoot;
+    zm_size_t best = ZM_MEM_FREE_NIL;
+    
+    while(node != ZM_MEM_FREE_NIL)
+    {
+        zmMemTree_t *n = ZM_MEM_TREE_NODE(heap, node);
+        
+        ZM_MEM_LAT_ADD(heap, latScan);
+        if(n->size >= size)
+        {
+            best = node;
+            node = n->left;
+        }
+        else
+        {
+            node = n->right;
+        }
+    }
+    return best;
+}
+
+/*****************************************************************
+* FUNCTION: zm_treeCheck
+*
+* DESCRIPTION: 
+*     Check a subtree for zm_heapCheck, in order.
+* INPUTS:
+*     node : The subtree root.
+*     depth : Depth of node, a loop runs into the AVL height bound.
+*     end : Offset of the end sentinel.
+*     prev : Last node visited, ZM_MEM_FREE_NIL before the first.
+*     num : Counts the nodes visited.
+* RETURNS:
+*     Height of the subtree, -1 if it is broken.
+* NOTE:
+*     Keys must ascend, heights be right and balanced, nodes be free
+*     blocks of their recorded size.
+*****************************************************************/
+static zm_int32_t zm_treeCheck(zm_heap_t *heap, zm_size_t node, zm_uint32_t depth, zm_size_t end,
+                               zm_size_t *prev, zm_size_t *num)
+{
+    zmMemTree_t *n;
+    zm_int32_t l, r;
+    
+    if(node == ZM_MEM_FREE_NIL) return 0;
+    if(depth > 2 * ZM_MEM_SIZE_BITS || node >= end || (node % ZM_MEM_ALIGN_SIZE) || zm_blkUsed(heap, node)) return -1;
+    
+    n = ZM_MEM_TREE_NODE(heap, node);
+    if(n->size != ZM_MEM_BLOCK_SIZE(heap, node) || n->size < ZM_MEM_BEST_FIT) return -1;
+    
+    l = zm_treeCheck(heap, n->left, depth + 1, end, prev, num);
+    if(l < 0) return -1;
+    
+    if(*prev != ZM_MEM_FREE_NIL && !zm_treeBefore(heap, ZM_MEM_TREE_NODE(heap, *prev)->size, *prev, node)) return -1;
+    *prev = node;
+    (*num)++;
+    
+    r = zm_treeCheck(heap, n->right, depth + 1, end, prev, num);
+    if(r < 0 || l > r + 1 || r > l + 1) return -1;
+    
+    if(l < r) l = r;
+    if(n->height != (zm_size_t)l + 1) return -1;
+    
+    return l + 1;
+}
+#endif
+
+/** a free block of at least size bytes, the lists then the tree of large blocks */
+ZM_INLINE zm_size_t zm_freeFind(zm_heap_t *heap, zm_size_t size)
+{
+#if ZM_MEM_BEST_FIT
+    zm_size_t idx;
+    
+    if(size >= ZM_MEM_BEST_FIT) return zm_treeFind(heap, size);
+    
+    idx = zm_binFind(heap, size);
+    if(idx == ZM_MEM_FREE_NIL) idx = zm_treeFind(heap, size);
+    
+    return idx;
+#else
+    return zm_binFind(heap, size);
+#endif
+}
+
+static void zm_binInsert(zm_heap_t *heap, zm_size_t idx)
+{
+    zm_size_t size = ZM_MEM_BLOCK_SIZE(heap, idx);
+    zm_size_t bin = zm_binIndex(size);
+    zmMemFree_t *node = ZM_MEM_FREE_NODE(heap, idx);
+    
+#if ZM_MEM_BEST_FIT
+    if(size >= ZM_MEM_BEST_FIT)
+    {
+        heap->treeRoot = zm_treeInsert(heap, heap->treeRoot, idx, size);
+    }
+    else
+#endif
+    {
+#if (ZM_MEM_LIST_ORDER == ZM_MEM_ORDER_ADDRESS)
+        zm_size_t prev = ZM_MEM_FREE_NIL;
+        zm_size_t next = heap->binHead[bin];
+        
+        while(next != ZM_MEM_FREE_NIL && next < idx)
+        {
+            prev = next;
+            next = ZM_MEM_FREE_NODE(heap, next)->nextFree;
+        }
+        
+        node->prevFree = prev;
+        node->nextFree = next;
+        
+        if(next != ZM_MEM_FREE_NIL)
+        {
+            ZM_MEM_FREE_NODE(heap, next)->prevFree = idx;
+        }
+        if(prev != ZM_MEM_FREE_NIL)
+        {
+            ZM_MEM_FREE_NODE(heap, prev)->nextFree = idx;
+        }
+        else
+        {
+            heap->binHead[bin] = idx;
+        }
+#else
+        node->prevFree = ZM_MEM_FREE_NIL;
+        node->nextFree = heap->binHead[bin];
+        
+        if(heap->binHead[bin] != ZM_MEM_FREE_NIL)
+        {
+            ZM_MEM_FREE_NODE(heap, heap->binHead[bin])->prevFree = idx;
+        }
+        heap->binHead[bin] = idx;
+#endif
+        zm_binMark(heap, bin);
+    }
+    
+#if ZM_MEM_STATS
+    heap->memStats.freeBlocks++;
+    heap->memStats.freeHist[zm_flsSize(size)]++;
+    if(size >= heap->memStats.largestFree)
+    {
+        // a stale largestFree is never below the real one.
+        heap->memStats.largestFree = size;
+        heap->memStats.largestDirty = 0;
+    }
+#endif
+}
+
+static void zm_binRemove(zm_heap_t *heap, zm_size_t idx)
+{
+    zmMemFree_t *node = ZM_MEM_FREE_NODE(heap, idx);
+    
+#if ZM_MEM_STATS || ZM_MEM_BEST_FIT
+    zm_size_t size = ZM_MEM_BLOCK_SIZE(heap, idx);
+#endif
+    
+#if ZM_MEM_STATS
+    heap->memStats.freeBlocks--;
+    heap->memStats.freeHist[zm_flsSize(size)]--;
+    if(size == heap->memStats.largestFree)
+    {
+        // found again on demand by zm_binLargest.
+        heap->memStats.largestDirty = 1;
+    }
+#endif
+    
+#if ZM_MEM_BEST_FIT
+    if(size >= ZM_MEM_BEST_FIT)
+    {
+        heap->treeRoot = zm_treeRemove(heap, heap->treeRoot, idx, size);
+        return;
+    }
+#endif
+    
+    if(node->nextFree != ZM_MEM_FREE_NIL)
+    {
+        ZM_MEM_FREE_NODE(heap, node->nextFree)->prevFree = node->prevFree;
+    }
+    
+    if(node->prevFree != ZM_MEM_FREE_NIL)
+    {
+        ZM_MEM_FREE_NODE(heap, node->prevFree)->nextFree = node->nextFree;
+    }
+    else
+    {
+        zm_size_t bin = zm_binIndex(ZM_MEM_BLOCK_SIZE(heap, idx));
+        
+        heap->binHead[bin] = node->nextFree;
+        if(heap->binHead[bin] == ZM_MEM_FREE_NIL)
+        {
+            zm_binClear(heap, bin);
+        }
+    }
+}
+
+#if ZM_MEM_PURGE
+/** offset of the first page boundary at or after off */
+ZM_INLINE zm_size_t zm_pageUp(zm_heap_t *heap, zm_size_t off)
+{
+    return (zm_size_t)(ZM_ALIGN((zm_uintptr_t)&heap->memHeap[off], heap->pageSize) - (zm_uintptr_t)heap->memHeap);
+}
+
+/** offset of the last page boundary at or before off, 0 inside the first page, which starts before memHeap */
+ZM_INLINE zm_size_t zm_pageDown(zm_heap_t *heap, zm_size_t off)
+{
+    zm_uintptr_t down = ZM_ALIGN_DOWN((zm_uintptr_t)&heap->memHeap[off], heap->pageSize);
+    
+    if(down < (zm_uintptr_t)heap->memHeap) return 0;
+    
+    return (zm_size_t)(down - (zm_uintptr_t)heap->memHeap);
+}
+
+static zm_uint32_t zm_purgeClock(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (zm_uint32_t)ts.tv_sec * 1000u + (zm_uint32_t)(ts.tv_nsec / 1000000);
+}
+
+/*****************************************************************
+* FUNCTION: zm_purgeDirty
+*
+* DESCRIPTION: 
+*     Forget the purged pages of a range about to be written.
+* INPUTS:
+*     heap : The heap handle.
+*     begin : First offset written.
+*     end : Offset past the last one written.
+* RETURNS:
+*     null
+* NOTE:
+*     The largest purged part is kept in zeroBegin/zeroEnd. Pages only
+*     partly written are forgotten too.
+*****************************************************************/
+static void zm_purgeDirty(zm_heap_t *heap, zm_size_t begin, zm_size_t end)
+{
+    zm_uint32_t i = 0;
+    
+    while(i < heap->purgedNum)
+    {
+        zmMemRange_t *range = &heap->purged[i];
+        zm_size_t lo, hi;
+        
+        if(range->end <= begin || range->begin >= end)
+        {
+            i++;
+            continue;
+        }
+        
+        lo = range->begin > begin ? range->begin : begin;
+        hi = range->end < end ? range->end : end;
+        if(hi - lo > heap->zeroEnd - heap->zeroBegin)
+        {
+            heap->zeroBegin = lo;
+            heap->zeroEnd = hi;
+        }
+        
+        // what is left on each side, in whole pages.
+        lo = range->begin < begin ? zm_pageDown(heap, begin) : range->begin;
+        hi = end < range->end ? zm_pageUp(heap, end) : range->end;
+        if(range->begin < lo && hi < range->end)
+        {
+            if(heap->purgedNum < ZM_MEM_PURGE_SLOTS)
+            {
+                heap->purged[heap->purgedNum].begin = hi;
+                heap->purged[heap->purgedNum].end = range->end;
+                heap->purgedNum++;
+                range->end = lo;
+            }
+            else if(lo - range->begin >= range->end - hi)
+            {
+                range->end = lo;
+            }
+            else
+            {
+                range->begin = hi;
+            }
+            i++;
+        }
+        else if(range->begin < lo)
+        {
+            range->end = lo;
+            i++;
+        }
+        else if(hi < range->end)
+        {
+            range->begin = hi;
+            i++;
+        }
+        else
+        {
+            *range = heap->purged[--heap->purgedNum];
+        }
+    }
+}
+
+/** the block at idx was handed out, with the header and links of a split tail after it */
+ZM_INLINE void zm_purgeUse(zm_heap_t *heap, zm_size_t idx)
+{
+    if(heap->purgedNum)
+    {
+        zm_purgeDirty(heap, idx, zm_blkNext(heap, idx) + MEM_STRUCT_SIZE + ZM_MEM_LINK_SIZE);
+    }
+}
+
+/* remember [begin, end), ranges inside it are merged in */
+static void zm_purgeAdd(zm_heap_t *heap, zm_size_t begin, zm_size_t end)
+{
+    zm_uint32_t i = 0;
+    zm_uint32_t small = 0;
+    
+    while(i < heap->purgedNum)
+    {
+        if(heap->purged[i].begin >= begin && heap->purged[i].end <= end)
+        {
+            heap->purged[i] = heap->purged[--heap->purgedNum];
+            continue;
+        }
+        if(heap->purged[i].end - heap->purged[i].begin <
+           heap->purged[small].end - heap->purged[small].begin)
+        {
+            small = i;
+        }
+        i++;
+    }
+    
+    if(heap->purgedNum < ZM_MEM_PURGE_SLOTS)
+    {
+        small = heap->purgedNum++;
+    }
+    else if(end - begin <= heap->purged[small].end - heap->purged[small].begin)
+    {
+        // table full, forgetting pages only costs a later madvise.
+        return;
+    }
+    heap->purged[small].begin = begin;
+    heap->purged[small].end = end;
+}
+
+/*****************************************************************
+* FUNCTION: zm_purgeBlock
+*
+* DESCRIPTION: 
+*     Purge the whole pages inside a free block.
+* INPUTS:
+*     heap : The heap handle.
+*     idx : The free block.
+* RETURNS:
+*     The number of bytes given to madvise.
+* NOTE:
+*     The page of the header and links and the page of the footer stay,
+*     pages already purged are skipped.
+*****************************************************************/
+static zm_size_t zm_purgeBlock(zm_heap_t *heap, zm_size_t idx)
+{
+    zm_size_t begin = zm_pageUp(heap, idx + MEM_STRUCT_SIZE + ZM_MEM_LINK_SIZE);
+    zm_size_t end = zm_pageDown(heap, zm_blkNext(heap, idx) - sizeof(zm_size_t));
+    zm_size_t cur = begin;
+    zm_size_t done = 0;
+    
+    if(heap->reserveEnd == NULL) return 0;
+    
+    // never past the reservation, whatever the rounding gave.
+    if(end > (zm_size_t)(heap->reserveEnd - heap->memHeap))
+    {
+        end = (zm_size_t)(heap->reserveEnd - heap->memHeap);
+    }
+    if(end <= begin) return 0;
+    
+    while(cur < end)
+    {
+        zm_size_t gapEnd = end;
+        zm_size_t skip = end;
+        zm_uint32_t i;
+        
+        // ranges of this block are inside [begin, end) and do not overlap.
+        for(i = 0; i < heap->purgedNum; i++)
+        {
+            if(heap->purged[i].begin >= cur && heap->purged[i].begin < gapEnd)
+            {
+                gapEnd = heap->purged[i].begin;
+                skip = heap->purged[i].end;
+            }
+        }
+        
+        if(gapEnd > cur)
+        {
+            madvise(&heap->memHeap[cur], gapEnd - cur, ZM_MEM_PURGE_ADVICE);
+            done += gapEnd - cur;
+        }
+        cur = skip;
+    }
+    
+    zm_purgeAdd(heap, begin, end);
+    
+    return done;
+}
+
+#if ZM_MEM_BEST_FIT
+/** purge the tree blocks of at least ZM_MEM_PURGE_MIN bytes, smaller subtrees are skipped */
+static zm_size_t zm_purgeTree(zm_heap_t *heap, zm_size_t node)
+{
+    zm_size_t done = 0;
+    
+    while(node != ZM_MEM_FREE_NIL)
+    {
+        zmMemTree_t *n = ZM_MEM_TREE_NODE(heap, node);
+        
+        if(n->size >= ZM_MEM_PURGE_MIN)
+        {
+            done += zm_purgeBlock(heap, node);
+            done += zm_purgeTree(heap, n->left);
+        }
+        node = n->right;
+    }
+    return done;
+}
+#endif
+
+/*****************************************************************
+* FUNCTION: zm_purge
+*
+* DESCRIPTION: 
+*     Purge every free block of at least ZM_MEM_PURGE_MIN bytes.
+* INPUTS:
+*     heap : The heap handle.
+* RETURNS:
+*     The number of bytes given to madvise.
+* NOTE:
+*     Only the lists and tree nodes that can hold such blocks are
+*     walked.
+*****************************************************************/
+static zm_size_t zm_purge(zm_heap_t *heap)
+{
+    zm_size_t bin;
+    zm_size_t done = 0;
+    
+    for(bin = zm_binIndex(ZM_MEM_PURGE_MIN); bin < ZM_MEM_BIN_NUM; bin++)
+    {
+        zm_size_t idx;
+        
+        for(idx = heap->binHead[bin]; idx != ZM_MEM_FREE_NIL; idx = ZM_MEM_FREE_NODE(heap, idx)->nextFree)
+        {
+            if(ZM_MEM_BLOCK_SIZE(heap, idx) >= ZM_MEM_PURGE_MIN)
+            {
+                done += zm_purgeBlock(heap, idx);
+            }
+        }
+    }
+#if ZM_MEM_BEST_FIT
+    done += zm_purgeTree(heap, heap->treeRoot);
+#endif
+    heap->purgePending = 0;
+    
+    return done;
+}
+
+/** decay check, one clock read per ZM_MEM_PURGE_TICKS calls while a run waits */
+ZM_INLINE void zm_purgeTick(zm_heap_t *heap)
+{
+#if ZM_MEM_PURGE_DECAY_MS
+    if(heap->purgePending && --heap->purgeTicks == 0)
+    {
+        heap->purgeTicks = ZM_MEM_PURGE_TICKS;
+        if((zm_uint32_t)(zm_purgeClock() - heap->purgeSince) >= ZM_MEM_PURGE_DECAY_MS)
+        {
+            zm_purge(heap);
+        }
+    }
+#else
+    (void)heap;
+#endif
+}
+#endif
+
+/*****************************************************************
+* FUNCTION: zm_putTogether
+*
+* DESCRIPTION: 
+*     Merge a free block with its free neighbours and put the
+*     result on its free list.
+* INPUTS:
+*     idx : The block just released, not on any free list.
+* RETURNS:
+*     null
+* NOTE:
+*     null
+*****************************************************************/
+static void zm_putTogether(zm_heap_t *heap, zm_size_t idx)
+{
+    zm_size_t next = zm_blkNext(heap, idx);
+    
+    if(!zm_blkUsed(heap, next))
+    {
+        zm_binRemove(heap, next);
+        next = zm_blkNext(heap, next);
+        ZM_MEM_LAT_ADD(heap, latMerge);
+    }
+    
+    if(zm_blkPrevFree(heap, idx))
+    {
+        idx = zm_blkPrev(heap, idx);
+        zm_binRemove(heap, idx);
+        ZM_MEM_LAT_ADD(heap, latMerge);
+    }
+    
+    zm_blkSet(heap, idx, next, 0);
+    zm_binInsert(heap, idx);
+    
+#if ZM_MEM_PURGE && ZM_MEM_PURGE_DECAY_MS
+    if(!heap->purgePending && (next - idx) > ZM_MEM_PURGE_MIN && heap->reserveEnd)
+    {
+        heap->purgePending = 1;
+        heap->purgeSince = zm_purgeClock();
+        heap->purgeTicks = ZM_MEM_PURGE_TICKS;
+    }
+#endif
+}
+
+#if ZM_MEM_FAST_MAX
+/*****************************************************************
+* FUNCTION: zm_fastConsolidate
+*
+* DESCRIPTION: 
+*     Merge every block of the fast bins into the free blocks.
+* INPUTS:
+*     heap : The heap handle.
+* RETURNS:
+*     null
+* NOTE:
+*     A fast neighbour is still marked used, it merges when its own
+*     turn comes.
+*****************************************************************/
+static void zm_fastConsolidate(zm_heap_t *heap)
+{
+    zm_size_t bin;
+    
+    for(bin = 0; bin < ZM_MEM_FAST_BINS; bin++)
+    {
+        zm_size_t idx = heap->fastHead[bin];
+        
+        while(idx != ZM_MEM_FREE_NIL)
+        {
+            zm_size_t next = ZM_MEM_FREE_NODE(heap, idx)->nextFree;
+            
+            zm_putTogether(heap, idx);
+            idx = next;
+        }
+        heap->fastHead[bin] = ZM_MEM_FREE_NIL;
+    }
+    heap->fastSize = 0;
+}
+
+/** park a freed block on its fast bin, the bins are swept once they hold too much */
+ZM_INLINE void zm_fastPush(zm_heap_t *heap, zm_size_t idx)
+{
+    zm_size_t bin = ZM_MEM_BLOCK_SIZE(heap, idx) / ZM_MEM_ALIGN_SIZE;
+    
+#if ZM_MEM_CHECK
+    if(heap->fastHead[bin] == idx)
+    {
+        // freed twice in a row, the block header can not tell.
+        ZM_MEM_ASSERT(0);
+    }
+#endif
+    
+    ZM_MEM_FREE_NODE(heap, idx)->nextFree = heap->fastHead[bin];
+    heap->fastHead[bin] = idx;
+    heap->fastSize += zm_blkNext(heap, idx) - idx;
+    
+    if(heap->fastSize > ZM_MEM_FAST_LIMIT)
+    {
+        zm_fastConsolidate(heap);
+    }
+}
+#endif
+
+/*****************************************************************
+* FUNCTION: zm_memSplit
+*
+* DESCRIPTION: 
+*     Cut the tail of a used block off and give it back to the bins.
+* INPUTS:
+*     heap : The heap handle.
+*     idx : Offset of the used block.
+*     size : Aligned payload size to keep.
+* RETURNS:
+*     null
+* NOTE:
+*     Nothing is done if the tail is too small to be a block, the tail
+*     is merged with the next block if that one is free.
+*****************************************************************/
+static void zm_memSplit(zm_heap_t *heap, zm_size_t idx, zm_size_t size)
+{
+    zm_size_t next = zm_blkNext(heap, idx);
+    zm_size_t tail;
+    
+    if((next - idx - MEM_STRUCT_SIZE) < (size + MEM_STRUCT_SIZE + MIN_SIZE_ALIGNED))
+    {
+        return;
+    }
+    
+    tail = idx + MEM_STRUCT_SIZE + size;
+    
+    zm_blkSet(heap, tail, next, 0);
+    zm_blkSet(heap, idx, tail, 1);
+    
+    zm_putTogether(heap, tail);
+}
+
+/*****************************************************************
+* FUNCTION: zm_mem_init
+*
+* DESCRIPTION: 
+*     zm dynamic memory init.
+* INPUTS:
+*     beginAddr : The beginning address of system heap memory.
+*     endAddr   : The end address of system heap memory.
+* RETURNS:
+*     The heap, its control block is at the beginning of the memory.
+*     NULL : faild, the memory is too small.
+* NOTE:
+*     null
+*****************************************************************/
+static zm_heap_t *zm_mem_init(void *beginAddr, void *endAddr)
+{
+    zm_heap_t *heap;
+    zm_size_t bin;
+    zm_size_t end;
+    zm_size_t memSize;
+    zm_uintptr_t span;
+    
+    zm_uintptr_t beginAlign = ZM_ALIGN((zm_uintptr_t)beginAddr, ZM_MEM_ALIGN_SIZE);
+    zm_uintptr_t endAlign = ZM_ALIGN_DOWN((zm_uintptr_t)endAddr, ZM_MEM_ALIGN_SIZE);
+    
+    if(endAlign > (HEAP_STRUCT_SIZE + 2 * MEM_STRUCT_SIZE) &&
+       (endAlign - HEAP_STRUCT_SIZE - 2 * MEM_STRUCT_SIZE) >= beginAlign)
+    {
+        span = endAlign - beginAlign - HEAP_STRUCT_SIZE - 2 * MEM_STRUCT_SIZE;
+    }
+    else
+    {
+        //memory error begin address and end address.
+        return NULL;
+    }
+    
+    // offsets must stay below ZM_MEM_FREE_NIL, the rest is left unused.
+    if(span > ZM_MEM_SIZE_MAX) span = ZM_MEM_SIZE_MAX;
+    memSize = (zm_size_t)span;
+    
+    heap = (zm_heap_t *)beginAlign;
+    heap->beginAddr = beginAddr;
+    heap->endAddr = endAddr;
+    heap->memSize = memSize;
+    heap->memHeap = (zm_uint8_t *)heap + HEAP_STRUCT_SIZE;
+    
+    end = heap->memSize + MEM_STRUCT_SIZE;
+    heap->memEnd = ZM_MEM_PTR(heap, end);
+    zm_blkSet(heap, end, end, 1);
+    
+    zm_blkSetFirst(heap);
+    
+#if ZM_MEM_STATS
+    memset(&heap->memStats, 0, sizeof(heap->memStats));
+#endif
+    
+    for(bin = 0; bin < ZM_MEM_BIN_NUM; bin++)
+    {
+        heap->binHead[bin] = ZM_MEM_FREE_NIL;
+    }
+#if (ZM_MEM_POLICY == ZM_MEM_POLICY_SEGFIT)
+    memset(heap->binMap, 0, sizeof(heap->binMap));
+#else
+    heap->flMap = 0;
+    memset(heap->slMap, 0, sizeof(heap->slMap));
+#endif
+#if ZM_MEM_BEST_FIT
+    heap->treeRoot = ZM_MEM_FREE_NIL;
+#endif
+#if ZM_MEM_FAST_MAX
+    for(bin = 0; bin < ZM_MEM_FAST_BINS; bin++)
+    {
+        heap->fastHead[bin] = ZM_MEM_FREE_NIL;
+    }
+    heap->fastSize = 0;
+#endif
+    
+    if(heap->memSize >= MIN_SIZE_ALIGNED)
+    {
+        zm_blkSet(heap, 0, end, 0);
+        zm_binInsert(heap, 0);
+    }
+    else
+    {
+        zm_blkSet(heap, 0, end, 1);
+    }
+
+#if ZM_MEM_THREAD_CACHE
+    heap->remoteFree = NULL;
+#endif
+#if ZM_MEM_USE_MMAP
+    heap->reserveEnd = NULL;
+    heap->hugeMode = ZM_MEM_HUGE_NONE;
+#endif
+#if ZM_MEM_PURGE
+    heap->purgedNum = 0;
+    heap->purgePending = 0;
+    heap->zeroBegin = 0;
+    heap->zeroEnd = 0;
+#endif
+    
+    return heap;
+}
+
+#if ZM_MEM_USE_MMAP
+/* PROT_NONE costs address space only, pages come with zm_memCommit */
+static zm_uint8_t *zm_memReserve(zm_uintptr_t reserve)
+{
+    zm_uint8_t *base;
+#if ZM_MEM_HUGE
+    zm_uint8_t *begin;
+    zm_uint8_t *end;
+    
+    // one huge page more, the range is trimmed to an aligned one.
+    base = (zm_uint8_t *)mmap(NULL, reserve + ZM_MEM_HUGE_SIZE, PROT_NONE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(base == (zm_uint8_t *)MAP_FAILED) return NULL;
+    
+    begin = (zm_uint8_t *)ZM_ALIGN((zm_uintptr_t)base, (zm_uintptr_t)ZM_MEM_HUGE_SIZE);
+    end = base + reserve + ZM_MEM_HUGE_SIZE;
+    if(begin > base) munmap(base, (zm_uintptr_t)(begin - base));
+    if(end > begin + reserve) munmap(begin + reserve, (zm_uintptr_t)(end - begin - reserve));
+    
+    return begin;
+#else
+    base = (zm_uint8_t *)mmap(NULL, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    
+    return base == (zm_uint8_t *)MAP_FAILED ? NULL : base;
+#endif
+}
+
+#if ZM_MEM_HUGE
+/* transparent huge pages for [begin, end), the mode the range gets */
+static zm_uint32_t zm_hugeAdvise(zm_uint8_t *begin, zm_uint8_t *end)
+{
+    if(madvise(begin, (zm_uintptr_t)(end - begin), MADV_HUGEPAGE) == 0) return ZM_MEM_HUGE_THP;
+    
+    return ZM_MEM_HUGE_NONE;
+}
+#endif
+
+/*****************************************************************
+* FUNCTION: zm_memCommit
+*
+* DESCRIPTION: 
+*     Make part of a reserved range usable.
+* INPUTS:
+*     addr : Start, aligned to the heap growth step.
+*     size : Multiple of the heap growth step.
+*     reserveEnd : End of the reserved range.
+*     hugeMode : Mode of the heap, updated on fallback.
+* RETURNS:
+*     1 : success.
+*     0 : faild.
+* NOTE:
+*     ZM_MEM_HUGE_HUGETLB maps pool pages over the reservation. When the
+*     pool is short, this and the rest of the range fall back to
+*     transparent or normal pages.
+*****************************************************************/
+static int zm_memCommit(zm_uint8_t *addr, zm_uintptr_t size, zm_uint8_t *reserveEnd, zm_uint32_t *hugeMode)
+{
+#if ZM_MEM_HUGE == ZM_MEM_HUGE_HUGETLB
+    if(*hugeMode == ZM_MEM_HUGE_HUGETLB)
+    {
+        if(mmap(addr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB,
+                -1, 0) != MAP_FAILED)
+        {
+            return 1;
+        }
+        
+        // older kernels unmap the old range on failure, reserve it again.
+        mmap(addr, (zm_uintptr_t)(reserveEnd - addr), PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+        *hugeMode = zm_hugeAdvise(addr, reserveEnd);
+    }
+#else
+    (void)reserveEnd;
+    (void)hugeMode;
+#endif
+    
+    return mprotect(addr, size, PROT_READ | PROT_WRITE) == 0;
+}
+
+/** growth step, whole huge pages once the heap has them */
+ZM_INLINE zm_uintptr_t zm_memStep(zm_uintptr_t pageSize)
+{
+    return pageSize > ZM_MEM_MMAP_COMMIT ? pageSize : ZM_MEM_MMAP_COMMIT;
+}
+
+/*****************************************************************
+* FUNCTION: zm_mem_mmapInit
+*
+* DESCRIPTION: 
+*     Create a heap in a reserved virtual range.
+* INPUTS:
+*     reserve : Size of the range.
+* RETURNS:
+*     The heap, its first pages committed.
+*     NULL : faild, the range could not be reserved.
+* NOTE:
+*     With ZM_MEM_HUGE the range is aligned to ZM_MEM_HUGE_SIZE.
+*****************************************************************/
+static zm_heap_t *zm_mem_mmapInit(zm_uintptr_t reserve)
+{
+    zm_uint32_t hugeMode = ZM_MEM_HUGE;
+    zm_uintptr_t pageSize;
+    zm_uintptr_t commit;
+    zm_uint8_t *base;
+    zm_heap_t *heap;
+    
+    if(zmMemPageSize == 0) zmMemPageSize = (zm_uintptr_t)sysconf(_SC_PAGESIZE);
+    
+    pageSize = hugeMode != ZM_MEM_HUGE_NONE ? ZM_MEM_HUGE_SIZE : zmMemPageSize;
+    commit = ZM_ALIGN(HEAP_STRUCT_SIZE + 2 * MEM_STRUCT_SIZE + MIN_SIZE_ALIGNED, zm_memStep(pageSize));
+    
+    reserve = ZM_ALIGN(reserve, zm_memStep(pageSize));
+    if(reserve < commit) reserve = commit;
+    
+    base = zm_memReserve(reserve);
+    if(base == NULL) return NULL;
+    
+#if ZM_MEM_HUGE == ZM_MEM_HUGE_THP
+    hugeMode = zm_hugeAdvise(base, base + reserve);
+#endif
+    
+    if(!zm_memCommit(base, commit, base + reserve, &hugeMode) ||
+       (heap = zm_mem_init(base, base + commit)) == NULL)
+    {
+        munmap(base, reserve);
+        return NULL;
+    }
+    heap->reserveEnd = base + reserve;
+    heap->hugeMode = hugeMode;
+    // a heap that fell back to normal pages from the start purges them one by one.
+    heap->pageSize = hugeMode != ZM_MEM_HUGE_NONE ? pageSize : zmMemPageSize;
+    
+    return heap;
+}
+
+/*****************************************************************
+* FUNCTION: zm_memGrow
+*
+* DESCRIPTION: 
+*     Commit more of the reserved range and move the end sentinel.
+* INPUTS:
+*     heap : The heap handle.
+*     size : Aligned payload size that must fit afterwards.
+* RETURNS:
+*     Offset of the last block, free and big enough for size.
+*     ZM_MEM_FREE_NIL : fixed heap, reserve exhausted or commit faild.
+* NOTE:
+*     The old sentinel becomes the header of the new free space and is
+*     merged with a free last block.
+*****************************************************************/
+static zm_size_t zm_memGrow(zm_heap_t *heap, zm_size_t size)
+{
+    zm_uint8_t *commitEnd = (zm_uint8_t *)heap->endAddr;
+    zm_size_t end = heap->memSize + MEM_STRUCT_SIZE;
+    zm_uintptr_t grow;
+    
+    if(heap->reserveEnd == NULL) return ZM_MEM_FREE_NIL;
+    
+    // checked before the headers are added, the sum may wrap.
+    if((zm_uintptr_t)size > (zm_uintptr_t)(heap->reserveEnd - commitEnd)) return ZM_MEM_FREE_NIL;
+    
+    grow = ZM_ALIGN((zm_uintptr_t)size + 2 * MEM_STRUCT_SIZE + MIN_SIZE_ALIGNED, zm_memStep(heap->pageSize));
+    if(grow > (zm_uintptr_t)(heap->reserveEnd - commitEnd) ||
+       grow > (zm_uintptr_t)(ZM_MEM_SIZE_MAX - heap->memSize))
+    {
+        return ZM_MEM_FREE_NIL;
+    }
+    
+    if(!zm_memCommit(commitEnd, grow, heap->reserveEnd, &heap->hugeMode)) return ZM_MEM_FREE_NIL;
+    
+    heap->endAddr = commitEnd + grow;
+    heap->memSize += (zm_size_t)grow;
+    heap->memEnd = ZM_MEM_PTR(heap, end + grow);
+    
+    zm_blkSet(heap, end + grow, end + grow, 1);
+    zm_blkSet(heap, end, end + grow, 1);
+    zm_putTogether(heap, end);
+    
+#if ZM_MEM_PURGE
+    // fresh pages are not resident and read as zero, as if purged.
+    if(zm_pageDown(heap, end + grow - sizeof(zm_size_t)) > zm_pageUp(heap, end + MEM_STRUCT_SIZE + ZM_MEM_LINK_SIZE))
+    {
+        zm_purgeAdd(heap, zm_pageUp(heap, end + MEM_STRUCT_SIZE + ZM_MEM_LINK_SIZE),
+                    zm_pageDown(heap, end + grow - sizeof(zm_size_t)));
+    }
+#endif
+    
+    return zm_blkPrev(heap, end + grow);
+}
+#endif
+
+/** largest payload the heap can ever hand out */
+ZM_INLINE zm_size_t zm_memLimit(zm_heap_t *heap)
+{
+#if ZM_MEM_USE_MMAP
+    if(heap->reserveEnd) return ZM_MEM_SIZE_MAX;
+#endif
+    return heap->memSize;
+}
+
+/** a free block of at least size, the heap grows if it can */
+static zm_size_t zm_memFind(zm_heap_t *heap, zm_size_t size)
+{
+    zm_size_t idx = ZM_MEM_FREE_NIL;
+    
+    if(size <= heap->memSize)
+    {
+        idx = zm_freeFind(heap, size);
+    }
+#if ZM_MEM_FAST_MAX
+    if(idx == ZM_MEM_FREE_NIL && heap->fastSize)
+    {
+        // the merged fast blocks may make room.
+        zm_fastConsolidate(heap);
+        if(size <= heap->memSize) idx = zm_freeFind(heap, size);
+    }
+#endif
+#if ZM_MEM_USE_MMAP
+    if(idx == ZM_MEM_FREE_NIL)
+    {
+        // not looked up, the bins round size up past the new block.
+        idx = zm_memGrow(heap, size);
+    }
+#endif
+    return idx;
+}
+
+/*****************************************************************
+* FUNCTION: zm_mem_malloc
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation.
+* INPUTS:
+*     size : The number of bytes to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     null
+*****************************************************************/
+static void *zm_mem_malloc(zm_heap_t *heap, zm_size_t size)
+{
+    zm_size_t idx;
+    
+#if ZM_MEM_STATS
+    heap->memStats.mallocCount++;
+#endif
+#if ZM_MEM_PURGE
+    zm_purgeTick(heap);
+#endif
+    
+    if(size == 0 || size > zm_memLimit(heap)) return NULL;
+    
+    size = ZM_ALIGN_GET(size);
+    
+    if(size < MIN_SIZE_ALIGNED) size = MIN_SIZE_ALIGNED;
+    
+#if ZM_MEM_FAST_MAX
+    if(size <= ZM_MEM_FAST_MAX && heap->fastHead[size / ZM_MEM_ALIGN_SIZE] != ZM_MEM_FREE_NIL)
+    {
+        // still marked used, nothing to unlink or split.
+        idx = heap->fastHead[size / ZM_MEM_ALIGN_SIZE];
+        heap->fastHead[size / ZM_MEM_ALIGN_SIZE] = ZM_MEM_FREE_NODE(heap, idx)->nextFree;
+        heap->fastSize -= zm_blkNext(heap, idx) - idx;
+    }
+    else
+#endif
+    {
+        ZM_MEM_LAT_ZERO(heap, latScan);
+        idx = zm_memFind(heap, size);
+        ZM_MEM_LAT_PUT(ZM_LAT_SCAN, heap->latScan);
+        if(idx == ZM_MEM_FREE_NIL) return NULL;
+        
+        zm_binRemove(heap, idx);
+        
+        zm_blkSet(heap, idx, zm_blkNext(heap, idx), 1);
+        zm_memSplit(heap, idx, size);
+#if ZM_MEM_PURGE
+        zm_purgeUse(heap, idx);
+#endif
+    }
+    
+#if ZM_MEM_STATS
+    heap->memStats.usedSize += (zm_blkNext(heap, idx) - idx);
+    if(heap->memStats.maxSize < heap->memStats.usedSize)
+    {
+        heap->memStats.maxSize = heap->memStats.usedSize;
+    }
+#endif
+    
+    return &heap->memHeap[idx + MEM_STRUCT_SIZE];
+}
+
+/*****************************************************************
+* FUNCTION: zm_mem_realloc
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation.
+* INPUTS:
+*     ptr : pointer to memory allocated by zm_mem_malloc.
+*     newsize : The number of new size to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     Shrinking gives the tail back in place. Growing first takes the
+*     next block if it is free, then the previous free block with a
+*     memmove, and only then allocates a new block and copies.
+*****************************************************************/
+static void *zm_mem_realloc(zm_heap_t *heap, void *ptr, zm_size_t newsize)
+{
+    zm_size_t idx;
+    zm_size_t next;
+    zm_size_t size;
+    zm_size_t span;
+    zm_size_t avail;
+    zm_uint32_t nextFree;
+    zm_uint32_t prevFree;
+    void *newMem;
+    
+#if ZM_MEM_STATS
+    heap->memStats.reallocCount++;
+#endif
+    
+    if(newsize > zm_memLimit(heap)) return NULL;
+    
+    newsize = ZM_ALIGN_GET(newsize);
+    
+    if(newsize == 0)
+    {
+        zm_mem_free(heap, ptr);
+        return NULL;
+    }
+
+    if(newsize < MIN_SIZE_ALIGNED) newsize = MIN_SIZE_ALIGNED;
+    
+    if(ptr == NULL) return zm_mem_malloc(heap, newsize);
+    
+    if((zm_uint8_t *)ptr < (zm_uint8_t *)heap->memHeap ||
+       (zm_uint8_t *)ptr >= (zm_uint8_t *)heap->memEnd)
+    {
+        //illegal memory
+        return ptr;
+    }
+    
+    idx = ZM_MEM_IDX(heap, (zm_uint8_t *)ptr - MEM_STRUCT_SIZE);
+    next = zm_blkNext(heap, idx);
+    span = next - idx;
+    size = span - MEM_STRUCT_SIZE;
+    
+    if(newsize <= size)
+    {
+        zm_memSplit(heap, idx, newsize);
+#if ZM_MEM_STATS
+        heap->memStats.usedSize -= span - (zm_blkNext(heap, idx) - idx);
+#endif
+        return ptr;
+    }
+    
+    nextFree = !zm_blkUsed(heap, next);
+    prevFree = zm_blkPrevFree(heap, idx);
+    
+    avail = size;
+    if(nextFree) avail += zm_blkNext(heap, next) - next;
+    
+    if(avail < newsize)
+    {
+        if(!prevFree || (avail + idx - zm_blkPrev(heap, idx)) < newsize)
+        {
+            prevFree = 0;
+            nextFree = 0;
+        }
+    }
+    else
+    {
+        // the next block is enough, data stays where it is.
+        prevFree = 0;
+    }
+    
+    if(nextFree)
+    {
+        zm_binRemove(heap, next);
+        next = zm_blkNext(heap, next);
+    }
+    
+    if(prevFree)
+    {
+        idx = zm_blkPrev(heap, idx);
+        zm_binRemove(heap, idx);
+        ptr = memmove(&heap->memHeap[idx + MEM_STRUCT_SIZE], ptr, size);
+    }
+    
+    if(nextFree || prevFree)
+    {
+        zm_blkSet(heap, idx, next, 1);
+        zm_memSplit(heap, idx, newsize);
+#if ZM_MEM_PURGE
+        zm_purgeUse(heap, idx);
+#endif
+#if ZM_MEM_STATS
+        heap->memStats.usedSize += (zm_blkNext(heap, idx) - idx) - span;
+        if(heap->memStats.maxSize < heap->memStats.usedSize)
+        {
+            heap->memStats.maxSize = heap->memStats.usedSize;
+        }
+#endif
+        return ptr;
+    }
+    
+    newMem = zm_mem_malloc(heap, newsize);
+    
+    if(newMem)
+    {
+        memcpy(newMem, ptr, size < newsize ? size : newsize);
+        zm_mem_free(heap, ptr);
+    }
+        
+    return newMem;
+}
+/*****************************************************************
+* FUNCTION: zm_mem_calloc
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation.
+*     This function will contiguously allocate enough space for count objects
+*     that are size bytes of memory each and returns a pointer to the allocated.
+* memory.
+* INPUTS:
+*     count : Number of objects to allocate.
+*     size : The number of size to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     Purged pages of the block are known to be zero, they are not
+*     cleared (and not made resident).
+*****************************************************************/
+static void *zm_mem_calloc(zm_heap_t *heap, zm_size_t count, zm_size_t size)
+{
+    void *ptr;
+    
+    if(size && count > ZM_MEM_FREE_NIL / size) return NULL;
+    
+#if ZM_MEM_PURGE && !ZM_MEM_PURGE_LAZY
+    heap->zeroBegin = 0;
+    heap->zeroEnd = 0;
+#endif
+    
+    ptr = zm_mem_malloc(heap, count * size);
+    
+#if ZM_MEM_PURGE && !ZM_MEM_PURGE_LAZY
+    if(ptr && heap->zeroEnd > heap->zeroBegin)
+    {
+        zm_uint8_t *begin = (zm_uint8_t *)ptr;
+        zm_uint8_t *end = begin + count * size;
+        zm_uint8_t *zeroBegin = &heap->memHeap[heap->zeroBegin];
+        zm_uint8_t *zeroEnd = &heap->memHeap[heap->zeroEnd];
+        
+        if(zeroBegin < begin) zeroBegin = begin;
+        if(zeroBegin > end) zeroBegin = end;
+        if(zeroEnd > end) zeroEnd = end;
+        if(zeroEnd < zeroBegin) zeroEnd = zeroBegin;
+        
+        memset(begin, 0, (zm_size_t)(zeroBegin - begin));
+        memset(zeroEnd, 0, (zm_size_t)(end - zeroEnd));
+        
+        return ptr;
+    }
+#endif
+    
+    if(ptr) memset(ptr, 0, count * size);
+    
+    return ptr;
+}
+/*****************************************************************
+* FUNCTION: zm_mem_memalign
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation with a given alignment.
+* INPUTS:
+*     alignment : Power of two.
+*     size : The number of bytes to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     A block with room for the worst padding is taken, the padding in
+*     front is then freed as a block of its own, the tail is split off.
+*****************************************************************/
+static void *zm_mem_memalign(zm_heap_t *heap, zm_size_t alignment, zm_size_t size)
+{
+    zm_size_t idx;
+    zm_size_t pad;
+    zm_size_t limit;
+    void *ptr;
+#if ZM_MEM_STATS
+    zm_size_t span;
+    zm_size_t maxSize = heap->memStats.maxSize;
+#endif
+    
+    if(alignment == 0 || (alignment & (alignment - 1))) return NULL;
+    
+    if(alignment <= ZM_MEM_ALIGN_SIZE) return zm_mem_malloc(heap, size);
+    
+    // checked before the padding is added, the sum may wrap.
+    limit = zm_memLimit(heap);
+    if(size == 0 || limit < MEM_STRUCT_SIZE + MIN_SIZE_ALIGNED) return NULL;
+    limit -= MEM_STRUCT_SIZE + MIN_SIZE_ALIGNED;
+    if(alignment > limit || size > limit - alignment) return NULL;
+    
+    size = ZM_ALIGN_GET(size);
+    if(size < MIN_SIZE_ALIGNED) size = MIN_SIZE_ALIGNED;
+    
+    ptr = zm_mem_malloc(heap, size + alignment + MEM_STRUCT_SIZE + MIN_SIZE_ALIGNED);
+    if(ptr == NULL) return NULL;
+    
+    idx = ZM_MEM_IDX(heap, (zm_uint8_t *)ptr - MEM_STRUCT_SIZE);
+    
+    pad = (zm_size_t)(ZM_ALIGN((zm_uintptr_t)ptr, (zm_uintptr_t)alignment) - (zm_uintptr_t)ptr);
+    if(pad)
+    {
+        // the padding must hold a free block.
+        while(pad < MEM_STRUCT_SIZE + MIN_SIZE_ALIGNED) pad += alignment;
+        
+        zm_blkSet(heap, idx + pad, zm_blkNext(heap, idx), 1);
+        zm_blkSet(heap, idx, idx + pad, 0);
+#if ZM_MEM_STATS
+        heap->memStats.usedSize -= pad;
+#endif
+        zm_putTogether(heap, idx);
+        
+        idx += pad;
+    }
+    
+#if ZM_MEM_STATS
+    span = zm_blkNext(heap, idx) - idx;
+#endif
+    zm_memSplit(heap, idx, size);
+#if ZM_MEM_STATS
+    heap->memStats.usedSize -= span - (zm_blkNext(heap, idx) - idx);
+    // the peak must not see the oversized block.
+    if(maxSize < heap->memStats.usedSize) maxSize = heap->memStats.usedSize;
+    heap->memStats.maxSize = maxSize;
+#endif
+    
+    return &heap->memHeap[idx + MEM_STRUCT_SIZE];
+}
+/*****************************************************************
+* FUNCTION: zm_mem_free
+*
+* DESCRIPTION: 
+*       zm dynamic memory de-allocation.
+* INPUTS:
+*     ptr : The first address assigned by zm_mem_malloc().
+* RETURNS:
+*     null
+* NOTE:
+*     null
+*****************************************************************/
+static void zm_mem_free(zm_heap_t *heap, void *ptr)
+{
+    zm_size_t idx;
+    
+    if(ptr == NULL) return;
+    
+    if((zm_uint8_t *)ptr < (zm_uint8_t *)heap->memHeap ||
+       (zm_uint8_t *)ptr >= (zm_uint8_t *)heap->memEnd)
+    {
+        //illegal memory
+        return;
+    }
+    
+#if ZM_MEM_STATS
+    heap->memStats.freeCount++;
+#endif
+    
+    idx = ZM_MEM_IDX(heap, (zm_uint8_t *)ptr - MEM_STRUCT_SIZE);
+    
+#if ZM_MEM_CHECK
+    if(!zm_blkValid(heap, idx))
+    {
+        ZM_MEM_ASSERT(0);
+        //return;
+    }
+#endif
+    
+#if ZM_MEM_STATS
+    heap->memStats.usedSize -= (zm_blkNext(heap, idx) - idx);
+#endif
+    
+#if ZM_MEM_FAST_MAX
+    if(ZM_MEM_BLOCK_SIZE(heap, idx) <= ZM_MEM_FAST_MAX)
+    {
+        zm_fastPush(heap, idx);
+    }
+    else
+#endif
+    {
+        ZM_MEM_LAT_ZERO(heap, latMerge);
+        zm_putTogether(heap, idx);
+        ZM_MEM_LAT_PUT(ZM_LAT_MERGE, heap->latMerge);
+    }
+#if ZM_MEM_PURGE
+    zm_purgeTick(heap);
+#endif
+}
+
+/*****************************************************************
+* FUNCTION: zm_mem_mallocBatch
+*
+* DESCRIPTION: 
+*     Allocate n blocks of one size.
+* INPUTS:
+*     heap : The heap handle.
+*     size : The number of bytes of each block.
+*     n : The number of blocks.
+*     ptrs : Filled with the blocks.
+* RETURNS:
+*     The number of blocks allocated, less than n if out of memory.
+* NOTE:
+*     The blocks are carved side by side out of one free block big
+*     enough for all of them, or out of as few blocks as the bins have.
+*****************************************************************/
+static zm_size_t zm_mem_mallocBatch(zm_heap_t *heap, zm_size_t size, zm_size_t n, void *ptrs[])
+{
+    zm_size_t got = 0;
+    zm_size_t taken = 0;
+    zm_size_t span;
+    zm_uint32_t whole = 1;
+    
+#if ZM_MEM_STATS
+    heap->memStats.mallocCount += n;
+#endif
+#if ZM_MEM_PURGE
+    zm_purgeTick(heap);
+#endif
+    
+    if(size == 0 || size > zm_memLimit(heap)) return 0;
+    
+    size = ZM_ALIGN_GET(size);
+    
+    if(size < MIN_SIZE_ALIGNED) size = MIN_SIZE_ALIGNED;
+    
+    span = MEM_STRUCT_SIZE + size;
+    
+    while(got < n)
+    {
+        zm_size_t want = n - got;
+        zm_size_t idx = ZM_MEM_FREE_NIL;
+        zm_size_t next, tail, end, blk, k, i;
+        
+        // one free block for all the rest, else any block that holds one.
+        if(whole && want > 1)
+        {
+            if(want > (heap->memSize + MEM_STRUCT_SIZE) / span)
+            {
+                want = (heap->memSize + MEM_STRUCT_SIZE) / span;
+            }
+            if(want > 1)
+            {
+                idx = zm_freeFind(heap, want * span - MEM_STRUCT_SIZE);
+            }
+            whole = (idx != ZM_MEM_FREE_NIL);
+        }
+        if(idx == ZM_MEM_FREE_NIL)
+        {
+            idx = zm_memFind(heap, size);
+            if(idx == ZM_MEM_FREE_NIL) break;
+        }
+        
+        zm_binRemove(heap, idx);
+        
+        next = zm_blkNext(heap, idx);
+        
+        // as many as fit, counted rather than divided.
+        tail = idx + span;
+        for(k = 1; got + k < n && (next - tail) >= span; k++)
+        {
+            tail += span;
+        }
+        
+        if((next - tail) >= (MEM_STRUCT_SIZE + MIN_SIZE_ALIGNED))
+        {
+            zm_blkSet(heap, tail, next, 0);
+        }
+        else
+        {
+            // too small to be a block, the last one keeps it.
+            tail = next;
+        }
+        
+        taken += tail - idx;
+        got += k;
+#if ZM_MEM_PURGE
+        if(heap->purgedNum)
+        {
+            zm_purgeDirty(heap, idx, tail + MEM_STRUCT_SIZE + ZM_MEM_LINK_SIZE);
+        }
+#endif
+        
+        // back to front, zm_blkSet wants the later header written.
+        for(i = got, end = tail; k--; end = blk)
+        {
+            blk = idx + k * span;
+            zm_blkSet(heap, blk, end, 1);
+            ptrs[--i] = &heap->memHeap[blk + MEM_STRUCT_SIZE];
+        }
+        
+        if(tail != next)
+        {
+            zm_binInsert(heap, tail);
+        }
+    }
+    
+#if ZM_MEM_STATS
+    heap->memStats.usedSize += taken;
+    if(heap->memStats.maxSize < heap->memStats.usedSize)
+    {
+        heap->memStats.maxSize = heap->memStats.usedSize;
+    }
+#else
+    (void)taken;
+#endif
+    
+    return got;
+}
+
+/* shell sort by address, no callback and no recursion, n is a burst */
+static void zm_ptrSort(void *ptrs[], zm_size_t n)
+{
+    static const zm_size_t gaps[] = {701, 301, 132, 57, 23, 10, 4, 1};
+    zm_uint32_t g;
+    
+    for(g = 0; gaps[g] >= n && gaps[g] > 1; g++);
+    
+    for(; g < sizeof(gaps) / sizeof(gaps[0]); g++)
+    {
+        zm_size_t gap = gaps[g];
+        zm_size_t i, j;
+        
+        for(i = gap; i < n; i++)
+        {
+            void *ptr = ptrs[i];
+            
+            for(j = i; j >= gap && (zm_uintptr_t)ptrs[j - gap] > (zm_uintptr_t)ptr; j -= gap)
+            {
+                ptrs[j] = ptrs[j - gap];
+            }
+            ptrs[j] = ptr;
+        }
+    }
+}
+
+/*****************************************************************
+* FUNCTION: zm_mem_freeSorted
+*
+* DESCRIPTION: 
+*     Free blocks given in address order.
+* INPUTS:
+*     heap : The heap handle.
+*     ptrs : The blocks, sorted by address, NULL first.
+*     n : The number of blocks.
+* RETURNS:
+*     null
+* NOTE:
+*     Blocks that are neighbours in memory are merged into one run
+*     before it goes to the bins, so a run costs one zm_putTogether.
+*****************************************************************/
+static void zm_mem_freeSorted(zm_heap_t *heap, void *ptrs[], zm_size_t n)
+{
+    zm_size_t i = 0;
+    zm_size_t released = 0;
+    zm_size_t freed = 0;
+    
+    while(i < n)
+    {
+        zm_uint8_t *ptr = (zm_uint8_t *)ptrs[i++];
+        zm_size_t idx, next;
+    
+        if(ptr < heap->memHeap || ptr >= (zm_uint8_t *)heap->memEnd)
+        {
+            //illegal memory
+            continue;
+        }
+    
+        idx = ZM_MEM_IDX(heap, ptr - MEM_STRUCT_SIZE);
+    
+#if ZM_MEM_CHECK
+        if(!zm_blkValid(heap, idx))
+        {
+            ZM_MEM_ASSERT(0);
+            //continue;
+        }
+#endif
+    
+        next = zm_blkNext(heap, idx);
+        freed++;
+    
+        while(i < n && (zm_uint8_t *)ptrs[i] == &heap->memHeap[next + MEM_STRUCT_SIZE])
+        {
+#if ZM_MEM_CHECK
+            if(!zm_blkValid(heap, next))
+            {
+                ZM_MEM_ASSERT(0);
+                //break;
+            }
+#endif
+            next = zm_blkNext(heap, next);
+            freed++;
+            i++;
+        }
+    
+        released += next - idx;
+    
+        zm_blkSet(heap, idx, next, 1);
+        zm_putTogether(heap, idx);
+    }
+    
+#if ZM_MEM_STATS
+    heap->memStats.freeCount += freed;
+    heap->memStats.usedSize -= released;
+#else
+    (void)released;
+    (void)freed;
+#endif
+#if ZM_MEM_PURGE
+    zm_purgeTick(heap);
+#endif
+}
+
+/*****************************************************************
+* FUNCTION: zm_mem_freeBatch
+*
+* DESCRIPTION: 
+*     Free n blocks at once.
+* INPUTS:
+*     heap : The heap handle.
+*     ptrs : The blocks, NULL entries are skipped.
+*     n : The number of blocks.
+* RETURNS:
+*     null
+* NOTE:
+*     ptrs is sorted by address in place.
+*****************************************************************/
+static void zm_mem_freeBatch(zm_heap_t *heap, void *ptrs[], zm_size_t n)
+{
+    zm_ptrSort(ptrs, n);
+    zm_mem_freeSorted(heap, ptrs, n);
+}
+
+#if ZM_MEM_THREAD_CACHE
+/*****************************************************************
+* FUNCTION: zm_remotePush
+*
+* DESCRIPTION: 
+*     Queue a block on the remote free list of its heap.
+* INPUTS:
+*     heap : The heap owning the block.
+*     ptr : The block to free.
+* RETURNS:
+*     null
+* NOTE:
+*     Lock-free multi-producer push, the block is linked through its
+*     first word. Only the lock holder takes the list, all at once.
+*****************************************************************/
+static void zm_remotePush(zm_heap_t *heap, void *ptr)
+{
+    void *head = __atomic_load_n(&heap->remoteFree, __ATOMIC_RELAXED);
+    
+    do
+    {
+        ZM_MEM_TCACHE_NEXT(ptr) = head;
+    }
+    while(!__atomic_compare_exchange_n(&heap->remoteFree, &head, ptr, 1,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*****************************************************************
+* FUNCTION: zm_remoteDrain
+*
+* DESCRIPTION: 
+*     Free every block queued by zm_remotePush.
+* INPUTS:
+*     heap : The heap, its lock is held.
+* RETURNS:
+*     null
+* NOTE:
+*     null
+*****************************************************************/
+static void zm_remoteDrain(zm_heap_t *heap)
+{
+    void *ptr;
+    
+    if(__atomic_load_n(&heap->remoteFree, __ATOMIC_RELAXED) == NULL) return;
+    
+    ptr = __atomic_exchange_n(&heap->remoteFree, NULL, __ATOMIC_ACQUIRE);
+    while(ptr)
+    {
+        void *next = ZM_MEM_TCACHE_NEXT(ptr);
+        
+        zm_mem_free(heap, ptr);
+        ptr = next;
+    }
+}
+
+/*****************************************************************
+* FUNCTION: zm_remoteFree
+*
+* DESCRIPTION: 
+*     Free a block without waiting for the heap lock.
+* INPUTS:
+*     heap : The heap owning the block.
+*     ptr : The block to free.
+* RETURNS:
+*     null
+* NOTE:
+*     When the lock is busy the block is queued for the lock holder.
+*****************************************************************/
+static void zm_remoteFree(zm_heap_t *heap, void *ptr)
+{
+    if(ZM_MEM_TRYLOCK(heap))
+    {
+        zm_mem_free(heap, ptr);
+        zm_remoteDrain(heap);
+        ZM_MEM_UNLOCK(heap);
+    }
+    else
+    {
+        zm_remotePush(heap, ptr);
+    }
+}
+
+#if ZM_MEM_USE_MMAP
+/*****************************************************************
+* FUNCTION: zm_arenaInitMmap
+*
+* DESCRIPTION: 
+*     Create ZM_MEM_ARENA_NUM growable locked heaps.
+* INPUTS:
+*     reserve : The virtual range shared by all arenas.
+* RETURNS:
+*     null
+* NOTE:
+*     Every arena reserves its own part and grows on its own.
+*****************************************************************/
+static void zm_arenaInitMmap(zm_uintptr_t reserve)
+{
+    zm_uint32_t i;
+    
+    zmMemArenaNum = 0;
+    
+    for(i = 0; i < ZM_MEM_ARENA_NUM; i++)
+    {
+        zm_heap_t *arena = zm_mem_mmapInit(reserve / ZM_MEM_ARENA_NUM);
+        
+        if(arena)
+        {
+            pthread_mutex_init(&arena->lock, NULL);
+            zmMemArena[zmMemArenaNum++] = arena;
+        }
+    }
+    
+    zmMemDefault = zmMemArenaNum ? zmMemArena[0] : NULL;
+}
+#else
+/*****************************************************************
+* FUNCTION: zm_arenaInit
+*
+* DESCRIPTION: 
+*     Split the default memory in ZM_MEM_ARENA_NUM locked heaps.
+* INPUTS:
+*     beginAddr : The beginning address of system heap memory.
+*     endAddr   : The end address of system heap memory.
+* RETURNS:
+*     null
+* NOTE:
+*     null
+*****************************************************************/
+static void zm_arenaInit(void *beginAddr, void *endAddr)
+{
+    zm_uint8_t *begin = (zm_uint8_t *)beginAddr;
+    zm_uintptr_t span = (zm_uintptr_t)((zm_uint8_t *)endAddr - begin) / ZM_MEM_ARENA_NUM;
+    zm_uint32_t i;
+    
+    zmMemArenaNum = 0;
+    
+    for(i = 0; i < ZM_MEM_ARENA_NUM; i++)
+    {
+        zm_heap_t *arena = zm_mem_init(begin + i * span, begin + (i + 1) * span);
+        
+        if(arena)
+        {
+            pthread_mutex_init(&arena->lock, NULL);
+            zmMemArena[zmMemArenaNum++] = arena;
+        }
+    }
+    
+    zmMemDefault = zmMemArenaNum ? zmMemArena[0] : NULL;
+}
+#endif
+
+static zm_heap_t *zm_arenaOf(void *ptr)
+{
+    zm_uint32_t i;
+    
+    for(i = 0; i < zmMemArenaNum; i++)
+    {
+        if((zm_uint8_t *)ptr >= zmMemArena[i]->memHeap &&
+           (zm_uint8_t *)ptr < (zm_uint8_t *)zmMemArena[i]->memEnd)
+        {
+            return zmMemArena[i];
+        }
+    }
+    return NULL;
+}
+
+/*****************************************************************
+* FUNCTION: zm_tcacheFlush
+*
+* DESCRIPTION: 
+*     Give cached blocks of one class back to their arenas.
+* INPUTS:
+*     cache : The thread cache.
+*     cls : The size class.
+*     num : The number of blocks to release.
+* RETURNS:
+*     null
+* NOTE:
+*     A lock is held while consecutive blocks belong to the same arena.
+*     An arena whose lock is busy gets its blocks on its remote free
+*     list instead, the flush never waits.
+*****************************************************************/
+static void zm_tcacheFlush(zmTCache_t *cache, zm_uint32_t cls, zm_uint32_t num)
+{
+    zm_heap_t *locked = NULL;
+    zm_heap_t *busy = NULL;
+    
+    while(num-- && cache->list[cls])
+    {
+        void *ptr = cache->list[cls];
+        zm_heap_t *arena = zm_arenaOf(ptr);
+        
+        cache->list[cls] = ZM_MEM_TCACHE_NEXT(ptr);
+        cache->count[cls]--;
+        
+        if(arena != locked && arena != busy)
+        {
+            if(locked)
+            {
+                zm_remoteDrain(locked);
+                ZM_MEM_UNLOCK(locked);
+                locked = NULL;
+            }
+            busy = NULL;
+            
+            if(ZM_MEM_TRYLOCK(arena))
+            {
+                locked = arena;
+            }
+            else
+            {
+                busy = arena;
+            }
+        }
+        
+        if(arena == locked)
+        {
+            zm_mem_free(arena, ptr);
+        }
+        else
+        {
+            zm_remotePush(arena, ptr);
+        }
+    }
+    
+    if(locked)
+    {
+        zm_remoteDrain(locked);
+        ZM_MEM_UNLOCK(locked);
+    }
+}
+
+static void zm_tcacheDestroy(void *arg)
+{
+    zmTCache_t *cache = (zmTCache_t *)arg;
+    zm_uint32_t cls;
+    
+    for(cls = 0; cls < ZM_MEM_TCACHE_CLASSES; cls++)
+    {
+        zm_tcacheFlush(cache, cls, cache->count[cls]);
+    }
+    cache->arena = 0;
+}
+
+static void zm_tcacheKeyInit(void)
+{
+    pthread_key_create(&zmTCacheKey, zm_tcacheDestroy);
+}
+
+static zmTCache_t *zm_tcacheGet(void)
+{
+    zmTCache_t *cache = &zmTCache;
+    
+    if(cache->arena == 0)
+    {
+        cache->arena = __atomic_fetch_add(&zmMemArenaNext, 1, __ATOMIC_RELAXED) % zmMemArenaNum + 1;
+        
+        // the key destructor flushes the cache when the thread exits.
+        pthread_once(&zmTCacheOnce, zm_tcacheKeyInit);
+        pthread_setspecific(zmTCacheKey, cache);
+    }
+    return cache;
+}
+
+/*****************************************************************
+* FUNCTION: zm_tcacheMalloc
+*
+* DESCRIPTION: 
+*     zm_malloc in multi-thread mode.
+* INPUTS:
+*     size : The number of bytes to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     A cache miss takes the arena lock once for ZM_MEM_TCACHE_BATCH
+*     blocks, carved side by side by zm_mem_mallocBatch. Large sizes, or an exhausted arena, go to the arenas in
+*     turn under their locks.
+*****************************************************************/
+static void *zm_tcacheMalloc(zm_size_t size)
+{
+    zmTCache_t *cache;
+    zm_uint32_t i;
+    void *ptr;
+    
+    if(size == 0 || zmMemArenaNum == 0) return NULL;
+    
+    cache = zm_tcacheGet();
+    
+    if(size <= ZM_MEM_TCACHE_MAX)
+    {
+        zm_uint32_t cls = (zm_uint32_t)((size - 1) / ZM_MEM_TCACHE_STEP);
+        
+        if(cache->list[cls] == NULL)
+        {
+            zm_heap_t *arena = zmMemArena[cache->arena - 1];
+            void *batch[ZM_MEM_TCACHE_BATCH];
+            zm_size_t got;
+            
+            ZM_MEM_LOCK(arena);
+            zm_remoteDrain(arena);
+            got = zm_mem_mallocBatch(arena, (cls + 1) * ZM_MEM_TCACHE_STEP, ZM_MEM_TCACHE_BATCH, batch);
+            ZM_MEM_UNLOCK(arena);
+            
+            // last block first, the cache hands them out in address order.
+            while(got--)
+            {
+                ZM_MEM_TCACHE_NEXT(batch[got]) = cache->list[cls];
+                cache->list[cls] = batch[got];
+                cache->count[cls]++;
+            }
+        }
+        
+        ptr = cache->list[cls];
+        if(ptr)
+        {
+            cache->list[cls] = ZM_MEM_TCACHE_NEXT(ptr);
+            cache->count[cls]--;
+            return ptr;
+        }
+    }
+    
+    for(i = 0; i < zmMemArenaNum; i++)
+    {
+        zm_heap_t *arena = zmMemArena[(cache->arena - 1 + i) % zmMemArenaNum];
+        
+        ZM_MEM_LOCK(arena);
+        zm_remoteDrain(arena);
+        ptr = zm_mem_malloc(arena, size);
+        ZM_MEM_UNLOCK(arena);
+        
+        if(ptr) return ptr;
+    }
+    return NULL;
+}
+
+/*****************************************************************
+* FUNCTION: zm_tcacheFree
+*
+* DESCRIPTION: 
+*     zm_free in multi-thread mode.
+* INPUTS:
+*     ptr : The first address assigned by zm_malloc().
+* RETURNS:
+*     null
+* NOTE:
+*     Blocks of a cached class are kept by the calling thread, whatever
+*     thread allocated them, ZM_MEM_TCACHE_BATCH go back to the arenas
+*     when the class holds more than ZM_MEM_TCACHE_COUNT.
+*****************************************************************/
+static void zm_tcacheFree(void *ptr)
+{
+    zmTCache_t *cache;
+    zm_heap_t *arena;
+    zm_size_t size;
+    zm_uint32_t cls;
+    
+    if(ptr == NULL) return;
+    
+    arena = zm_arenaOf(ptr);
+    if(arena == NULL)
+    {
+        //illegal memory
+        return;
+    }
+    
+    // a used block's size only changes through its owner, no lock needed.
+    size = ZM_MEM_BLOCK_SIZE(arena, ZM_MEM_IDX(arena, (zm_uint8_t *)ptr - MEM_STRUCT_SIZE));
+    cls = (zm_uint32_t)(size / ZM_MEM_TCACHE_STEP);
+    
+    if(cls == 0 || cls > ZM_MEM_TCACHE_CLASSES)
+    {
+        zm_remoteFree(arena, ptr);
+        return;
+    }
+    cls--;
+    
+    cache = zm_tcacheGet();
+    ZM_MEM_TCACHE_NEXT(ptr) = cache->list[cls];
+    cache->list[cls] = ptr;
+    
+    if(++cache->count[cls] > ZM_MEM_TCACHE_COUNT)
+    {
+        zm_tcacheFlush(cache, cls, ZM_MEM_TCACHE_BATCH);
+    }
+}
+
+/*****************************************************************
+* FUNCTION: zm_tcacheRealloc
+*
+* DESCRIPTION: 
+*     zm_realloc in multi-thread mode.
+* INPUTS:
+*     ptr : pointer to memory allocated by zm_malloc.
+*     newsize : The number of new size to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     The block is resized in its own arena, or moved to any arena.
+*****************************************************************/
+static void *zm_tcacheRealloc(void *ptr, zm_size_t newsize)
+{
+    zm_heap_t *arena;
+    zm_size_t size;
+    void *newMem;
+    
+    if(ptr == NULL) return zm_tcacheMalloc(newsize);
+    
+    if(newsize == 0)
+    {
+        zm_tcacheFree(ptr);
+        return NULL;
+    }
+    
+    arena = zm_arenaOf(ptr);
+    if(arena == NULL)
+    {
+        //illegal memory
+        return ptr;
+    }
+    size = ZM_MEM_BLOCK_SIZE(arena, ZM_MEM_IDX(arena, (zm_uint8_t *)ptr - MEM_STRUCT_SIZE));
+    
+    ZM_MEM_LOCK(arena);
+    zm_remoteDrain(arena);
+    newMem = zm_mem_realloc(arena, ptr, newsize);
+    ZM_MEM_UNLOCK(arena);
+    
+    if(newMem == NULL)
+    {
+        newMem = zm_tcacheMalloc(newsize);
+        if(newMem)
+        {
+            memcpy(newMem, ptr, size < newsize ? size : newsize);
+            zm_tcacheFree(ptr);
+        }
+    }
+    return newMem;
+}
+/*****************************************************************
+* FUNCTION: zm_tcacheMemalign
+*
+* DESCRIPTION: 
+*     Aligned allocation in thread cache mode.
+* INPUTS:
+*     alignment : Power of two.
+*     size : The number of bytes to allocate.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     Never served from the cache, the own arena is tried first.
+*****************************************************************/
+static void *zm_tcacheMemalign(zm_size_t alignment, zm_size_t size)
+{
+    zmTCache_t *cache;
+    zm_uint32_t i;
+    void *ptr;
+    
+    if(zmMemArenaNum == 0) return NULL;
+    
+    cache = zm_tcacheGet();
+    
+    for(i = 0; i < zmMemArenaNum; i++)
+    {
+        zm_heap_t *arena = zmMemArena[(cache->arena - 1 + i) % zmMemArenaNum];
+        
+        ZM_MEM_LOCK(arena);
+        zm_remoteDrain(arena);
+        ptr = zm_mem_memalign(arena, alignment, size);
+        ZM_MEM_UNLOCK(arena);
+        
+        if(ptr) return ptr;
+    }
+    return NULL;
+}
+/*****************************************************************
+* FUNCTION: zm_tcacheMallocBatch
+*
+* DESCRIPTION: 
+*     zm_mallocBatch in multi-thread mode.
+* INPUTS:
+*     size : The number of bytes of each block.
+*     n : The number of blocks.
+*     ptrs : Filled with the blocks.
+* RETURNS:
+*     The number of blocks allocated.
+* NOTE:
+*     Never served from the cache, the own arena is tried first.
+*****************************************************************/
+static zm_size_t zm_tcacheMallocBatch(zm_size_t size, zm_size_t n, void *ptrs[])
+{
+    zmTCache_t *cache;
+    zm_size_t got = 0;
+    zm_uint32_t i;
+    
+    if(zmMemArenaNum == 0) return 0;
+    
+    cache = zm_tcacheGet();
+    
+    for(i = 0; i < zmMemArenaNum && got < n; i++)
+    {
+        zm_heap_t *arena = zmMemArena[(cache->arena - 1 + i) % zmMemArenaNum];
+        
+        ZM_MEM_LOCK(arena);
+        zm_remoteDrain(arena);
+        got += zm_mem_mallocBatch(arena, size, n - got, &ptrs[got]);
+        ZM_MEM_UNLOCK(arena);
+    }
+    return got;
+}
+/*****************************************************************
+* FUNCTION: zm_tcacheFreeBatch
+*
+* DESCRIPTION: 
+*     zm_freeBatch in multi-thread mode.
+* INPUTS:
+*     ptrs : The blocks, NULL entries are skipped.
+*     n : The number of blocks.
+* RETURNS:
+*     null
+* NOTE:
+*     Arenas are address ranges, once sorted the blocks of an arena are
+*     side by side and take its lock once. The cache is bypassed.
+*****************************************************************/
+static void zm_tcacheFreeBatch(void *ptrs[], zm_size_t n)
+{
+    zm_size_t i = 0;
+    
+    zm_ptrSort(ptrs, n);
+    
+    while(i < n)
+    {
+        zm_heap_t *arena = zm_arenaOf(ptrs[i]);
+        zm_size_t j = i + 1;
+        
+        if(arena == NULL)
+        {
+            //illegal memory
+            i++;
+            continue;
+        }
+        
+        while(j < n && (zm_uint8_t *)ptrs[j] < (zm_uint8_t *)arena->memEnd)
+        {
+            j++;
+        }
+        
+        ZM_MEM_LOCK(arena);
+        zm_remoteDrain(arena);
+        zm_mem_freeSorted(arena, &ptrs[i], j - i);
+        ZM_MEM_UNLOCK(arena);
+        
+        i = j;
+    }
+}
+#endif
+
+/* value in base 10 or 16, at least width digits, returns the length */
+static zm_uint32_t zm_dumpNum(char *buf, zm_uintptr_t value, zm_uint32_t base, zm_uint32_t width)
+{
+    char digit[24];
+    zm_uint32_t n = 0;
+    zm_uint32_t len = 0;
+    
+    do
+    {
+        digit[n++] = "0123456789abcdef"[value % base];
+        value /= base;
+    }while(value || n < width);
+    
+    while(n)
+    {
+        buf[len++] = digit[--n];
+    }
+    return len;
+}
+
+/* close the current map character, a full line goes out */
+static void zm_dumpCell(zmMemDump_t *dump)
+{
+    if(dump->cells == 0)
+    {
+        dump->len = zm_dumpNum(dump->line, dump->offset, 16, 8);
+        dump->line[dump->len++] = ' ';
+    }
+    
+    dump->line[dump->len++] = dump->used == 0 ? '.' : dump->used == dump->fill ? '#' : '+';
+    dump->offset += dump->fill;
+    dump->fill = 0;
+    dump->used = 0;
+    
+    if(++dump->cells == 64)
+    {
+        dump->line[dump->len++] = '\n';
+        dump->write(dump->ctx, dump->line, dump->len);
+        dump->cells = 0;
+    }
+}
+
+/* len bytes, used or free, into the map */
+static void zm_dumpSpan(zmMemDump_t *dump, zm_size_t len, zm_uint32_t used)
+{
+    while(len)
+    {
+        zm_size_t take = dump->unit - dump->fill;
+        
+        if(take > len) take = len;
+        
+        dump->fill += take;
+        if(used) dump->used += take;
+        len -= take;
+        
+        if(dump->fill == dump->unit) zm_dumpCell(dump);
+    }
+}
+
+/* zm_heapWalk callback of zm_heapDump */
+static zm_int32_t zm_dumpBlock(void *ctx, const zm_memBlock_t *block)
+{
+    zmMemDump_t *dump = (zmMemDump_t *)ctx;
+    zm_uint32_t len;
+    
+    if(dump->format == ZM_MEM_DUMP_CSV)
+    {
+        len = zm_dumpNum(dump->line, block->offset, 10, 1);
+        dump->line[len++] = ',';
+        len += zm_dumpNum(&dump->line[len], block->size, 10, 1);
+        dump->line[len++] = ',';
+        dump->line[len++] = block->used ? '1' : '0';
+        dump->line[len++] = '\n';
+        dump->write(dump->ctx, dump->line, len);
+    }
+    else
+    {
+        zm_dumpSpan(dump, MEM_STRUCT_SIZE, 1);
+        zm_dumpSpan(dump, block->size, block->used);
+    }
+    
+    return 0;
+}
+
+/*****************************************************************
+* FUNCTION: zm_getMemStatsEx
+*
+* DESCRIPTION: 
+*       Get zm memory management extended statistics.
+* INPUTS:
+*     stats : Filled with the statistics of the default heap.
+* RETURNS:
+*     null
+* NOTE:
+*     If no set ZM_MEM_STATS to 1, only totalSize is set.
+*     Kept up to date by malloc, free and merge, cheap to poll. A moving
+*     realloc also counts one malloc and one free.
+*     With ZM_MEM_THREAD_CACHE, arenas are summed, largestFree is the
+*     largest of all arenas.
+*****************************************************************/
+void zm_getMemStatsEx(zm_memStatsEx_t *stats)
+{
+#if ZM_MEM_THREAD_CACHE
+    zm_memStatsEx_t arena;
+    zm_uint32_t i, n;
+    
+    memset(stats, 0, sizeof(zm_memStatsEx_t));
+    
+    for(i = 0; i < zmMemArenaNum; i++)
+    {
+        zm_heapGetStatsEx(zmMemArena[i], &arena);
+        
+        stats->totalSize += arena.totalSize;
+        stats->usedSize += arena.usedSize;
+        stats->maxSize += arena.maxSize;
+        stats->freeBlocks += arena.freeBlocks;
+        stats->mallocCount += arena.mallocCount;
+        stats->freeCount += arena.freeCount;
+        stats->reallocCount += arena.reallocCount;
+        stats->purgedSize += arena.purgedSize;
+        stats->fastSize += arena.fastSize;
+        if(i == 0 || arena.hugeMode < stats->hugeMode)
+        {
+            stats->hugeMode = arena.hugeMode;
+        }
+        for(n = 0; n < ZM_MEM_HIST_NUM; n++)
+        {
+            stats->freeHist[n] += arena.freeHist[n];
+        }
+        if(arena.largestFree > stats->largestFree)
+        {
+            stats->largestFree = arena.largestFree;
+        }
+    }
+#else
+    zm_heapGetStatsEx(zmMemDefault, stats);
+#endif
+}
+/*****************************************************************
+* FUNCTION: zm_memWalk
+*
+* DESCRIPTION: 
+*     zm_heapWalk on the memory behind zm_malloc.
+* INPUTS:
+*     walk : Called for each block.
+*     ctx : Passed to walk.
+* RETURNS:
+*     0 : every block was visited.
+*     The value walk stopped with.
+* NOTE:
+*     null
+*****************************************************************/
+zm_int32_t zm_memWalk(zm_memWalk_t walk, void *ctx)
+{
+#if ZM_MEM_THREAD_CACHE
+    zm_int32_t ret = 0;
+    zm_uint32_t i;
+    
+    for(i = 0; i < zmMemArenaNum && ret == 0; i++)
+    {
+        ret = zm_heapWalk(zmMemArena[i], walk, ctx);
+    }
+    return ret;
+#else
+    return zm_heapWalk(zmMemDefault, walk, ctx);
+#endif
+}
+/*****************************************************************
+* FUNCTION: zm_memCheck
+*
+* DESCRIPTION: 
+*     zm_heapCheck on the memory behind zm_malloc.
+* INPUTS:
+*     null
+* RETURNS:
+*     0 : consistent.
+*     See zm_heapCheck.
+* NOTE:
+*     null
+*****************************************************************/
+zm_int32_t zm_memCheck(void)
+{
+#if ZM_MEM_THREAD_CACHE
+    zm_int32_t ret = 0;
+    zm_uint32_t i;
+    
+    for(i = 0; i < zmMemArenaNum && ret == 0; i++)
+    {
+        ret = zm_heapCheck(zmMemArena[i]);
+    }
+    return ret;
+#else
+    return zm_heapCheck(zmMemDefault);
+#endif
+}
+/*****************************************************************
+* FUNCTION: zm_memDump
+*
+* DESCRIPTION: 
+*     zm_heapDump on the memory behind zm_malloc.
+* INPUTS:
+*     format : ZM_MEM_DUMP_MAP or ZM_MEM_DUMP_CSV.
+*     unit : Bytes per map character, 0 to fit a heap in 32 lines.
+*     write : Called with each piece of text.
+*     ctx : Passed to write.
+* RETURNS:
+*     null
+* NOTE:
+*     null
+*****************************************************************/
+void zm_memDump(zm_uint8_t format, zm_size_t unit, zm_memWrite_t write, void *ctx)
+{
+#if ZM_MEM_THREAD_CACHE
+    zm_uint32_t i;
+    
+    for(i = 0; i < zmMemArenaNum; i++)
+    {
+        zm_heapDump(zmMemArena[i], format, unit, write, ctx);
+    }
+#else
+    zm_heapDump(zmMemDefault, format, unit, write, ctx);
+#endif
+}
+#if ZM_MEM_LATENCY
+/*****************************************************************
+* FUNCTION: zm_getMemLatency
+*
+* DESCRIPTION: 
+*     Take a snapshot of the latency and work histograms.
+* INPUTS:
+*     lat : Filled with the histograms.
+*     reset : 1 to clear them as they are read.
+* RETURNS:
+*     null
+* NOTE:
+*     null
+*****************************************************************/
+void zm_getMemLatency(zm_memLatency_t *lat, zm_uint8_t reset)
+{
+    zm_uint32_t hist, bucket;
+    unsigned long long ns;
+    
+    for(hist = 0; hist < ZM_LAT_NUM; hist++)
+    {
+        for(bucket = 0; bucket < ZM_LAT_BUCKETS; bucket++)
+        {
+#if ZM_MEM_THREAD_CACHE
+            if(reset)
+            {
+                lat->count[hist][bucket] = __atomic_exchange_n(&zmMemLat[hist][bucket], 0, __ATOMIC_RELAXED);
+            }
+            else
+            {
+                lat->count[hist][bucket] = __atomic_load_n(&zmMemLat[hist][bucket], __ATOMIC_RELAXED);
+            }
+#else
+            lat->count[hist][bucket] = zmMemLat[hist][bucket];
+            if(reset) zmMemLat[hist][bucket] = 0;
+#endif
+        }
+    }
+    
+    // rate over the whole run, clocks that are not counters give nonsense below 1 ms.
+    // ticks per ms first, the tick count times 1000 overflows after a long uptime.
+    ns = zm_latNs() - zmMemLatNs;
+    if(zmMemLatNs && ns >= 1000000u)
+    {
+        lat->clockHz = (zm_latClock() - zmMemLatTick) / (ns / 1000000u) * 1000u;
+    }
+    else
+    {
+        lat->clockHz = 0;
+    }
+}
+/*****************************************************************
+* FUNCTION: zm_latencyQuantile
+*
+* DESCRIPTION: 
+*     Value under which a share of the calls of a histogram fall.
+* INPUTS:
+*     lat : Snapshot of zm_getMemLatency.
+*     hist : ZM_LAT_xxx.
+*     q : Share in 1/10000.
+* RETURNS:
+*     Upper bound of the bucket holding the quantile, 0 if empty.
+* NOTE:
+*     null
+*****************************************************************/
+zm_uint32_t zm_latencyQuantile(const zm_memLatency_t *lat, zm_uint32_t hist, zm_uint32_t q)
+{
+    unsigned long long total = 0, target, sum = 0;
+    zm_uint32_t bucket;
+    
+    if(hist >= ZM_LAT_NUM) return 0;
+    if(q > 10000u) q = 10000u;
+    
+    for(bucket = 0; bucket < ZM_LAT_BUCKETS; bucket++)
+    {
+        total += lat->count[hist][bucket];
+    }
+    if(total == 0) return 0;
+    
+    target = (total * q + 9999u) / 10000u;
+    if(target == 0) target = 1;
+    
+    for(bucket = 0; bucket < ZM_LAT_BUCKETS - 1; bucket++)
+    {
+        sum += lat->count[hist][bucket];
+        if(sum >= target) return zm_latencyBucket(bucket + 1) - 1;
+    }
+    return 0xFFFFFFFFu;
+}
+/*****************************************************************
+* FUNCTION: zm_latencyBucket
+*
+* DESCRIPTION: 
+*     Lowest value of a histogram bucket.
+* INPUTS:
+*     bucket : 0 to ZM_LAT_BUCKETS - 1.
+* RETURNS:
+*     The value.
+* NOTE:
+*     null
+*****************************************************************/
+zm_uint32_t zm_latencyBucket(zm_uint32_t bucket)
+{
+    if(bucket < (1u << ZM_LAT_SUB_BITS)) return bucket;
+    
+    return ((1u << ZM_LAT_SUB_BITS) + (bucket & ((1u << ZM_LAT_SUB_BITS) - 1))) << ((bucket >> ZM_LAT_SUB_BITS) - 1);
+}
+/*****************************************************************
+* FUNCTION: zm_latencyClock
+*
+* DESCRIPTION: 
+*     Tick source of the latency histograms without a cycle counter.
+* INPUTS:
+*     null
+* RETURNS:
+*     Ticks.
+* NOTE:
+*     It's weak functions, you can redefine it.
+*****************************************************************/
+__ZM_WEAK unsigned long long zm_latencyClock(void)
+{
+    return zm_latNs();
+}
+#endif
+/*****************************************************************
+* FUNCTION: zm_heapInit
+*
+* DESCRIPTION: 
+*     Create an independent heap over a memory range.
+* INPUTS:
+*     beginAddr : The beginning address of the heap memory.
+*     endAddr   : The end address of the heap memory.
+* RETURNS:
+*     The heap handle.
+*     NULL : faild, the memory is too small.
+* NOTE:
+*     The heap control block takes the beginning of the range.
+*****************************************************************/
+zm_heap_t *zm_heapInit(void *beginAddr, void *endAddr)
+{
+    zm_heap_t *heap = zm_mem_init(beginAddr, endAddr);
+    
+#if ZM_MEM_THREAD_CACHE
+    if(heap) pthread_mutex_init(&heap->lock, NULL);
+#endif
+    
+    return heap;
+}
+/*****************************************************************
+* FUNCTION: zm_heapReset
+*
+* DESCRIPTION: 
+*     Release every block of a heap at once.
+* INPUTS:
+*     heap : The heap handle.
+* RETURNS:
+*     null
+* NOTE:
+*     All pointers allocated from the heap become invalid.
+*****************************************************************/
+void zm_heapReset(zm_heap_t *heap)
+{
+    if(heap == NULL) return;
+    
+    ZM_MEM_LOCK(heap);
+#if ZM_MEM_USE_MMAP
+    {
+        zm_uint8_t *reserveEnd = heap->reserveEnd;
+        zm_uint32_t hugeMode = heap->hugeMode;
+        
+        zm_mem_init(heap->beginAddr, heap->endAddr);
+        heap->reserveEnd = reserveEnd;
+        heap->hugeMode = hugeMode;
+    }
+#else
+    zm_mem_init(heap->beginAddr, heap->endAddr);
+#endif
+    ZM_MEM_UNLOCK(heap);
+}
+/*****************************************************************
+* FUNCTION: zm_heapMalloc
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation from a given heap.
+* INPUTS:
+*     heap : The heap handle.
+*     size : The number of bytes to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     null
+*****************************************************************/
+void *zm_heapMalloc(zm_heap_t *heap, zm_size_t size)
+{
+    void *ptr;
+    
+    if(heap == NULL) return NULL;
+    
+    ZM_MEM_LOCK(heap);
+#if ZM_MEM_THREAD_CACHE
+    zm_remoteDrain(heap);
+#endif
+    ptr = zm_mem_malloc(heap, size);
+    ZM_MEM_UNLOCK(heap);
+    
+    return ptr;
+}
+/*****************************************************************
+* FUNCTION: zm_heapRealloc
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation from a given heap.
+*     This function will change the previously allocated memory block.
+* INPUTS:
+*     heap : The heap handle.
+*     ptr : pointer to memory allocated by zm_heapMalloc.
+*     newsize : The number of new size to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     null
+*****************************************************************/
+void *zm_heapRealloc(zm_heap_t *heap, void *ptr, zm_size_t newsize)
+{
+    if(heap == NULL) return NULL;
+    
+    ZM_MEM_LOCK(heap);
+#if ZM_MEM_THREAD_CACHE
+    zm_remoteDrain(heap);
+#endif
+    ptr = zm_mem_realloc(heap, ptr, newsize);
+    ZM_MEM_UNLOCK(heap);
+    
+    return ptr;
+}
+/*****************************************************************
+* FUNCTION: zm_heapCalloc
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation from a given heap, zero filled.
+* INPUTS:
+*     heap : The heap handle.
+*     count : Number of objects to allocate.
+*     size : The number of size to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     null
+*****************************************************************/
+void *zm_heapCalloc(zm_heap_t *heap, zm_size_t count, zm_size_t size)
+{
+    void *ptr;
+    
+    if(heap == NULL) return NULL;
+    
+    ZM_MEM_LOCK(heap);
+#if ZM_MEM_THREAD_CACHE
+    zm_remoteDrain(heap);
+#endif
+    ptr = zm_mem_calloc(heap, count, size);
+    ZM_MEM_UNLOCK(heap);
+    
+    return ptr;
+}
+/*****************************************************************
+* FUNCTION: zm_heapMemalign
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation from a given heap with a given alignment.
+* INPUTS:
+*     heap : The heap handle.
+*     alignment : Power of two.
+*     size : The number of bytes to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory or alignment is not a power of two.
+* NOTE:
+*     null
+*****************************************************************/
+void *zm_heapMemalign(zm_heap_t *heap, zm_size_t alignment, zm_size_t size)
+{
+    void *ptr;
+    
+    if(heap == NULL) return NULL;
+    
+    ZM_MEM_LOCK(heap);
+#if ZM_MEM_THREAD_CACHE
+    zm_remoteDrain(heap);
+#endif
+    ptr = zm_mem_memalign(heap, alignment, size);
+    ZM_MEM_UNLOCK(heap);
+    
+    return ptr;
+}
+/*****************************************************************
+* FUNCTION: zm_heapFree
+*
+* DESCRIPTION: 
+*       zm dynamic memory de-allocation to a given heap.
+* INPUTS:
+*     heap : The heap handle.
+*     ptr : The first address assigned by zm_heapMalloc().
+* RETURNS:
+*     null
+* NOTE:
+*     null
+*****************************************************************/
+void zm_heapFree(zm_heap_t *heap, void *ptr)
+{
+    if(heap == NULL) return;
+    
+#if ZM_MEM_THREAD_CACHE
+    if((zm_uint8_t *)ptr < heap->memHeap || (zm_uint8_t *)ptr >= (zm_uint8_t *)heap->memEnd)
+    {
+        //illegal memory
+        return;
+    }
+    zm_remoteFree(heap, ptr);
+#else
+    zm_mem_free(heap, ptr);
+#endif
+}
+/*****************************************************************
+* FUNCTION: zm_heapFreeSized
+*
+* DESCRIPTION: 
+*       zm_heapFree with the size the block was allocated with.
+* INPUTS:
+*     heap : The heap handle.
+*     ptr : The first address assigned by zm_heapMalloc().
+*     size : The size asked for when ptr was allocated.
+* RETURNS:
+*     null
+* NOTE:
+*     See zm_freeSized.
+*****************************************************************/
+void zm_heapFreeSized(zm_heap_t *heap, void *ptr, zm_size_t size)
+{
+    if(heap == NULL || ptr == NULL) return;
+    
+#if ZM_MEM_CHECK
+    if(!zm_sizeValid(heap, ptr, size))
+    {
+        //illegal memory
+        return;
+    }
+#else
+    (void)size;
+#endif
+    
+    zm_heapFree(heap, ptr);
+}
+/*****************************************************************
+* FUNCTION: zm_heapMallocBatch
+*
+* DESCRIPTION: 
+*     Allocate n blocks of one size from a given heap.
+* INPUTS:
+*     heap : The heap handle.
+*     size : The number of bytes of each block.
+*     n : The number of blocks.
+*     ptrs : Filled with the blocks.
+* RETURNS:
+*     The number of blocks allocated, less than n if out of memory.
+* NOTE:
+*     null
+*****************************************************************/
+zm_size_t zm_heapMallocBatch(zm_heap_t *heap, zm_size_t size, zm_size_t n, void *ptrs[])
+{
+    zm_size_t got;
+    
+    if(heap == NULL) return 0;
+    
+    ZM_MEM_LOCK(heap);
+#if ZM_MEM_THREAD_CACHE
+    zm_remoteDrain(heap);
+#endif
+    got = zm_mem_mallocBatch(heap, size, n, ptrs);
+    ZM_MEM_UNLOCK(heap);
+    
+    return got;
+}
+/*****************************************************************
+* FUNCTION: zm_heapFreeBatch
+*
+* DESCRIPTION: 
+*       Free n blocks to a given heap.
+* INPUTS:
+*     heap : The heap handle.
+*     ptrs : The blocks, NULL entries are skipped.
+*     n : The number of blocks.
+* RETURNS:
+*     null
+* NOTE:
+*     ptrs is sorted by address in place.
+*****************************************************************/
+void zm_heapFreeBatch(zm_heap_t *heap, void *ptrs[], zm_size_t n)
+{
+    if(heap == NULL) return;
+    
+    ZM_MEM_LOCK(heap);
+#if ZM_MEM_THREAD_CACHE
+    zm_remoteDrain(heap);
+#endif
+    zm_mem_freeBatch(heap, ptrs, n);
+    ZM_MEM_UNLOCK(heap);
+}
+/*****************************************************************
+* FUNCTION: zm_heapGetTotal
+*
+* DESCRIPTION: 
+*       Get heap total size.
+* INPUTS:
+*     heap : The heap handle.
+* RETURNS:
+*     heap total size.
+* NOTE:
+*     null
+*****************************************************************/
+zm_size_t zm_heapGetTotal(zm_heap_t *heap)
+{
+    if(heap == NULL) return 0;
+    
+    return heap->memSize;
+}
+/*****************************************************************
+* FUNCTION: zm_heapGetUsed
+*
+* DESCRIPTION: 
+*       Get heap used size.
+* INPUTS:
+*     heap : The heap handle.
+* RETURNS:
+*     heap used size.
+* NOTE:
+*     If no set ZM_MEM_STATS to 1, It always returns 0.
+*****************************************************************/
+zm_size_t zm_heapGetUsed(zm_heap_t *heap)
+{
+#if ZM_MEM_STATS
+    if(heap == NULL) return 0;
+    
+    return heap->memStats.usedSize;
+#else
+    (void)heap;
+    return 0;
+#endif
+}
+/*****************************************************************
+* FUNCTION: zm_heapGetMaxUsed
+*
+* DESCRIPTION: 
+*       Get heap max used size.
+* INPUTS:
+*     heap : The heap handle.
+* RETURNS:
+*     heap max used size.
+* NOTE:
+*     If no set ZM_MEM_STATS to 1, It always returns 0.
+*****************************************************************/
+zm_size_t zm_heapGetMaxUsed(zm_heap_t *heap)
+{
+#if ZM_MEM_STATS
+    if(heap == NULL) return 0;
+    
+    return heap->memStats.maxSize;
+#else
+    (void)heap;
+    return 0;
+#endif
+}
+/*****************************************************************
+* FUNCTION: zm_heapGetStatsEx
+*
+* DESCRIPTION: 
+*       Get heap extended statistics.
+* INPUTS:
+*     heap : The heap handle.
+*     stats : Filled with the statistics.
+* RETURNS:
+*     null
+* NOTE:
+*     See zm_getMemStatsEx.
+*****************************************************************/
+void zm_heapGetStatsEx(zm_heap_t *heap, zm_memStatsEx_t *stats)
+{
+    memset(stats, 0, sizeof(zm_memStatsEx_t));
+    
+    if(heap == NULL) return;
+    
+    stats->totalSize = heap->memSize;
+#if ZM_MEM_USE_MMAP
+    stats->hugeMode = heap->hugeMode;
+#endif
+    
+#if ZM_MEM_STATS
+    ZM_MEM_LOCK(heap);
+    if(heap->memStats.largestDirty)
+    {
+        heap->memStats.largestFree = zm_binLargest(heap);
+#if ZM_MEM_BEST_FIT
+        // any tree block is larger than the list ones, the last one is the largest.
+        if(heap->treeRoot != ZM_MEM_FREE_NIL)
+        {
+            zm_size_t node = heap->treeRoot;
+            
+            while(ZM_MEM_TREE_NODE(heap, node)->right != ZM_MEM_FREE_NIL)
+            {
+                node = ZM_MEM_TREE_NODE(heap, node)->right;
+            }
+            heap->memStats.largestFree = ZM_MEM_TREE_NODE(heap, node)->size;
+        }
+#endif
+        heap->memStats.largestDirty = 0;
+    }
+    
+    stats->usedSize = heap->memStats.usedSize;
+    stats->maxSize = heap->memStats.maxSize;
+    stats->largestFree = heap->memStats.largestFree;
+    stats->freeBlocks = heap->memStats.freeBlocks;
+    memcpy(stats->freeHist, heap->memStats.freeHist, sizeof(stats->freeHist));
+    stats->mallocCount = heap->memStats.mallocCount;
+    stats->freeCount = heap->memStats.freeCount;
+    stats->reallocCount = heap->memStats.reallocCount;
+#if ZM_MEM_FAST_MAX
+    stats->fastSize = heap->fastSize;
+#endif
+    ZM_MEM_UNLOCK(heap);
+#endif
+#if ZM_MEM_PURGE
+    ZM_MEM_LOCK(heap);
+    {
+        zm_uint32_t i;
+        
+        for(i = 0; i < heap->purgedNum; i++)
+        {
+            stats->purgedSize += heap->purged[i].end - heap->purged[i].begin;
+        }
+    }
+    ZM_MEM_UNLOCK(heap);
+#endif
+}
+/*****************************************************************
+* FUNCTION: zm_heapWalk
+*
+* DESCRIPTION: 
+*     Visit every block of a heap in address order.
+* INPUTS:
+*     heap : The heap handle.
+*     walk : Called for each block.
+*     ctx : Passed to walk.
+* RETURNS:
+*     0 : every block was visited.
+*     The value walk stopped with.
+* NOTE:
+*     The heap is locked during the walk.
+*****************************************************************/
+zm_int32_t zm_heapWalk(zm_heap_t *heap, zm_memWalk_t walk, void *ctx)
+{
+    zm_memBlock_t block;
+    zm_size_t idx = 0;
+    zm_size_t end;
+    zm_int32_t ret = 0;
+    
+    if(heap == NULL) return 0;
+    
+    ZM_MEM_LOCK(heap);
+#if ZM_MEM_THREAD_CACHE
+    zm_remoteDrain(heap);
+#endif
+    end = ZM_MEM_IDX(heap, heap->memEnd);
+    
+    while(idx < end && ret == 0)
+    {
+        zm_size_t next = zm_blkNext(heap, idx);
+        
+        if(next <= idx || next > end)
+        {
+            // broken chain, see zm_heapCheck.
+            break;
+        }
+        
+        block.ptr = &heap->memHeap[idx + MEM_STRUCT_SIZE];
+        block.offset = idx;
+        block.size = next - idx - MEM_STRUCT_SIZE;
+        block.used = zm_blkUsed(heap, idx) ? 1 : 0;
+        
+        ret = walk(ctx, &block);
+        idx = next;
+    }
+    ZM_MEM_UNLOCK(heap);
+    
+    return ret;
+}
+/*****************************************************************
+* FUNCTION: zm_heapCheck
+*
+* DESCRIPTION: 
+*     Check the block chain and the free lists of a heap.
+* INPUTS:
+*     heap : The heap handle.
+* RETURNS:
+*     0 : consistent.
+*     -1 : the block chain is broken.
+*     -2 : the free lists do not match the free blocks of the chain.
+* NOTE:
+*     Each list is followed no further than the number of free blocks
+*     in the chain, a loop is caught as a mismatch. With
+*     ZM_MEM_BEST_FIT the tree order and balance are checked too,
+*     with ZM_MEM_FAST_MAX the fast bins, with ZM_MEM_ORDER_ADDRESS
+*     the list order.
+*****************************************************************/
+zm_int32_t zm_heapCheck(zm_heap_t *heap)
+{
+    zm_size_t idx = 0;
+    zm_size_t end;
+    zm_size_t bin;
+    zm_size_t freeNum = 0;
+    zm_size_t listNum = 0;
+    zm_uint32_t prevUsed = 1;
+    zm_int32_t ret = 0;
+    
+    if(heap == NULL) return 0;
+    
+    ZM_MEM_LOCK(heap);
+#if ZM_MEM_THREAD_CACHE
+    zm_remoteDrain(heap);
+#endif
+    end = ZM_MEM_IDX(heap, heap->memEnd);
+    
+    while(idx < end)
+    {
+        zm_size_t next = zm_blkNext(heap, idx);
+        zm_uint32_t used = zm_blkUsed(heap, idx) ? 1 : 0;
+        
+        if(next < idx + MEM_STRUCT_SIZE || next > end || (next % ZM_MEM_ALIGN_SIZE)) break;
+#if ZM_MEM_COMPACT
+        if(zm_blkPrevFree(heap, idx) == prevUsed) break;
+        if(!used && ZM_MEM_FOOT(heap, next) != next - idx) break;
+#else
+        if(ZM_MEM_PTR(heap, idx)->magic != ZM_HEAP_MAGIC || ZM_MEM_PTR(heap, next)->prev != idx) break;
+#endif
+        // free neighbours are always merged.
+        if(!used && !prevUsed) break;
+        
+        freeNum += !used;
+        prevUsed = used;
+        idx = next;
+    }
+    
+    if(idx != end || !zm_blkUsed(heap, end) || zm_blkNext(heap, end) != end)
+    {
+        ret = -1;
+    }
+#if ZM_MEM_COMPACT
+    else if(zm_blkPrevFree(heap, end) == prevUsed)
+    {
+        ret = -1;
+    }
+#endif
+    
+    for(bin = 0; bin < ZM_MEM_BIN_NUM && ret == 0; bin++)
+    {
+        zm_size_t prev = ZM_MEM_FREE_NIL;
+        zm_size_t node = heap->binHead[bin];
+        
+        while(node != ZM_MEM_FREE_NIL)
+        {
+            if(node >= end || (node % ZM_MEM_ALIGN_SIZE) || zm_blkUsed(heap, node) || ++listNum > freeNum ||
+               ZM_MEM_FREE_NODE(heap, node)->prevFree != prev || zm_binIndex(ZM_MEM_BLOCK_SIZE(heap, node)) != bin ||
+               (ZM_MEM_LIST_ORDER == ZM_MEM_ORDER_ADDRESS && prev != ZM_MEM_FREE_NIL && node < prev))
+            {
+                ret = -2;
+                break;
+            }
+            prev = node;
+            node = ZM_MEM_FREE_NODE(heap, node)->nextFree;
+        }
+    }
+#if ZM_MEM_BEST_FIT
+    if(ret == 0)
+    {
+        zm_size_t prev = ZM_MEM_FREE_NIL;
+        
+        if(zm_treeCheck(heap, heap->treeRoot, 0, end, &prev, &listNum) < 0) ret = -2;
+    }
+#endif
+#if ZM_MEM_FAST_MAX
+    if(ret == 0)
+    {
+        zm_size_t fastSize = 0;
+        
+        // fast blocks are used ones of their bin size, their sum bounds a loop.
+        for(bin = 0; bin < ZM_MEM_FAST_BINS && ret == 0; bin++)
+        {
+            zm_size_t node;
+            
+            for(node = heap->fastHead[bin]; node != ZM_MEM_FREE_NIL; node = ZM_MEM_FREE_NODE(heap, node)->nextFree)
+            {
+                if(node >= end || (node % ZM_MEM_ALIGN_SIZE) || !zm_blkUsed(heap, node) ||
+                   ZM_MEM_BLOCK_SIZE(heap, node) / ZM_MEM_ALIGN_SIZE != bin ||
+                   (fastSize += zm_blkNext(heap, node) - node) > heap->fastSize)
                 {
-                    memStats.maxSize = memStats.usedSize;
+                    ret = -2;
+                    break;
                 }
+            }
+        }
+        if(ret == 0 && fastSize != heap->fastSize) ret = -2;
+    }
+#endif
+    if(ret == 0 && listNum != freeNum) ret = -2;
+    
+    ZM_MEM_UNLOCK(heap);
+    
+    return ret;
+}
+/*****************************************************************
+* FUNCTION: zm_heapDump
+*
+* DESCRIPTION: 
+*     Write the block layout of a heap, built on zm_heapWalk.
+* INPUTS:
+*     heap : The heap handle.
+*     format : ZM_MEM_DUMP_MAP or ZM_MEM_DUMP_CSV.
+*     unit : Bytes per map character, 0 to fit the heap in 32 lines.
+*     write : Called with each piece of text.
+*     ctx : Passed to write.
+* RETURNS:
+*     null
+* NOTE:
+*     The map starts with a "heap <address> size <bytes> unit <bytes>"
+*     line, each line after it with the offset of its first character.
+*****************************************************************/
+void zm_heapDump(zm_heap_t *heap, zm_uint8_t format, zm_size_t unit, zm_memWrite_t write, void *ctx)
+{
+    zmMemDump_t dump;
+    zm_uint32_t len;
+    
+    if(heap == NULL) return;
+    
+    if(unit == 0) unit = ZM_ALIGN_GET(heap->memSize / (64 * 32) + 1);
+    
+    memset(&dump, 0, sizeof(dump));
+    dump.write = write;
+    dump.ctx = ctx;
+    dump.format = format;
+    dump.unit = unit;
+    
+    if(format == ZM_MEM_DUMP_CSV)
+    {
+        write(ctx, "offset,size,used\n", 17);
+    }
+    else
+    {
+        memcpy(dump.line, "heap 0x", 7);
+        len = 7 + zm_dumpNum(&dump.line[7], (zm_uintptr_t)heap->memHeap, 16, 1);
+        memcpy(&dump.line[len], " size ", 6);
+        len += 6 + zm_dumpNum(&dump.line[len + 6], heap->memSize, 10, 1);
+        memcpy(&dump.line[len], " unit ", 6);
+        len += 6 + zm_dumpNum(&dump.line[len + 6], unit, 10, 1);
+        dump.line[len++] = '\n';
+        write(ctx, dump.line, len);
+    }
+    
+    zm_heapWalk(heap, zm_dumpBlock, &dump);
+    
+    if(format != ZM_MEM_DUMP_CSV)
+    {
+        if(dump.fill) zm_dumpCell(&dump);
+        if(dump.cells)
+        {
+            dump.line[dump.len++] = '\n';
+            write(ctx, dump.line, dump.len);
+        }
+    }
+}
+/*****************************************************************
+* FUNCTION: zm_memoryMgrInit
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation init.
+* INPUTS:
+*     null
+* RETURNS:
+*     null.
+* NOTE:
+*     null
+*****************************************************************/
+void zm_memoryMgrInit(void)
+{
+#if ZM_MEM_THREAD_CACHE
+#if ZM_MEM_USE_MMAP
+    zm_arenaInitMmap(ZM_MEM_MMAP_RESERVE);
+#elif ZM_MEM_USE_HEAP
+    zm_arenaInit((void *)ZM_MEM_HEAP_BEGIN, (void *)ZM_MEM_HEAP_END);
+#else
+    zm_arenaInit((void *)&zm_pool[0], (void *)((zm_uint8_t *)&zm_pool[ZM_MEM_SIZE - 1]));
+#endif
+#else
+#if ZM_MEM_USE_MMAP
+    zmMemDefault = zm_mem_mmapInit(ZM_MEM_MMAP_RESERVE);
+#elif ZM_MEM_USE_HEAP
+    zmMemDefault = zm_mem_init((void *)ZM_MEM_HEAP_BEGIN, (void *)ZM_MEM_HEAP_END);
+#else
+    zmMemDefault = zm_mem_init((void *)&zm_pool[0], (void *)((zm_uint8_t *)&zm_pool[ZM_MEM_SIZE - 1]));
+#endif
+#endif
+#if ZM_MEM_LATENCY
+    zmMemLatTick = zm_latClock();
+    zmMemLatNs = zm_latNs();
+#endif
+}
+/*****************************************************************
+* FUNCTION: zm_getDefaultHeap
+*
+* DESCRIPTION: 
+*     Get the heap used by zm_malloc, zm_free...
+* INPUTS:
+*     null
+* RETURNS:
+*     The default heap handle, NULL before zm_memoryMgrInit.
+* NOTE:
+*     null
+*****************************************************************/
+zm_heap_t *zm_getDefaultHeap(void)
+{
+    return zmMemDefault;
+}
+#if ZM_MEM_USE_MMAP
+/*****************************************************************
+* FUNCTION: zm_heapCreate
+*
+* DESCRIPTION: 
+*     Create a heap that grows on demand in its own virtual range.
+* INPUTS:
+*     reserve : Size of the range to reserve, the heap never grows past it.
+* RETURNS:
+*     The heap handle.
+*     NULL : faild, the range could not be reserved.
+* NOTE:
+*     null
+*****************************************************************/
+zm_heap_t *zm_heapCreate(zm_size_t reserve)
+{
+    zm_heap_t *heap = zm_mem_mmapInit(reserve);
+    
+#if ZM_MEM_THREAD_CACHE
+    if(heap) pthread_mutex_init(&heap->lock, NULL);
 #endif
-            }
-            pMem->magic = ZM_HEAP_MAGIC;
-            
-            if(pMem == lfree)
-            {
-                while(lfree->used && lfree != zmMemEnd)
-                {
-                    lfree = (zmMem_t *)&zmMemHeap[lfree->next];
-                }
-                
-                ZM_MEM_ASSERT(lfree == zmMemEnd || !lfree->used);
-            }
-            
-            return (zm_uint8_t *)pMem + MEM_STRUCT_SIZE;
-        }
+    
+    return heap;
+}
+/*****************************************************************
+* FUNCTION: zm_heapDestroy
+*
+* DESCRIPTION: 
+*     Give the virtual range of a heap back to the system.
+* INPUTS:
+*     heap : Returned by zm_heapCreate.
+* RETURNS:
+*     null
+* NOTE:
+*     null
+*****************************************************************/
+void zm_heapDestroy(zm_heap_t *heap)
+{
+    if(heap == NULL || heap->reserveEnd == NULL) return;
+    
+#if ZM_MEM_THREAD_CACHE
+    pthread_mutex_destroy(&heap->lock);
+#endif
+    // the control block is in the range, read it first.
+    munmap(heap->beginAddr, (zm_uintptr_t)(heap->reserveEnd - (zm_uint8_t *)heap->beginAddr));
+}
+#endif
+#if ZM_MEM_PURGE
+/*****************************************************************
+* FUNCTION: zm_heapTrim
+*
+* DESCRIPTION: 
+*     Give the pages of large free runs back to the system now.
+* INPUTS:
+*     heap : The heap handle.
+* RETURNS:
+*     The number of bytes purged by this call.
+* NOTE:
+*     null
+*****************************************************************/
+zm_size_t zm_heapTrim(zm_heap_t *heap)
+{
+    zm_size_t done;
+    
+    if(heap == NULL || heap->reserveEnd == NULL) return 0;
+    
+    ZM_MEM_LOCK(heap);
+#if ZM_MEM_THREAD_CACHE
+    zm_remoteDrain(heap);
+#endif
+#if ZM_MEM_FAST_MAX
+    zm_fastConsolidate(heap);
+#endif
+    done = zm_purge(heap);
+    ZM_MEM_UNLOCK(heap);
+    
+    return done;
+}
+/*****************************************************************
+* FUNCTION: zm_memTrim
+*
+* DESCRIPTION: 
+*     zm_heapTrim on the memory behind zm_malloc.
+* INPUTS:
+*     null
+* RETURNS:
+*     The number of bytes purged by this call.
+* NOTE:
+*     null
+*****************************************************************/
+zm_size_t zm_memTrim(void)
+{
+#if ZM_MEM_THREAD_CACHE
+    zm_size_t sum = 0;
+    zm_uint32_t i;
+    
+    for(i = 0; i < zmMemArenaNum; i++)
+    {
+        sum += zm_heapTrim(zmMemArena[i]);
     }
-    return NULL;
+    return sum;
+#else
+    return zm_heapTrim(zmMemDefault);
+#endif
 }
-
+#endif
 /*****************************************************************
-* FUNCTION: zm_mem_realloc
+* FUNCTION: zm_malloc
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation.
+* INPUTS:
+*     size : The number of bytes to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     null
+*****************************************************************/
+void *zm_malloc(zm_size_t size)
+{
+    void *ptr;
+    ZM_MEM_LAT_BEGIN();
+    
+#if ZM_MEM_THREAD_CACHE
+    ptr = zm_tcacheMalloc(size);
+#else
+    ptr = zm_heapMalloc(zmMemDefault, size);
+#endif
+    ZM_MEM_LAT_END(ZM_LAT_MALLOC);
+    ZM_MEM_TRACE_CALL(ZM_TRACE_MALLOC, size, ptr, NULL);
+    ZM_MEM_PROF_ALLOC(size, ptr);
+    
+    return ptr;
+}
+/*****************************************************************
+* FUNCTION: zm_realloc
 *
 * DESCRIPTION: 
 *     zm dynamic memory allocation.
+*     This function will change the previously allocated memory block.
 * INPUTS:
 *     ptr : pointer to memory allocated by zm_mem_malloc.
 *     newsize : The number of new size to allocate from the HEAP.
@@ -301,172 +4408,342 @@ static void *zm_mem_malloc(zm_size_t size)
 * NOTE:
 *     null
 *****************************************************************/
-static void *zm_mem_realloc(void *ptr, zm_size_t newsize)
+void *zm_realloc(void *ptr, zm_size_t newsize)
 {
-    zm_size_t idx;
-    zm_size_t size;
-    zmMem_t *pMem;
     void *newMem;
     
-    newsize = ZM_ALIGN_GET(newsize);
-    
-    if(newsize > zmMemSize) return NULL;
+    // the block may be freed or moved, a failed realloc loses its sample
+    ZM_MEM_PROF_FREE(ptr);
     
-    if(newsize == 0)
     {
-        zm_mem_free(ptr);
-        return NULL;
+        ZM_MEM_LAT_BEGIN();
+        
+#if ZM_MEM_THREAD_CACHE
+        newMem = zm_tcacheRealloc(ptr, newsize);
+#else
+        newMem = zm_heapRealloc(zmMemDefault, ptr, newsize);
+#endif
+        ZM_MEM_LAT_END(ZM_LAT_REALLOC);
     }
-
-    if(newsize < MIN_SIZE_ALIGNED) newsize = MIN_SIZE_ALIGNED;
+    ZM_MEM_TRACE_CALL(ZM_TRACE_REALLOC, newsize, newMem, ptr);
+    ZM_MEM_PROF_ALLOC(newsize, newMem);
     
-    if(ptr == NULL) return zm_mem_malloc(newsize);
+    return newMem;
+}
+/*****************************************************************
+* FUNCTION: zm_mem_calloc
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation.
+*     This function will contiguously allocate enough space for count objects
+*     that are size bytes of memory each and returns a pointer to the allocated.
+* memory.
+* INPUTS:
+*     count : Number of objects to allocate.
+*     size : The number of size to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     null
+*****************************************************************/
+void *zm_calloc(zm_size_t count, zm_size_t size)
+{
+    void *ptr;
+    ZM_MEM_LAT_BEGIN();
     
-    if((zm_uint8_t *)ptr < (zm_uint8_t *)zmMemHeap ||
-       (zm_uint8_t *)ptr >= (zm_uint8_t *)zmMemEnd)
+#if ZM_MEM_THREAD_CACHE
+    ptr = NULL;
+    if(size == 0 || count <= ZM_MEM_FREE_NIL / size)
     {
-        //illegal memory
-        return ptr;
+        ptr = zm_tcacheMalloc(count * size);
     }
     
-    pMem = (zmMem_t *)((zm_uint8_t *)ptr - MEM_STRUCT_SIZE);
+    if(ptr) memset(ptr, 0, count * size);
+#else
+    ptr = zm_heapCalloc(zmMemDefault, count, size);
+#endif
+    ZM_MEM_LAT_END(ZM_LAT_MALLOC);
+    ZM_MEM_TRACE_CALL(ZM_TRACE_CALLOC, count * size, ptr, NULL);
+    ZM_MEM_PROF_ALLOC(count * size, ptr);
+    
+    return ptr;
+}
+/*****************************************************************
+* FUNCTION: zm_memalign
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation with a given alignment.
+* INPUTS:
+*     alignment : Power of two.
+*     size : The number of bytes to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory or alignment is not a power of two.
+* NOTE:
+*     Traced as a malloc.
+*****************************************************************/
+void *zm_memalign(zm_size_t alignment, zm_size_t size)
+{
+    void *ptr;
+    ZM_MEM_LAT_BEGIN();
+    
+#if ZM_MEM_THREAD_CACHE
+    ptr = zm_tcacheMemalign(alignment, size);
+#else
+    ptr = zm_heapMemalign(zmMemDefault, alignment, size);
+#endif
+    ZM_MEM_LAT_END(ZM_LAT_MALLOC);
+    ZM_MEM_TRACE_CALL(ZM_TRACE_MALLOC, size, ptr, NULL);
+    ZM_MEM_PROF_ALLOC(size, ptr);
+    
+    return ptr;
+}
+/*****************************************************************
+* FUNCTION: zm_aligned_alloc
+*
+* DESCRIPTION: 
+*     C11 aligned_alloc for zm.
+* INPUTS:
+*     alignment : Power of two.
+*     size : The number of bytes to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory or alignment is not a power of two.
+* NOTE:
+*     null
+*****************************************************************/
+void *zm_aligned_alloc(zm_size_t alignment, zm_size_t size)
+{
+    return zm_memalign(alignment, size);
+}
+/*****************************************************************
+* FUNCTION: zm_free
+*
+* DESCRIPTION: 
+*       zm dynamic memory de-allocation.
+* INPUTS:
+*     ptr : The first address assigned by zm_malloc().
+* RETURNS:
+*     null
+* NOTE:
+*     null
+*****************************************************************/
+void zm_free(void *ptr)
+{
+    ZM_MEM_LAT_BEGIN();
+    
+    ZM_MEM_TRACE_CALL(ZM_TRACE_FREE, 0, ptr, NULL);
+    ZM_MEM_PROF_FREE(ptr);
+    
+#if ZM_MEM_THREAD_CACHE
+    zm_tcacheFree(ptr);
+#else
+    zm_heapFree(zmMemDefault, ptr);
+#endif
+    ZM_MEM_LAT_END(ZM_LAT_FREE);
+}
+/*****************************************************************
+* FUNCTION: zm_freeSized
+*
+* DESCRIPTION: 
+*       zm_free with the size the block was allocated with.
+* INPUTS:
+*     ptr : The first address assigned by zm_malloc().
+*     size : The size asked for when ptr was allocated.
+* RETURNS:
+*     null
+* NOTE:
+*     The header is read anyway, free merges with the neighbours it
+*     names. With ZM_MEM_CHECK a size larger than the block is caught
+*     as illegal memory, the trace records the size.
+*****************************************************************/
+void zm_freeSized(void *ptr, zm_size_t size)
+{
+    ZM_MEM_LAT_BEGIN();
     
-    idx = (zm_uint8_t *)pMem - zmMemHeap;
-    size = pMem->next - idx - MEM_STRUCT_SIZE;
+    ZM_MEM_TRACE_CALL(ZM_TRACE_FREE, size, ptr, NULL);
+    ZM_MEM_PROF_FREE(ptr);
     
-    if(size == newsize)
+    if(ptr == NULL)
     {
-        return ptr;
+        ZM_MEM_LAT_END(ZM_LAT_FREE);
+        return;
     }
     
-    if((newsize + MEM_STRUCT_SIZE + MIN_SIZE_ALIGNED) < size)
+#if ZM_MEM_THREAD_CACHE
+#if ZM_MEM_CHECK
     {
-        zm_size_t idx2;
-        zmMem_t *mem;
-        
-        idx2 = idx + MEM_STRUCT_SIZE + size;
-        mem = (zmMem_t *)&zmMemHeap[idx2];
-        mem->magic = ZM_HEAP_MAGIC;
-        mem->used = 0;
-        mem->next = pMem->next;
-        mem->prev = idx;
+        zm_heap_t *arena = zm_arenaOf(ptr);
         
-        pMem->next = idx2;
-        
-        if(mem->next != (zmMemSize + MEM_STRUCT_SIZE))
+        if(arena && !zm_sizeValid(arena, ptr, size))
         {
-            ((zmMem_t *)&zmMemHeap[mem->next])->prev = idx2;
+            //illegal memory
+            ZM_MEM_LAT_END(ZM_LAT_FREE);
+            return;
         }
-#if ZM_MEM_STATS
-        memStats.usedSize -= (size - newsize);
+    }
+#else
+    (void)size;
 #endif
-        if(mem < lfree) lfree = mem;
-        
-        zm_putTogether(mem);
+    zm_tcacheFree(ptr);
+#else
+    zm_heapFreeSized(zmMemDefault, ptr, size);
+#endif
+    ZM_MEM_LAT_END(ZM_LAT_FREE);
+}
+/*****************************************************************
+* FUNCTION: zm_mallocBatch
+*
+* DESCRIPTION: 
+*     Allocate n blocks of one size.
+* INPUTS:
+*     size : The number of bytes of each block.
+*     n : The number of blocks.
+*     ptrs : Filled with the blocks.
+* RETURNS:
+*     The number of blocks allocated, less than n if out of memory.
+* NOTE:
+*     Traced as n mallocs.
+*****************************************************************/
+zm_size_t zm_mallocBatch(zm_size_t size, zm_size_t n, void *ptrs[])
+{
+    zm_size_t got;
+    
+#if ZM_MEM_THREAD_CACHE
+    got = zm_tcacheMallocBatch(size, n, ptrs);
+#else
+    got = zm_heapMallocBatch(zmMemDefault, size, n, ptrs);
+#endif
+#if ZM_MEM_TRACE || ZM_MEM_PROF
+    {
+        zm_size_t i;
         
-        return ptr;
+        for(i = 0; i < got; i++)
+        {
+            ZM_MEM_TRACE_CALL(ZM_TRACE_MALLOC, size, ptrs[i], NULL);
+            ZM_MEM_PROF_ALLOC(size, ptrs[i]);
+        }
     }
+#endif
     
-    newMem = zm_mem_malloc(newsize);
+    return got;
+}
+/*****************************************************************
+* FUNCTION: zm_freeBatch
+*
+* DESCRIPTION: 
+*       Free n blocks at once.
+* INPUTS:
+*     ptrs : The blocks, NULL entries are skipped.
+*     n : The number of blocks.
+* RETURNS:
+*     null
+* NOTE:
+*     ptrs is sorted by address in place. Traced as n frees.
+*****************************************************************/
+void zm_freeBatch(void *ptrs[], zm_size_t n)
+{
+#if ZM_MEM_TRACE || ZM_MEM_PROF
+    zm_size_t i;
     
-    if(newMem)
+    for(i = 0; i < n; i++)
     {
-        memcpy(newMem, ptr, size < newsize ? size : newsize);
-        zm_mem_free(ptr);
+        ZM_MEM_TRACE_CALL(ZM_TRACE_FREE, 0, ptrs[i], NULL);
+        ZM_MEM_PROF_FREE(ptrs[i]);
     }
-        
-    return newMem;
+#endif
+    
+#if ZM_MEM_THREAD_CACHE
+    zm_tcacheFreeBatch(ptrs, n);
+#else
+    zm_heapFreeBatch(zmMemDefault, ptrs, n);
+#endif
 }
 /*****************************************************************
-* FUNCTION: zm_mem_calloc
+* FUNCTION: zm_getMemTotal
 *
 * DESCRIPTION: 
-*     zm dynamic memory allocation.
-*     This function will contiguously allocate enough space for count objects
-*     that are size bytes of memory each and returns a pointer to the allocated.
-* memory.
+*       Get zm memory management total size.
 * INPUTS:
-*     count : Number of objects to allocate.
-*     size : The number of size to allocate from the HEAP.
+*     null
 * RETURNS:
-*     The first address of the allocated memory space.
-*     NULL : faild, It may be out of memory.
+*     memory total size.
 * NOTE:
 *     null
 *****************************************************************/
-void *zm_mem_calloc(zm_size_t count, zm_size_t size)
+zm_size_t zm_getMemTotal(void)
 {
-    void *ptr;
-    
-    ptr = zm_mem_malloc(count * size);
+#if ZM_MEM_THREAD_CACHE
+    zm_size_t sum = 0;
+    zm_uint32_t i;
     
-    if(ptr) memset(ptr, 0, count * size);
-    
-    return ptr;
+    for(i = 0; i < zmMemArenaNum; i++)
+    {
+        sum += zm_heapGetTotal(zmMemArena[i]);
+    }
+    return sum;
+#else
+    return zm_heapGetTotal(zmMemDefault);
+#endif
 }
 /*****************************************************************
-* FUNCTION: zm_mem_free
+* FUNCTION: zm_getMemUsed
 *
 * DESCRIPTION: 
-*       zm dynamic memory de-allocation.
+*       Get zm memory management used size.
 * INPUTS:
-*     ptr : The first address assigned by zm_mem_malloc().
-* RETURNS:
 *     null
+* RETURNS:
+*     memory used size.
 * NOTE:
-*     null
+*     If no set ZM_MEM_STATS to 1, It always returns 0.
 *****************************************************************/
-static void zm_mem_free(void *ptr)
+zm_size_t zm_getMemUsed(void)
 {
-    zmMem_t *pMem;
-    
-    if(ptr == NULL) return;
+#if ZM_MEM_THREAD_CACHE
+    zm_size_t sum = 0;
+    zm_uint32_t i;
     
-    if((zm_uint8_t *)ptr < (zm_uint8_t *)zmMemHeap ||
-       (zm_uint8_t *)ptr >= (zm_uint8_t *)zmMemEnd)
+    for(i = 0; i < zmMemArenaNum; i++)
     {
-        //illegal memory
-        return;
-    }
-    
-    pMem = (zmMem_t *)((zm_uint8_t *)ptr - MEM_STRUCT_SIZE);
-    
-    if(pMem->magic != ZM_HEAP_MAGIC || !pMem->used)
-    {
-        ZM_MEM_ASSERT(0);
-        //return;
+        sum += zm_heapGetUsed(zmMemArena[i]);
     }
-    pMem->used = 0;
-    
-    if(pMem < lfree) lfree = pMem;
-    
-#if ZM_MEM_STATS
-    memStats.usedSize -= (pMem->next - ((zm_uint8_t *)pMem - zmMemHeap));
+    return sum;
+#else
+    return zm_heapGetUsed(zmMemDefault);
 #endif
-    
-    zm_putTogether(pMem);
 }
-
 /*****************************************************************
-* FUNCTION: zm_memoryMgrInit
+* FUNCTION: zm_getMemMaxUsed
 *
 * DESCRIPTION: 
-*     zm dynamic memory allocation init.
+*       Get zm memory management max used size.
 * INPUTS:
 *     null
 * RETURNS:
-*     null.
+*     memory max used size.
 * NOTE:
-*     null
+*     If no set ZM_MEM_STATS to 1, It always returns 0.
 *****************************************************************/
-void zm_memoryMgrInit(void)
+zm_size_t zm_getMemMaxUsed(void)
 {
-#if ZM_MEM_USE_HEAP
-    zm_mem_init((void *)ZM_MEM_HEAP_BEGIN, (void *)ZM_MEM_HEAP_END);
+#if ZM_MEM_THREAD_CACHE
+    zm_size_t sum = 0;
+    zm_uint32_t i;
+    
+    for(i = 0; i < zmMemArenaNum; i++)
+    {
+        sum += zm_heapGetMaxUsed(zmMemArena[i]);
+    }
+    return sum;
 #else
-    zm_mem_init((void *)&zm_pool[0], (void *)((zm_uint8_t *)&zm_pool[ZM_MEM_SIZE - 1]));
+    return zm_heapGetMaxUsed(zmMemDefault);
 #endif
 }
+
+#else
+
 /*****************************************************************
 * FUNCTION: zm_malloc
 *
@@ -478,51 +4755,50 @@ void zm_memoryMgrInit(void)
 *     The first address of the allocated memory space.
 *     NULL : faild, It may be out of memory.
 * NOTE:
-*     null
+*     It's weak functions, you can redefine it.
 *****************************************************************/
-void *zm_malloc(zm_size_t size)
+__ZM_WEAK void *zm_malloc(zm_size_t size)
 {
-    return zm_mem_malloc(size);
+    return malloc(size);
 }
 /*****************************************************************
-* FUNCTION: zm_realloc
+* FUNCTION: zm_memalign
 *
 * DESCRIPTION: 
-*     zm dynamic memory allocation.
-*     This function will change the previously allocated memory block.
+*     zm dynamic memory allocation with a given alignment.
 * INPUTS:
-*     ptr : pointer to memory allocated by zm_mem_malloc.
-*     newsize : The number of new size to allocate from the HEAP.
+*     alignment : Power of two.
+*     size : The number of bytes to allocate from the HEAP.
 * RETURNS:
 *     The first address of the allocated memory space.
 *     NULL : faild, It may be out of memory.
 * NOTE:
-*     null
+*     It's weak functions, you can redefine it.
 *****************************************************************/
-void *zm_realloc(void *ptr, zm_size_t newsize)
+__ZM_WEAK void *zm_memalign(zm_size_t alignment, zm_size_t size)
 {
-    return zm_mem_realloc(ptr, newsize);
+    if(alignment == 0 || (alignment & (alignment - 1))) return NULL;
+    if(alignment < sizeof(void *)) alignment = sizeof(void *);
+    
+    return aligned_alloc(alignment, ZM_ALIGN(size, alignment));
 }
 /*****************************************************************
-* FUNCTION: zm_mem_calloc
+* FUNCTION: zm_aligned_alloc
 *
 * DESCRIPTION: 
-*     zm dynamic memory allocation.
-*     This function will contiguously allocate enough space for count objects
-*     that are size bytes of memory each and returns a pointer to the allocated.
-* memory.
+*     C11 aligned_alloc for zm.
 * INPUTS:
-*     count : Number of objects to allocate.
-*     size : The number of size to allocate from the HEAP.
+*     alignment : Power of two.
+*     size : The number of bytes to allocate from the HEAP.
 * RETURNS:
 *     The first address of the allocated memory space.
 *     NULL : faild, It may be out of memory.
 * NOTE:
-*     null
+*     It's weak functions, you can redefine it.
 *****************************************************************/
-void *zm_calloc(zm_size_t count, zm_size_t size)
+__ZM_WEAK void *zm_aligned_alloc(zm_size_t alignment, zm_size_t size)
 {
-    return zm_mem_calloc(count, size);
+    return zm_memalign(alignment, size);
 }
 /*****************************************************************
 * FUNCTION: zm_free
@@ -530,15 +4806,78 @@ void *zm_calloc(zm_size_t count, zm_size_t size)
 * DESCRIPTION: 
 *       zm dynamic memory de-allocation.
 * INPUTS:
-*     ptr : The first address assigned by zm_malloc().
+*     ptr : The first address assigned by zm_mem_malloc().
 * RETURNS:
 *     null
 * NOTE:
+*     It's weak functions, you can redefine it.
+*****************************************************************/
+__ZM_WEAK void zm_free(void *ptr)
+{
+    free(ptr);
+}
+/*****************************************************************
+* FUNCTION: zm_freeSized
+*
+* DESCRIPTION: 
+*       zm_free with the size the block was allocated with.
+* INPUTS:
+*     ptr : The block.
+*     size : The size asked for when ptr was allocated.
+* RETURNS:
 *     null
+* NOTE:
+*     It's weak functions, you can redefine it.
 *****************************************************************/
-void zm_free(void *ptr)
+__ZM_WEAK void zm_freeSized(void *ptr, zm_size_t size)
+{
+    (void)size;
+    free(ptr);
+}
+/*****************************************************************
+* FUNCTION: zm_mallocBatch
+*
+* DESCRIPTION: 
+*     Allocate n blocks of one size.
+* INPUTS:
+*     size : The number of bytes of each block.
+*     n : The number of blocks.
+*     ptrs : Filled with the blocks.
+* RETURNS:
+*     The number of blocks allocated.
+* NOTE:
+*     It's weak functions, you can redefine it.
+*****************************************************************/
+__ZM_WEAK zm_size_t zm_mallocBatch(zm_size_t size, zm_size_t n, void *ptrs[])
+{
+    zm_size_t got;
+    
+    for(got = 0; got < n; got++)
+    {
+        ptrs[got] = malloc(size);
+        if(ptrs[got] == NULL) break;
+    }
+    return got;
+}
+/*****************************************************************
+* FUNCTION: zm_freeBatch
+*
+* DESCRIPTION: 
+*       Free n blocks at once.
+* INPUTS:
+*     ptrs : The blocks.
+*     n : The number of blocks.
+* RETURNS:
+*     null
+* NOTE:
+*     It's weak functions, you can redefine it.
+*****************************************************************/
+__ZM_WEAK void zm_freeBatch(void *ptrs[], zm_size_t n)
 {
-    zm_mem_free(ptr);
+    while(n--)
+    {
+        free(ptrs[n]);
+    }
 }
 /*****************************************************************
 * FUNCTION: zm_getMemTotal
@@ -552,9 +4891,9 @@ void zm_free(void *ptr)
 * NOTE:
 *     null
 *****************************************************************/
-zm_size_t zm_getMemTotal(void)
+__ZM_WEAK zm_size_t zm_getMemTotal(void)
 {
-    return zmMemSize;
+    return 0;
 }
 /*****************************************************************
 * FUNCTION: zm_getMemUsed
@@ -566,15 +4905,11 @@ zm_size_t zm_getMemTotal(void)
 * RETURNS:
 *     memory used size.
 * NOTE:
-*     If no set ZM_MEM_STATS to 1, It always returns 0.
+*     
 *****************************************************************/
-zm_size_t zm_getMemUsed(void)
+__ZM_WEAK zm_size_t zm_getMemUsed(void)
 {
-#if ZM_MEM_STATS
-    return memStats.usedSize;
-#else
     return 0;
-#endif
 }
 /*****************************************************************
 * FUNCTION: zm_getMemMaxUsed
@@ -586,99 +4921,272 @@ zm_size_t zm_getMemUsed(void)
 * RETURNS:
 *     memory max used size.
 * NOTE:
-*     If no set ZM_MEM_STATS to 1, It always returns 0.
+*     
 *****************************************************************/
-zm_size_t zm_getMemMaxUsed(void)
+__ZM_WEAK zm_size_t zm_getMemMaxUsed(void)
 {
-#if ZM_MEM_STATS
-    return memStats.maxSize;
-#else
     return 0;
-#endif
 }
-
-#else
-
 /*****************************************************************
-* FUNCTION: zm_malloc
+* FUNCTION: zm_getMemStatsEx
 *
 * DESCRIPTION: 
-*     zm dynamic memory allocation.
+*       Get zm memory management extended statistics.
+* INPUTS:
+*     stats : Filled with zero.
+* RETURNS:
+*     null
+* NOTE:
+*     
+*****************************************************************/
+__ZM_WEAK void zm_getMemStatsEx(zm_memStatsEx_t *stats)
+{
+    memset(stats, 0, sizeof(zm_memStatsEx_t));
+}
+/*****************************************************************
+* FUNCTION: zm_heapInit
+*
+* DESCRIPTION: 
+*     Heap handle over a memory range.
+* INPUTS:
+*     beginAddr : The beginning address of the heap memory.
+*     endAddr   : The end address of the heap memory.
+* RETURNS:
+*     beginAddr as the handle, the range itself is not used.
+*     NULL : faild, the range is empty.
+* NOTE:
+*     It's weak functions, you can redefine it, heap is ignored.
+*****************************************************************/
+__ZM_WEAK zm_heap_t *zm_heapInit(void *beginAddr, void *endAddr)
+{
+    if(beginAddr == NULL || (zm_uint8_t *)endAddr <= (zm_uint8_t *)beginAddr) return NULL;
+    
+    return (zm_heap_t *)beginAddr;
+}
+/*****************************************************************
+* FUNCTION: zm_heapMalloc
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation from a given heap.
 * INPUTS:
+*     heap : The heap handle.
 *     size : The number of bytes to allocate from the HEAP.
 * RETURNS:
 *     The first address of the allocated memory space.
 *     NULL : faild, It may be out of memory.
 * NOTE:
-*     It's weak functions, you can redefine it.
+*     It's weak functions, you can redefine it, heap is ignored.
 *****************************************************************/
-__ZM_WEAK void *zm_malloc(zm_size_t size)
+__ZM_WEAK void *zm_heapMalloc(zm_heap_t *heap, zm_size_t size)
 {
+    (void)heap;
     return malloc(size);
 }
 /*****************************************************************
-* FUNCTION: zm_free
+* FUNCTION: zm_heapRealloc
 *
 * DESCRIPTION: 
-*       zm dynamic memory de-allocation.
+*     zm dynamic memory allocation from a given heap.
 * INPUTS:
-*     ptr : The first address assigned by zm_mem_malloc().
+*     heap : The heap handle.
+*     ptr : pointer to memory allocated by zm_heapMalloc.
+*     newsize : The number of new size to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     It's weak functions, you can redefine it, heap is ignored.
+*****************************************************************/
+__ZM_WEAK void *zm_heapRealloc(zm_heap_t *heap, void *ptr, zm_size_t newsize)
+{
+    (void)heap;
+    return realloc(ptr, newsize);
+}
+/*****************************************************************
+* FUNCTION: zm_heapCalloc
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation from a given heap, zero filled.
+* INPUTS:
+*     heap : The heap handle.
+*     count : Number of objects to allocate.
+*     size : The number of size to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     It's weak functions, you can redefine it, heap is ignored.
+*****************************************************************/
+__ZM_WEAK void *zm_heapCalloc(zm_heap_t *heap, zm_size_t count, zm_size_t size)
+{
+    (void)heap;
+    return calloc(count, size);
+}
+/*****************************************************************
+* FUNCTION: zm_heapMemalign
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation from a given heap with a given alignment.
+* INPUTS:
+*     heap : The heap handle.
+*     alignment : Power of two.
+*     size : The number of bytes to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     It's weak functions, you can redefine it, heap is ignored.
+*****************************************************************/
+__ZM_WEAK void *zm_heapMemalign(zm_heap_t *heap, zm_size_t alignment, zm_size_t size)
+{
+    (void)heap;
+    return zm_memalign(alignment, size);
+}
+/*****************************************************************
+* FUNCTION: zm_heapFree
+*
+* DESCRIPTION: 
+*     zm dynamic memory de-allocation to a given heap.
+* INPUTS:
+*     heap : The heap handle.
+*     ptr : The first address assigned by zm_heapMalloc().
 * RETURNS:
 *     null
 * NOTE:
-*     It's weak functions, you can redefine it.
+*     It's weak functions, you can redefine it, heap is ignored.
 *****************************************************************/
-__ZM_WEAK void zm_free(void *ptr)
+__ZM_WEAK void zm_heapFree(zm_heap_t *heap, void *ptr)
 {
+    (void)heap;
     free(ptr);
 }
 /*****************************************************************
-* FUNCTION: zm_getMemTotal
+* FUNCTION: zm_heapFreeSized
 *
 * DESCRIPTION: 
-*       Get zm memory management total size.
+*     zm_heapFree with the size the block was allocated with.
 * INPUTS:
+*     heap : The heap handle.
+*     ptr : The first address assigned by zm_heapMalloc().
+*     size : The size asked for when ptr was allocated.
+* RETURNS:
 *     null
+* NOTE:
+*     It's weak functions, you can redefine it, heap is ignored.
+*****************************************************************/
+__ZM_WEAK void zm_heapFreeSized(zm_heap_t *heap, void *ptr, zm_size_t size)
+{
+    (void)heap;
+    (void)size;
+    free(ptr);
+}
+/*****************************************************************
+* FUNCTION: zm_heapMallocBatch
+*
+* DESCRIPTION: 
+*     Allocate n blocks of one size from a given heap.
+* INPUTS:
+*     heap : The heap handle.
+*     size : The number of bytes of each block.
+*     n : The number of blocks.
+*     ptrs : Filled with the blocks.
 * RETURNS:
-*     memory total size.
+*     The number of blocks allocated.
 * NOTE:
+*     It's weak functions, you can redefine it, heap is ignored.
+*****************************************************************/
+__ZM_WEAK zm_size_t zm_heapMallocBatch(zm_heap_t *heap, zm_size_t size, zm_size_t n, void *ptrs[])
+{
+    (void)heap;
+    return zm_mallocBatch(size, n, ptrs);
+}
+/*****************************************************************
+* FUNCTION: zm_heapFreeBatch
+*
+* DESCRIPTION: 
+*     Free n blocks to a given heap.
+* INPUTS:
+*     heap : The heap handle.
+*     ptrs : The first addresses assigned by zm_heapMalloc().
+*     n : The number of blocks, NULL entries are skipped.
+* RETURNS:
 *     null
+* NOTE:
+*     It's weak functions, you can redefine it, heap is ignored.
 *****************************************************************/
-__ZM_WEAK zm_size_t zm_getMemTotal(void)
+__ZM_WEAK void zm_heapFreeBatch(zm_heap_t *heap, void *ptrs[], zm_size_t n)
+{
+    (void)heap;
+    zm_freeBatch(ptrs, n);
+}
+/*****************************************************************
+* FUNCTION: zm_heapGetTotal
+*
+* DESCRIPTION: 
+*       Get heap total size.
+* INPUTS:
+*     heap : The heap handle.
+* RETURNS:
+*     heap total size, always 0.
+* NOTE:
+*     It's weak functions, you can redefine it, heap is ignored.
+*****************************************************************/
+__ZM_WEAK zm_size_t zm_heapGetTotal(zm_heap_t *heap)
 {
+    (void)heap;
     return 0;
 }
 /*****************************************************************
-* FUNCTION: zm_getMemUsed
+* FUNCTION: zm_heapGetUsed
 *
 * DESCRIPTION: 
-*       Get zm memory management used size.
+*       Get heap used size.
 * INPUTS:
-*     null
+*     heap : The heap handle.
 * RETURNS:
-*     memory used size.
+*     heap used size, always 0.
 * NOTE:
-*     
+*     It's weak functions, you can redefine it, heap is ignored.
 *****************************************************************/
-__ZM_WEAK zm_size_t zm_getMemUsed(void)
+__ZM_WEAK zm_size_t zm_heapGetUsed(zm_heap_t *heap)
 {
+    (void)heap;
     return 0;
 }
 /*****************************************************************
-* FUNCTION: zm_getMemMaxUsed
+* FUNCTION: zm_heapGetMaxUsed
 *
 * DESCRIPTION: 
-*       Get zm memory management max used size.
+*       Get heap max used size.
 * INPUTS:
-*     null
+*     heap : The heap handle.
 * RETURNS:
-*     memory max used size.
+*     heap max used size, always 0.
 * NOTE:
-*     
+*     It's weak functions, you can redefine it, heap is ignored.
 *****************************************************************/
-__ZM_WEAK zm_size_t zm_getMemMaxUsed(void)
+__ZM_WEAK zm_size_t zm_heapGetMaxUsed(zm_heap_t *heap)
 {
+    (void)heap;
     return 0;
 }
+/*****************************************************************
+* FUNCTION: zm_heapGetStatsEx
+*
+* DESCRIPTION: 
+*       Get heap extended statistics.
+* INPUTS:
+*     heap : The heap handle.
+*     stats : Filled with zero.
+* RETURNS:
+*     null
+* NOTE:
+*     It's weak functions, you can redefine it, heap is ignored.
+*****************************************************************/
+__ZM_WEAK void zm_heapGetStatsEx(zm_heap_t *heap, zm_memStatsEx_t *stats)
+{
+    (void)heap;
+    memset(stats, 0, sizeof(zm_memStatsEx_t));
+}
 #endif
 /****************************************************** END OF FILE ******************************************************/
@@ -27,18 +27,251 @@ extern "C"
 /*************************************************************************************************************************
  *                                                       INCLUDES                                                        *
  *************************************************************************************************************************/
+#include <stddef.h>
+#include <stdint.h>
 
 /*************************************************************************************************************************
  *                                                        MACROS                                                         *
  *************************************************************************************************************************/ 
+/* Options below may be overridden on the compiler command line (-DZM_MEM_STATS=0...). */
+#ifndef ZM_USE_MEM_MGR
 #define ZM_USE_MEM_MGR          1
+#endif
+#ifndef ZM_MEM_USE_HEAP
 #define ZM_MEM_USE_HEAP         1
+#endif
+#ifndef ZM_MEM_STATS
 #define ZM_MEM_STATS            1
+#endif
+/**
+ * 1: time every zm_malloc, zm_free and zm_realloc, and count the free blocks
+ * each heap malloc examines and the neighbours each heap free merges, in
+ * log-linear histograms, see zm_getMemLatency. Ticks are the TSC on x86, the
+ * virtual counter on ARM64, zm_latencyClock() elsewhere.
+ */
+#ifndef ZM_MEM_LATENCY
+#define ZM_MEM_LATENCY          0
+#endif
 
+/**
+ * Linux/POSIX: the default heap lives in a virtual range reserved with
+ * mmap(PROT_NONE), ZM_MEM_USE_HEAP and ZM_MEM_SIZE are then not used.
+ * Pages are committed ZM_MEM_MMAP_COMMIT bytes at a time as the heap runs
+ * out of free blocks, so startup touches almost nothing and only memory
+ * in use costs RSS. With ZM_MEM_THREAD_CACHE every arena reserves its share.
+ * Also provides zm_heapCreate/zm_heapDestroy.
+ */
+#ifndef ZM_MEM_USE_MMAP
+#define ZM_MEM_USE_MMAP         0
+#endif
+#ifndef ZM_MEM_MMAP_RESERVE
+#define ZM_MEM_MMAP_RESERVE     (1024u << 20)
+#endif
+/** growth step, a multiple of the page size */
+#ifndef ZM_MEM_MMAP_COMMIT
+#define ZM_MEM_MMAP_COMMIT      (64u << 10)
+#endif
+
+/**
+ * Huge pages for ZM_MEM_USE_MMAP heaps, a large heap then needs far fewer TLB
+ * entries. ZM_MEM_HUGE_THP reserves ZM_MEM_HUGE_SIZE aligned and asks for
+ * transparent huge pages with madvise(MADV_HUGEPAGE). ZM_MEM_HUGE_HUGETLB
+ * commits explicit MAP_HUGETLB pages from the pool (vm.nr_hugepages) and
+ * falls back to transparent, then normal pages once the pool is empty.
+ * Growing and purging go by whole huge pages. The mode a heap got is in
+ * zm_memStatsEx_t.hugeMode.
+ */
+#define ZM_MEM_HUGE_NONE        0
+#define ZM_MEM_HUGE_THP         1
+#define ZM_MEM_HUGE_HUGETLB     2
+
+#ifndef ZM_MEM_HUGE
+#define ZM_MEM_HUGE             ZM_MEM_HUGE_NONE
+#endif
+#ifndef ZM_MEM_HUGE_SIZE
+#define ZM_MEM_HUGE_SIZE        (2u << 20)
+#endif
+
+/**
+ * Give the pages inside free runs of at least ZM_MEM_PURGE_MIN bytes back to
+ * the system with madvise, heaps of ZM_MEM_USE_MMAP only. Purging runs from
+ * zm_heapTrim/zm_memTrim, or by itself ZM_MEM_PURGE_DECAY_MS after a large
+ * free run appeared (0: never by itself). The decay is checked every
+ * ZM_MEM_PURGE_TICKS heap operations while a run waits, never on a timer;
+ * thread cache hits do not count.
+ * ZM_MEM_PURGE_LAZY 1 uses MADV_FREE, the kernel takes the pages only under
+ * memory pressure. With MADV_DONTNEED purged pages come back zeroed and
+ * zm_calloc does not clear them.
+ */
+#ifndef ZM_MEM_PURGE
+#define ZM_MEM_PURGE            ZM_MEM_USE_MMAP
+#endif
+#ifndef ZM_MEM_PURGE_MIN
+#define ZM_MEM_PURGE_MIN        (64u << 10)
+#endif
+#ifndef ZM_MEM_PURGE_DECAY_MS
+#define ZM_MEM_PURGE_DECAY_MS   1000
+#endif
+#ifndef ZM_MEM_PURGE_TICKS
+#define ZM_MEM_PURGE_TICKS      1024
+#endif
+#ifndef ZM_MEM_PURGE_LAZY
+#define ZM_MEM_PURGE_LAZY       0
+#endif
+
+/**
+ * Width of block offsets and sizes.
+ * 0 : 32 bit, heaps up to 4 GiB, smallest block header.
+ * 1 : size_t wide, for heaps larger than 4 GiB on 64 bit hosts.
+ * Pointers are handled at full width in both modes.
+ */
+#ifndef ZM_MEM_64BIT
+#define ZM_MEM_64BIT            0
+#endif
+
+/**
+ * Default alignment of every block, 4, 8 or 16. Use 16 where payloads must
+ * hold max_align_t or SIMD vectors. Larger alignments: zm_memalign.
+ * At least 8 with ZM_MEM_64BIT.
+ */
+#ifndef ZM_ALIGN_SIZE
+#if ZM_MEM_64BIT
+#define ZM_ALIGN_SIZE           8
+#else
 #define ZM_ALIGN_SIZE           4
+#endif
+#endif
+#ifndef ZM_MIN_SIZE
 #define ZM_MIN_SIZE             12
+#endif
+
+/**
+ * Block header format.
+ * 0 : magic, used flag, previous and next offsets, 12 bytes (24 with ZM_MEM_64BIT).
+ * 1 : one word, size plus used and previous-used flags. A free block also
+ *     keeps its size in its last word, a used block costs one word.
+ */
+#ifndef ZM_MEM_COMPACT
+#define ZM_MEM_COMPACT          0
+#endif
+
+/** 1: check the header of every block given to zm_free, set 0 once the code is trusted */
+#ifndef ZM_MEM_CHECK
+#define ZM_MEM_CHECK            1
+#endif
+
+/**
+ * Free block allocation policy.
+ * ZM_MEM_POLICY_SEGFIT : exact small lists, power of two sub-range lists above.
+ * ZM_MEM_POLICY_TLSF   : two-level segregated fit, bounded malloc/free time.
+ *
+ * With ZM_MEM_POLICY_TLSF the malloc and free paths have no loop, given a
+ * count-leading-zeros instruction (GCC/Clang builtins). Worst case, measured
+ * as the straight-line code of every function on the path (gcc 12 -O2, x86-64):
+ *     zm_malloc : 235 instructions (search, unlink, split, file the remainder).
+ *     zm_free   : 233 instructions (unlink both neighbours, merge, file).
+ * Any single call executes fewer, since only one side of each branch runs.
+ */
+#define ZM_MEM_POLICY_SEGFIT    1
+#define ZM_MEM_POLICY_TLSF      2
+
+#ifndef ZM_MEM_POLICY
+#define ZM_MEM_POLICY           ZM_MEM_POLICY_SEGFIT
+#endif
 
+/**
+ * Order of the blocks on each free list, the lists live in the payload of
+ * the free blocks and malloc never reads a used header to search them.
+ * ZM_MEM_ORDER_LIFO    : a freed block goes first, O(1).
+ * ZM_MEM_ORDER_ADDRESS : lists are kept by address, the lowest fitting block
+ *                        is taken and the heap fragments less. A free walks
+ *                        its list to the insertion point, long lists of one
+ *                        size make it slow.
+ */
+#define ZM_MEM_ORDER_LIFO       1
+#define ZM_MEM_ORDER_ADDRESS    2
+
+#ifndef ZM_MEM_LIST_ORDER
+#define ZM_MEM_LIST_ORDER       ZM_MEM_ORDER_LIFO
+#endif
+
+/**
+ * Best fit for large blocks. Free blocks of at least ZM_MEM_BEST_FIT bytes
+ * leave the lists for an AVL tree ordered by size, then address, and a
+ * request goes to the tree when it is that large or its lists are empty:
+ * the smallest block that fits, the lowest of equal ones, in O(log n).
+ * Large free runs are not cut for a request the tree can serve tighter.
+ * Smaller blocks keep the list fast path, ZM_MEM_POLICY_TLSF loses its
+ * loop-free bound for large ones. 0: off, else at least 64.
+ */
+#ifndef ZM_MEM_BEST_FIT
+#define ZM_MEM_BEST_FIT         0
+#endif
+
+/**
+ * Fast bins, deferred coalescing. A freed block of at most ZM_MEM_FAST_MAX
+ * payload bytes goes on a LIFO list of its exact size, still marked used
+ * and not merged, and a malloc of that size takes it back with no search,
+ * split or merge. The lists are merged into the free blocks in one sweep
+ * when a request finds no free block, when they hold more than
+ * ZM_MEM_FAST_LIMIT bytes, and by zm_heapTrim. Until then zm_heapWalk shows
+ * their blocks as used. With ZM_MEM_CHECK a double free of a fast block is
+ * caught only while it is the last one freed of its size.
+ * 0: off, else at most 1024.
+ */
+#ifndef ZM_MEM_FAST_MAX
+#define ZM_MEM_FAST_MAX         0
+#endif
+#ifndef ZM_MEM_FAST_LIMIT
+#define ZM_MEM_FAST_LIMIT       (16u << 10)
+#endif
+
+/** 1: record every zm_malloc/zm_calloc/zm_realloc/zm_free call, see ZM_MemTrace.h */
+#ifndef ZM_MEM_TRACE
+#define ZM_MEM_TRACE            0
+#endif
+
+/**
+ * 1: sample about one zm_malloc in every ZM_MEM_PROF_RATE bytes and keep the
+ * call stacks of the samples still live, see ZM_MemProf.h
+ */
+#ifndef ZM_MEM_PROF
+#define ZM_MEM_PROF             0
+#endif
+
+/**
+ * Multi-thread mode (POSIX threads, GCC atomics).
+ * The default memory is split in ZM_MEM_ARENA_NUM heaps, each with its own
+ * lock, and threads are spread over them. Every thread also keeps a cache of
+ * freed blocks up to ZM_MEM_TCACHE_MAX bytes, ZM_MEM_TCACHE_COUNT per size
+ * class, so most zm_malloc/zm_free calls take no lock. A cache refills from
+ * and flushes to the arenas ZM_MEM_TCACHE_BATCH blocks at a time.
+ * zm_heapXxx() calls on any heap are locked in this mode.
+ * A free never waits for a heap lock: when the lock is busy the block goes
+ * on a lock-free remote free list of the heap, emptied in bulk by the next
+ * allocation on that heap.
+ */
+#ifndef ZM_MEM_THREAD_CACHE
+#define ZM_MEM_THREAD_CACHE     0
+#endif
+#ifndef ZM_MEM_ARENA_NUM
+#define ZM_MEM_ARENA_NUM        8
+#endif
+#ifndef ZM_MEM_TCACHE_MAX
+#define ZM_MEM_TCACHE_MAX       512
+#endif
+#ifndef ZM_MEM_TCACHE_COUNT
+#define ZM_MEM_TCACHE_COUNT     32
+#endif
+#ifndef ZM_MEM_TCACHE_BATCH
+#define ZM_MEM_TCACHE_BATCH     (ZM_MEM_TCACHE_COUNT / 2)
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define __ZM_WEAK               __attribute__((weak))
+#else
 #define __ZM_WEAK               __weak
+#endif
 
 /**
  * ZM_ALIGN(size, align)
@@ -73,14 +306,33 @@ extern int __bss_end;
 
 #else
 
+#ifndef ZM_MEM_SIZE
 #define  ZM_MEM_SIZE            (8192)
+#endif
 
 #endif
 
 /*************************************************************************************************************************
  *                                                      CONSTANTS                                                        *
  *************************************************************************************************************************/
- 
+/** zm_heapDump formats */
+#define ZM_MEM_DUMP_MAP         1       //!< one character per unit bytes, 64 per line
+#define ZM_MEM_DUMP_CSV         2       //!< "offset,size,used" line per block
+
+/** zm_getMemLatency histograms */
+#define ZM_LAT_MALLOC           0       //!< ticks of zm_malloc, zm_calloc, zm_memalign
+#define ZM_LAT_FREE             1       //!< ticks of zm_free, zm_freeSized
+#define ZM_LAT_REALLOC          2       //!< ticks of zm_realloc
+#define ZM_LAT_SCAN             3       //!< free blocks examined by each heap malloc
+#define ZM_LAT_MERGE            4       //!< neighbours merged by each heap free
+#define ZM_LAT_NUM              5
+
+/**
+ * Values below 2^ZM_LAT_SUB_BITS have a bucket each, every power of two
+ * above is split in 2^ZM_LAT_SUB_BITS buckets (12.5% wide), up to 2^32.
+ */
+#define ZM_LAT_SUB_BITS         3
+#define ZM_LAT_BUCKETS          ((33 - ZM_LAT_SUB_BITS) << ZM_LAT_SUB_BITS)
 /*************************************************************************************************************************
  *                                                       TYPEDEFS                                                        *
  *************************************************************************************************************************/
@@ -93,7 +345,58 @@ typedef unsigned short zm_uint16_t;    //!< Unsigned 16 bit integer
 typedef signed int zm_int32_t;         //!< Signed 32 bit integer
 typedef unsigned int zm_uint32_t;      //!< Unsigned 32 bit integer
 
+#if ZM_MEM_64BIT
+typedef size_t zm_size_t;
+#else
 typedef zm_uint32_t zm_size_t;
+#endif
+
+typedef uintptr_t zm_uintptr_t;        //!< Integer as wide as a pointer
+
+/** Heap handle, the control block lives at the beginning of the heap memory. */
+typedef struct zmHeap zm_heap_t;
+
+/** log2 buckets of the free block histogram */
+#define ZM_MEM_HIST_NUM         (sizeof(zm_size_t) * 8)
+
+/** Extended statistics, see zm_getMemStatsEx. */
+typedef struct
+{
+    zm_size_t totalSize;                    //!< zm_getMemTotal
+    zm_size_t usedSize;                     //!< zm_getMemUsed
+    zm_size_t maxSize;                      //!< zm_getMemMaxUsed
+    zm_size_t largestFree;                  //!< largest free block payload
+    zm_size_t freeBlocks;                   //!< number of free blocks
+    zm_size_t freeHist[ZM_MEM_HIST_NUM];    //!< free blocks with payload in [2^n, 2^(n+1))
+    zm_size_t mallocCount;                  //!< heap level malloc calls
+    zm_size_t freeCount;                    //!< heap level free calls
+    zm_size_t reallocCount;                 //!< heap level realloc calls
+    zm_size_t purgedSize;                   //!< free bytes given back to the system, ZM_MEM_PURGE
+    zm_size_t fastSize;                     //!< freed bytes waiting in the fast bins, ZM_MEM_FAST_MAX
+    zm_uint32_t hugeMode;                   //!< ZM_MEM_HUGE_* in use, the least of all arenas
+}zm_memStatsEx_t;
+
+/** One block of a heap, see zm_heapWalk. */
+typedef struct
+{
+    void *ptr;                              //!< payload, what malloc returned for a used block
+    zm_size_t offset;                       //!< header offset from the first block of the heap
+    zm_size_t size;                         //!< payload size
+    zm_uint8_t used;                        //!< 1 used, 0 free
+}zm_memBlock_t;
+
+/** Called for each block by zm_heapWalk, not 0 stops the walk. */
+typedef zm_int32_t (*zm_memWalk_t)(void *ctx, const zm_memBlock_t *block);
+
+/** Receives dump text piece by piece. */
+typedef void (*zm_memWrite_t)(void *ctx, const char *text, zm_size_t len);
+
+/** Latency and work histograms, see zm_getMemLatency. */
+typedef struct
+{
+    zm_uint32_t count[ZM_LAT_NUM][ZM_LAT_BUCKETS];  //!< calls per bucket, see zm_latencyBucket
+    unsigned long long clockHz;                     //!< ticks per second, measured, 0 if unknown
+}zm_memLatency_t;
 /*************************************************************************************************************************
  *                                                   PUBLIC FUNCTIONS                                                    *
  *************************************************************************************************************************/
@@ -160,6 +463,38 @@ void *zm_realloc(void *ptr, zm_size_t newsize);
 *****************************************************************/
 void *zm_calloc(zm_size_t count, zm_size_t size);
 /*****************************************************************
+* FUNCTION: zm_memalign
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation with a given alignment.
+* INPUTS:
+*     alignment : Power of two, e.g. 64 for a cache line, 4096 for a page.
+*     size : The number of bytes to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory or alignment is not a power of two.
+* NOTE:
+*     The padding in front of the block goes back to the heap as a free
+*     block. Release with zm_free. zm_realloc keeps only ZM_ALIGN_SIZE
+*     alignment if the block has to move.
+*****************************************************************/
+void *zm_memalign(zm_size_t alignment, zm_size_t size);
+/*****************************************************************
+* FUNCTION: zm_aligned_alloc
+*
+* DESCRIPTION: 
+*     C11 aligned_alloc for zm.
+* INPUTS:
+*     alignment : Power of two.
+*     size : The number of bytes to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory or alignment is not a power of two.
+* NOTE:
+*     Same as zm_memalign, size need not be a multiple of alignment.
+*****************************************************************/
+void *zm_aligned_alloc(zm_size_t alignment, zm_size_t size);
+/*****************************************************************
 * FUNCTION: zm_free
 *
 * DESCRIPTION: 
@@ -173,6 +508,55 @@ void *zm_calloc(zm_size_t count, zm_size_t size);
 *****************************************************************/
 void zm_free(void *ptr);
 /*****************************************************************
+* FUNCTION: zm_freeSized
+*
+* DESCRIPTION: 
+*       zm_free with the size the block was allocated with.
+* INPUTS:
+*     ptr : The first address assigned by zm_malloc().
+*     size : The size asked for when ptr was allocated.
+* RETURNS:
+*     null
+* NOTE:
+*     For callers that know the size, like C++ sized delete. With
+*     ZM_MEM_CHECK a size larger than the block is caught as illegal
+*     memory.
+*****************************************************************/
+void zm_freeSized(void *ptr, zm_size_t size);
+/*****************************************************************
+* FUNCTION: zm_mallocBatch
+*
+* DESCRIPTION: 
+*     Allocate n blocks of one size.
+* INPUTS:
+*     size : The number of bytes of each block.
+*     n : The number of blocks.
+*     ptrs : Filled with the blocks.
+* RETURNS:
+*     The number of blocks allocated, less than n if out of memory.
+* NOTE:
+*     One lock, one search and one statistics update for the whole batch,
+*     the blocks are carved side by side from one free block when the
+*     heap has one big enough. Each block is released with zm_free or
+*     zm_freeBatch.
+*****************************************************************/
+zm_size_t zm_mallocBatch(zm_size_t size, zm_size_t n, void *ptrs[]);
+/*****************************************************************
+* FUNCTION: zm_freeBatch
+*
+* DESCRIPTION: 
+*       Free n blocks at once.
+* INPUTS:
+*     ptrs : The first addresses assigned by zm_malloc() or zm_mallocBatch().
+*     n : The number of blocks, NULL entries are skipped.
+* RETURNS:
+*     null
+* NOTE:
+*     ptrs is sorted by address in place. Neighbour blocks are merged
+*     first and the run goes back to the heap once.
+*****************************************************************/
+void zm_freeBatch(void *ptrs[], zm_size_t n);
+/*****************************************************************
 * FUNCTION: zm_getMemTotal
 *
 * DESCRIPTION: 
@@ -196,6 +580,7 @@ zm_size_t zm_getMemTotal(void);
 *     memory used size.
 * NOTE:
 *     If no set zm_MEM_STATS to 1, It always returns 0.
+*     With ZM_MEM_THREAD_CACHE, blocks held in thread caches count as used.
 *****************************************************************/
 zm_size_t zm_getMemUsed(void);
 /*****************************************************************
@@ -209,8 +594,470 @@ zm_size_t zm_getMemUsed(void);
 *     memory max used size.
 * NOTE:
 *     If no set zm_MEM_STATS to 1, It always returns 0.
+*     With ZM_MEM_THREAD_CACHE, it is the sum of the arena peaks.
 *****************************************************************/
 zm_size_t zm_getMemMaxUsed(void);
+/*****************************************************************
+* FUNCTION: zm_getMemStatsEx
+*
+* DESCRIPTION: 
+*       Get zm memory management extended statistics.
+* INPUTS:
+*     stats : Filled with the statistics of the default heap.
+* RETURNS:
+*     null
+* NOTE:
+*     If no set ZM_MEM_STATS to 1, only totalSize is set.
+*     Kept up to date by malloc, free and merge, cheap to poll. A moving
+*     realloc also counts one malloc and one free.
+*     With ZM_MEM_THREAD_CACHE, arenas are summed, largestFree is the
+*     largest of all arenas.
+*****************************************************************/
+void zm_getMemStatsEx(zm_memStatsEx_t *stats);
+/*****************************************************************
+* FUNCTION: zm_memWalk
+*
+* DESCRIPTION: 
+*     zm_heapWalk on the memory behind zm_malloc.
+* INPUTS:
+*     walk : Called for each block.
+*     ctx : Passed to walk.
+* RETURNS:
+*     0 : every block was visited.
+*     The value walk stopped with.
+* NOTE:
+*     With ZM_MEM_THREAD_CACHE arenas are walked one after the other,
+*     offsets start again at 0 in each.
+*****************************************************************/
+zm_int32_t zm_memWalk(zm_memWalk_t walk, void *ctx);
+/*****************************************************************
+* FUNCTION: zm_memCheck
+*
+* DESCRIPTION: 
+*     zm_heapCheck on the memory behind zm_malloc.
+* INPUTS:
+*     null
+* RETURNS:
+*     0 : consistent.
+*     See zm_heapCheck.
+* NOTE:
+*     null
+*****************************************************************/
+zm_int32_t zm_memCheck(void);
+/*****************************************************************
+* FUNCTION: zm_memDump
+*
+* DESCRIPTION: 
+*     zm_heapDump on the memory behind zm_malloc.
+* INPUTS:
+*     format : ZM_MEM_DUMP_MAP or ZM_MEM_DUMP_CSV.
+*     unit : Bytes per map character, 0 to fit a heap in 32 lines.
+*     write : Called with each piece of text.
+*     ctx : Passed to write.
+* RETURNS:
+*     null
+* NOTE:
+*     One dump per arena with ZM_MEM_THREAD_CACHE. write must not
+*     call zm_malloc or zm_free.
+*****************************************************************/
+void zm_memDump(zm_uint8_t format, zm_size_t unit, zm_memWrite_t write, void *ctx);
+/*****************************************************************
+* FUNCTION: zm_heapInit
+*
+* DESCRIPTION: 
+*     Create an independent heap over a memory range.
+* INPUTS:
+*     beginAddr : The beginning address of the heap memory.
+*     endAddr   : The end address of the heap memory.
+* RETURNS:
+*     The heap handle.
+*     NULL : faild, the memory is too small.
+* NOTE:
+*     The heap control block takes the beginning of the range.
+*****************************************************************/
+zm_heap_t *zm_heapInit(void *beginAddr, void *endAddr);
+/*****************************************************************
+* FUNCTION: zm_heapReset
+*
+* DESCRIPTION: 
+*     Release every block of a heap at once.
+* INPUTS:
+*     heap : The heap handle.
+* RETURNS:
+*     null
+* NOTE:
+*     All pointers allocated from the heap become invalid.
+*****************************************************************/
+void zm_heapReset(zm_heap_t *heap);
+/*****************************************************************
+* FUNCTION: zm_heapMalloc
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation from a given heap.
+* INPUTS:
+*     heap : The heap handle.
+*     size : The number of bytes to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     null
+*****************************************************************/
+void *zm_heapMalloc(zm_heap_t *heap, zm_size_t size);
+/*****************************************************************
+* FUNCTION: zm_heapRealloc
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation from a given heap.
+*     This function will change the previously allocated memory block.
+* INPUTS:
+*     heap : The heap handle.
+*     ptr : pointer to memory allocated by zm_heapMalloc.
+*     newsize : The number of new size to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     null
+*****************************************************************/
+void *zm_heapRealloc(zm_heap_t *heap, void *ptr, zm_size_t newsize);
+/*****************************************************************
+* FUNCTION: zm_heapCalloc
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation from a given heap, zero filled.
+* INPUTS:
+*     heap : The heap handle.
+*     count : Number of objects to allocate.
+*     size : The number of size to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory.
+* NOTE:
+*     null
+*****************************************************************/
+void *zm_heapCalloc(zm_heap_t *heap, zm_size_t count, zm_size_t size);
+/*****************************************************************
+* FUNCTION: zm_heapMemalign
+*
+* DESCRIPTION: 
+*     zm dynamic memory allocation from a given heap with a given alignment.
+* INPUTS:
+*     heap : The heap handle.
+*     alignment : Power of two.
+*     size : The number of bytes to allocate from the HEAP.
+* RETURNS:
+*     The first address of the allocated memory space.
+*     NULL : faild, It may be out of memory or alignment is not a power of two.
+* NOTE:
+*     See zm_memalign, release with zm_heapFree.
+*****************************************************************/
+void *zm_heapMemalign(zm_heap_t *heap, zm_size_t alignment, zm_size_t size);
+/*****************************************************************
+* FUNCTION: zm_heapFree
+*
+* DESCRIPTION: 
+*       zm dynamic memory de-allocation to a given heap.
+* INPUTS:
+*     heap : The heap handle.
+*     ptr : The first address assigned by zm_heapMalloc().
+* RETURNS:
+*     null
+* NOTE:
+*     null
+*****************************************************************/
+void zm_heapFree(zm_heap_t *heap, void *ptr);
+/*****************************************************************
+* FUNCTION: zm_heapFreeSized
+*
+* DESCRIPTION: 
+*       zm_heapFree with the size the block was allocated with.
+* INPUTS:
+*     heap : The heap handle.
+*     ptr : The first address assigned by zm_heapMalloc().
+*     size : The size asked for when ptr was allocated.
+* RETURNS:
+*     null
+* NOTE:
+*     See zm_freeSized.
+*****************************************************************/
+void zm_heapFreeSized(zm_heap_t *heap, void *ptr, zm_size_t size);
+/*****************************************************************
+* FUNCTION: zm_heapMallocBatch
+*
+* DESCRIPTION: 
+*     Allocate n blocks of one size from a given heap.
+* INPUTS:
+*     heap : The heap handle.
+*     size : The number of bytes of each block.
+*     n : The number of blocks.
+*     ptrs : Filled with the blocks.
+* RETURNS:
+*     The number of blocks allocated, less than n if out of memory.
+* NOTE:
+*     See zm_mallocBatch, release with zm_heapFree or zm_heapFreeBatch.
+*****************************************************************/
+zm_size_t zm_heapMallocBatch(zm_heap_t *heap, zm_size_t size, zm_size_t n, void *ptrs[]);
+/*****************************************************************
+* FUNCTION: zm_heapFreeBatch
+*
+* DESCRIPTION: 
+*       Free n blocks to a given heap.
+* INPUTS:
+*     heap : The heap handle.
+*     ptrs : The first addresses assigned by zm_heapMalloc().
+*     n : The number of blocks, NULL entries are skipped.
+* RETURNS:
+*     null
+* NOTE:
+*     See zm_freeBatch.
+*****************************************************************/
+void zm_heapFreeBatch(zm_heap_t *heap, void *ptrs[], zm_size_t n);
+/*****************************************************************
+* FUNCTION: zm_heapGetTotal
+*
+* DESCRIPTION: 
+*       Get heap total size.
+* INPUTS:
+*     heap : The heap handle.
+* RETURNS:
+*     heap total size.
+* NOTE:
+*     null
+*****************************************************************/
+zm_size_t zm_heapGetTotal(zm_heap_t *heap);
+/*****************************************************************
+* FUNCTION: zm_heapGetUsed
+*
+* DESCRIPTION: 
+*       Get heap used size.
+* INPUTS:
+*     heap : The heap handle.
+* RETURNS:
+*     heap used size.
+* NOTE:
+*     If no set ZM_MEM_STATS to 1, It always returns 0.
+*****************************************************************/
+zm_size_t zm_heapGetUsed(zm_heap_t *heap);
+/*****************************************************************
+* FUNCTION: zm_heapGetMaxUsed
+*
+* DESCRIPTION: 
+*       Get heap max used size.
+* INPUTS:
+*     heap : The heap handle.
+* RETURNS:
+*     heap max used size.
+* NOTE:
+*     If no set ZM_MEM_STATS to 1, It always returns 0.
+*****************************************************************/
+zm_size_t zm_heapGetMaxUsed(zm_heap_t *heap);
+/*****************************************************************
+* FUNCTION: zm_heapGetStatsEx
+*
+* DESCRIPTION: 
+*       Get heap extended statistics.
+* INPUTS:
+*     heap : The heap handle.
+*     stats : Filled with the statistics.
+* RETURNS:
+*     null
+* NOTE:
+*     See zm_getMemStatsEx.
+*****************************************************************/
+void zm_heapGetStatsEx(zm_heap_t *heap, zm_memStatsEx_t *stats);
+/*****************************************************************
+* FUNCTION: zm_heapWalk
+*
+* DESCRIPTION: 
+*     Visit every block of a heap in address order.
+* INPUTS:
+*     heap : The heap handle.
+*     walk : Called for each block.
+*     ctx : Passed to walk.
+* RETURNS:
+*     0 : every block was visited.
+*     The value walk stopped with.
+* NOTE:
+*     The heap is locked during the walk, walk must not allocate from
+*     it or free to it. The walk stops early at a broken link, see
+*     zm_heapCheck. Blocks held by thread caches are used blocks.
+*****************************************************************/
+zm_int32_t zm_heapWalk(zm_heap_t *heap, zm_memWalk_t walk, void *ctx);
+/*****************************************************************
+* FUNCTION: zm_heapCheck
+*
+* DESCRIPTION: 
+*     Check the block chain and the free lists of a heap.
+* INPUTS:
+*     heap : The heap handle.
+* RETURNS:
+*     0 : consistent.
+*     -1 : the block chain is broken, a bad link, magic or footer, or
+*          two free blocks side by side.
+*     -2 : the free lists do not match the free blocks of the chain.
+* NOTE:
+*     One pass over the blocks and one over the free lists.
+*****************************************************************/
+zm_int32_t zm_heapCheck(zm_heap_t *heap);
+/*****************************************************************
+* FUNCTION: zm_heapDump
+*
+* DESCRIPTION: 
+*     Write the block layout of a heap, built on zm_heapWalk.
+* INPUTS:
+*     heap : The heap handle.
+*     format : ZM_MEM_DUMP_MAP or ZM_MEM_DUMP_CSV.
+*     unit : Bytes per map character, 0 to fit the heap in 32 lines.
+*     write : Called with each piece of text.
+*     ctx : Passed to write.
+* RETURNS:
+*     null
+* NOTE:
+*     Map characters: '#' used, '.' free, '+' both. Block headers
+*     count as used. The CSV has a header line, sizes are payloads.
+*     The heap is locked, write must not allocate from it.
+*****************************************************************/
+void zm_heapDump(zm_heap_t *heap, zm_uint8_t format, zm_size_t unit, zm_memWrite_t write, void *ctx);
+/*****************************************************************
+* FUNCTION: zm_getDefaultHeap
+*
+* DESCRIPTION: 
+*     Get the heap used by zm_malloc, zm_free...
+* INPUTS:
+*     null
+* RETURNS:
+*     The default heap handle, NULL before zm_memoryMgrInit.
+* NOTE:
+*     null
+*****************************************************************/
+zm_heap_t *zm_getDefaultHeap(void);
+#if ZM_MEM_USE_MMAP
+/*****************************************************************
+* FUNCTION: zm_heapCreate
+*
+* DESCRIPTION: 
+*     Create a heap that grows on demand in its own virtual range.
+* INPUTS:
+*     reserve : Size of the range to reserve, the heap never grows past it.
+* RETURNS:
+*     The heap handle.
+*     NULL : faild, the range could not be reserved.
+* NOTE:
+*     Only the control block page is committed at first, the heap then
+*     grows by ZM_MEM_MMAP_COMMIT steps, whole huge pages with ZM_MEM_HUGE.
+*     Release with zm_heapDestroy.
+*****************************************************************/
+zm_heap_t *zm_heapCreate(zm_size_t reserve);
+/*****************************************************************
+* FUNCTION: zm_heapDestroy
+*
+* DESCRIPTION: 
+*     Give the virtual range of a heap back to the system.
+* INPUTS:
+*     heap : Returned by zm_heapCreate.
+* RETURNS:
+*     null
+* NOTE:
+*     All pointers allocated from the heap become invalid. Heaps from
+*     zm_heapInit are left alone.
+*****************************************************************/
+void zm_heapDestroy(zm_heap_t *heap);
+#endif
+#if ZM_MEM_PURGE
+/*****************************************************************
+* FUNCTION: zm_heapTrim
+*
+* DESCRIPTION: 
+*     Give the pages of large free runs back to the system now.
+* INPUTS:
+*     heap : The heap handle.
+* RETURNS:
+*     The number of bytes purged by this call.
+* NOTE:
+*     Only runs of at least ZM_MEM_PURGE_MIN bytes, pages already
+*     purged are skipped. Heaps from zm_heapInit are left alone.
+*****************************************************************/
+zm_size_t zm_heapTrim(zm_heap_t *heap);
+/*****************************************************************
+* FUNCTION: zm_memTrim
+*
+* DESCRIPTION: 
+*     zm_heapTrim on the memory behind zm_malloc, every arena with
+*     ZM_MEM_THREAD_CACHE.
+* INPUTS:
+*     null
+* RETURNS:
+*     The number of bytes purged by this call.
+* NOTE:
+*     Blocks held by thread caches are not free to the heap.
+*****************************************************************/
+zm_size_t zm_memTrim(void);
+#endif
+#if ZM_MEM_LATENCY
+/*****************************************************************
+* FUNCTION: zm_getMemLatency
+*
+* DESCRIPTION: 
+*     Take a snapshot of the latency and work histograms.
+* INPUTS:
+*     lat : Filled with the histograms.
+*     reset : 1 to clear them as they are read.
+* RETURNS:
+*     null
+* NOTE:
+*     Recording is lock-free, a call that ends during the snapshot
+*     lands in this one or the next, none is lost with reset. Counts
+*     wrap at 2^32, scrape with reset to keep them small.
+*     clockHz compares the ticks with CLOCK_MONOTONIC since
+*     zm_memoryMgrInit, POSIX targets only.
+*****************************************************************/
+void zm_getMemLatency(zm_memLatency_t *lat, zm_uint8_t reset);
+/*****************************************************************
+* FUNCTION: zm_latencyQuantile
+*
+* DESCRIPTION: 
+*     Value under which a share of the calls of a histogram fall.
+* INPUTS:
+*     lat : Snapshot of zm_getMemLatency.
+*     hist : ZM_LAT_xxx.
+*     q : Share in 1/10000, 9900 for p99, 9990 for p99.9.
+* RETURNS:
+*     Upper bound of the bucket holding the quantile, 0 if empty.
+* NOTE:
+*     null
+*****************************************************************/
+zm_uint32_t zm_latencyQuantile(const zm_memLatency_t *lat, zm_uint32_t hist, zm_uint32_t q);
+/*****************************************************************
+* FUNCTION: zm_latencyBucket
+*
+* DESCRIPTION: 
+*     Lowest value of a histogram bucket.
+* INPUTS:
+*     bucket : 0 to ZM_LAT_BUCKETS - 1.
+* RETURNS:
+*     The value, the bucket ends where the next one starts.
+* NOTE:
+*     For exporters that keep their own buckets.
+*****************************************************************/
+zm_uint32_t zm_latencyBucket(zm_uint32_t bucket);
+/*****************************************************************
+* FUNCTION: zm_latencyClock
+*
+* DESCRIPTION: 
+*     Tick source of the latency histograms where there is no cycle
+*     counter built in (not x86 or ARM64).
+* INPUTS:
+*     null
+* RETURNS:
+*     Ticks, wrapping.
+* NOTE:
+*     It's weak functions, you can redefine it, with a DWT cycle
+*     counter for example. The default uses clock_gettime on POSIX
+*     targets, nanoseconds, and returns 0 elsewhere.
+*****************************************************************/
+unsigned long long zm_latencyClock(void);
+#endif
 
 
 
@@ -0,0 +1,306 @@
+/*****************************************************************
+* Copyright (C) 2021 zm. All rights reserved.                    *
+******************************************************************
+* ZM_StaticHeap.hpp
+*
+* DESCRIPTION:
+*     zm heap specialized at compile time, header only, C++17.
+*     zm::StaticHeap<Size, Align, SizeClasses...> owns a buffer of Size
+*     bytes. Requests up to the largest size class come from per class
+*     free lists, the size to class mapping is a constexpr table, and
+*     allocate<N>() resolves the class at compile time. Larger requests
+*     and class refills go to a zm heap in the same buffer.
+*     The constructor is constexpr, a global can be constinit (C++20)
+*     and needs no zm_memoryMgrInit, the heap is set up on first use.
+* AUTHOR:
+*     zm
+* CREATED DATE:
+*     2023/3/3
+* REVISION:
+*     v0.1
+*
+* MODIFICATION HISTORY
+* --------------------
+* $Log:$
+*
+*****************************************************************/
+#ifndef __ZM_STATICHEAP_HPP__
+#define __ZM_STATICHEAP_HPP__
+
+/*************************************************************************************************************************
+ *                                                       INCLUDES                                                        *
+ *************************************************************************************************************************/
+#include <array>
+#include <cstddef>
+#include "ZM_Memory.h"
+
+/*************************************************************************************************************************
+ *                                                        MACROS                                                         *
+ *************************************************************************************************************************/
+/** slots taken from the heap at once when a class list runs empty */
+#ifndef ZM_STATICHEAP_REFILL
+#define ZM_STATICHEAP_REFILL    16
+#endif
+
+/** keeps the refill path and its batch array out of the inlined fast path */
+#if defined(__GNUC__) || defined(__clang__)
+#define ZM_STATICHEAP_NOINLINE  __attribute__((noinline))
+#else
+#define ZM_STATICHEAP_NOINLINE
+#endif
+
+namespace zm
+{
+namespace detail
+{
+/*************************************************************************************************************************
+ *                                                       TYPEDEFS                                                        *
+ *************************************************************************************************************************/
+/** Size classes of a StaticHeap. */
+template<std::size_t Align, std::size_t... Classes>
+struct HeapClasses
+{
+    static constexpr std::size_t num = sizeof...(Classes);
+    static constexpr std::array<std::size_t, sizeof...(Classes)> size = {{Classes...}};
+};
+
+/** No classes given: 1, 2, 3, 4, 6, 8, 12 and 16 steps of Align, at least a pointer. */
+template<std::size_t Align>
+struct HeapClasses<Align>
+{
+    static constexpr std::size_t step = Align > sizeof(void *) ? Align : sizeof(void *);
+    static constexpr std::size_t num = 8;
+    static constexpr std::array<std::size_t, 8> size = {{step, 2 * step, 3 * step, 4 * step,
+                                                         6 * step, 8 * step, 12 * step, 16 * step}};
+};
+/*************************************************************************************************************************
+ *                                                    LOCAL FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+/* classes ascending, Align multiples, each slot can hold the list link */
+template<class Classes, std::size_t Align>
+constexpr bool heapClassesValid()
+{
+    for(std::size_t i = 0; i < Classes::num; i++)
+    {
+        if(Classes::size[i] % Align || Classes::size[i] < sizeof(void *)) return false;
+        if(i && Classes::size[i] <= Classes::size[i - 1]) return false;
+    }
+    return Classes::num > 0 && Classes::num < 256;
+}
+
+/* class of every Align step up to the largest class */
+template<class Classes, std::size_t Align>
+constexpr std::array<zm_uint8_t, Classes::size[Classes::num - 1] / Align + 1> heapLookup()
+{
+    std::array<zm_uint8_t, Classes::size[Classes::num - 1] / Align + 1> table{};
+    std::size_t cls = 0;
+    
+    for(std::size_t i = 0; i < table.size(); i++)
+    {
+        while(Classes::size[cls] < i * Align) cls++;
+        table[i] = (zm_uint8_t)cls;
+    }
+    return table;
+}
+}
+
+/** Heap over a buffer of its own, size classes fixed at compile time, not thread safe. */
+template<std::size_t Size, std::size_t Align = ZM_ALIGN_SIZE, std::size_t... SizeClasses>
+class StaticHeap
+{
+    typedef detail::HeapClasses<Align, SizeClasses...> Classes;
+    
+    static_assert((Align & (Align - 1)) == 0 && Align >= ZM_ALIGN_SIZE, "Align must be a power of two, at least ZM_ALIGN_SIZE");
+    static_assert(detail::heapClassesValid<Classes, Align>(), "size classes must ascend in multiples of Align");
+    static_assert(Size >= 1024, "Size too small for a zm heap");
+    
+public:
+    static constexpr std::size_t classNum = Classes::num;
+    static constexpr std::size_t classMax = Classes::size[Classes::num - 1];
+    
+    constexpr StaticHeap() noexcept : mem_(), heap_(nullptr), free_() {}
+    StaticHeap(const StaticHeap &) = delete;
+    StaticHeap &operator=(const StaticHeap &) = delete;
+    
+    /** class of a request of at most classMax bytes */
+    static constexpr std::size_t classOf(std::size_t size)
+    {
+        return lookup_[(size + Align - 1) / Align];
+    }
+    
+    /** slot size of a class */
+    static constexpr std::size_t classSize(std::size_t cls)
+    {
+        return Classes::size[cls];
+    }
+    
+    /*****************************************************************
+    * FUNCTION: allocate
+    *
+    * DESCRIPTION:
+    *     Allocate size bytes.
+    * INPUTS:
+    *     size : The number of bytes.
+    * RETURNS:
+    *     The memory, aligned to Align.
+    *     NULL : faild, It may be out of memory.
+    * NOTE:
+    *     One table load and a list pop up to classMax.
+    *****************************************************************/
+    void *allocate(std::size_t size) noexcept
+    {
+        if(size <= classMax) return pop(classOf(size));
+        
+        return large(size);
+    }
+    
+    /** allocate with the size known at compile time, no class lookup is left */
+    template<std::size_t N>
+    void *allocate() noexcept
+    {
+        if constexpr(N <= classMax)
+        {
+            constexpr std::size_t cls = classOf(N);
+            
+            return pop(cls);
+        }
+        else
+        {
+            return large(N);
+        }
+    }
+    
+    /*****************************************************************
+    * FUNCTION: deallocate
+    *
+    * DESCRIPTION:
+    *     Give back memory of allocate.
+    * INPUTS:
+    *     ptr : The memory.
+    *     size : The size it was allocated with.
+    * RETURNS:
+    *     null
+    * NOTE:
+    *     Class slots go back to their list, not to the heap, see trim.
+    *****************************************************************/
+    void deallocate(void *ptr, std::size_t size) noexcept
+    {
+        if(ptr == nullptr) return;
+        
+        if(size <= classMax)
+        {
+            push(classOf(size), ptr);
+        }
+        else
+        {
+            zm_heapFree(heap_, ptr);
+        }
+    }
+    
+    template<std::size_t N>
+    void deallocate(void *ptr) noexcept
+    {
+        if(ptr == nullptr) return;
+        
+        if constexpr(N <= classMax)
+        {
+            constexpr std::size_t cls = classOf(N);
+            
+            push(cls, ptr);
+        }
+        else
+        {
+            zm_heapFree(heap_, ptr);
+        }
+    }
+    
+    /** release the slots kept on the class lists to the heap */
+    void trim() noexcept
+    {
+        for(std::size_t cls = 0; cls < classNum; cls++)
+        {
+            while(free_[cls])
+            {
+                void *ptr = free_[cls];
+                
+                free_[cls] = *static_cast<void **>(ptr);
+                zm_heapFree(heap_, ptr);
+            }
+        }
+    }
+    
+    /** the zm heap behind it, for zm_heapGetStatsEx or zm::allocator */
+    zm_heap_t *heap() noexcept
+    {
+        if(heap_ == nullptr) heap_ = zm_heapInit(mem_, mem_ + Size);
+        
+        return heap_;
+    }
+    
+private:
+    static constexpr std::array<zm_uint8_t, classMax / Align + 1> lookup_ = detail::heapLookup<Classes, Align>();
+    /** free slots hold the list link, the heap may align less than a pointer */
+    static constexpr std::size_t slotAlign_ = Align > alignof(void *) ? Align : alignof(void *);
+    
+    void *pop(std::size_t cls) noexcept
+    {
+        void *ptr = free_[cls];
+        
+        if(ptr == nullptr) return refill(cls);
+        
+        free_[cls] = *static_cast<void **>(ptr);
+        return ptr;
+    }
+    
+    void push(std::size_t cls, void *ptr) noexcept
+    {
+        *static_cast<void **>(ptr) = free_[cls];
+        free_[cls] = ptr;
+    }
+    
+    /* list empty, take a batch of slots from the heap */
+    ZM_STATICHEAP_NOINLINE void *refill(std::size_t cls) noexcept
+    {
+        void *batch[ZM_STATICHEAP_REFILL];
+        zm_size_t got;
+        
+        if constexpr(slotAlign_ > ZM_ALIGN_SIZE)
+        {
+            batch[0] = zm_heapMemalign(heap(), slotAlign_, classSize(cls));
+            got = batch[0] ? 1 : 0;
+        }
+        else
+        {
+            got = zm_heapMallocBatch(heap(), classSize(cls), ZM_STATICHEAP_REFILL, batch);
+        }
+        if(got == 0) return nullptr;
+        
+        while(--got)
+        {
+            push(cls, batch[got]);
+        }
+        return batch[0];
+    }
+    
+    void *large(std::size_t size) noexcept
+    {
+        if(size > (zm_size_t)-1) return nullptr;
+        
+        if constexpr(Align > ZM_ALIGN_SIZE)
+        {
+            return zm_heapMemalign(heap(), Align, (zm_size_t)size);
+        }
+        else
+        {
+            return zm_heapMalloc(heap(), (zm_size_t)size);
+        }
+    }
+    
+    alignas(Align) zm_uint8_t mem_[Size];
+    zm_heap_t *heap_;
+    void *free_[Classes::num];
+};
+
+}
+
+#endif /* ZM_StaticHeap.hpp */
@@ -0,0 +1,186 @@
+/*****************************************************************
+* Copyright (C) 2021 zm. All rights reserved.                    *
+******************************************************************
+* zm_bench_batch.c
+*
+* DESCRIPTION:
+*     zm batch allocation benchmark for burst traffic.
+*     Bursts of n descriptors are allocated, then freed in a shuffled
+*     order like completions come back, either with n zm_malloc and n
+*     zm_free calls or with one zm_mallocBatch and one zm_freeBatch.
+*     A background of live blocks of mixed sizes, every other one
+*     freed, keeps the bins fragmented. Reports the cost per object.
+*     Build on Linux from this directory:
+*     gcc -O2 -I.. -DZM_MEM_USE_HEAP=0 "-DZM_MEM_SIZE=(64u << 20)" \
+*         zm_bench_batch.c ../ZM_Memory.c -o zm_bench_batch
+*     ./zm_bench_batch [object size] [objects per test] [background blocks]
+* AUTHOR:
+*     zm
+* CREATED DATE:
+*     2023/3/3
+* REVISION:
+*     v0.1
+*
+* MODIFICATION HISTORY
+* --------------------
+* $Log:$
+*
+*****************************************************************/
+
+/*************************************************************************************************************************
+ *                                                       INCLUDES                                                        *
+ *************************************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "ZM_Memory.h"
+
+/*************************************************************************************************************************
+ *                                                        MACROS                                                         *
+ *************************************************************************************************************************/
+#define BENCH_BURST_MAX         256
+/*************************************************************************************************************************
+ *                                                    LOCAL VARIABLES                                                    *
+ *************************************************************************************************************************/
+static void *benchPtrs[BENCH_BURST_MAX];
+static void *benchOrder[BENCH_BURST_MAX];
+static unsigned int benchPerm[BENCH_BURST_MAX];
+/*************************************************************************************************************************
+ *                                                    LOCAL FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+static unsigned int bench_rand(unsigned int *seed)
+{
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* live blocks of 16..512 bytes, every other one given back */
+static void **bench_background(unsigned long count)
+{
+    void **live = calloc(count, sizeof(void *));
+    unsigned int seed = 2463534242u;
+    unsigned long i;
+
+    for(i = 0; i < count; i++)
+    {
+        live[i] = zm_malloc(16 + bench_rand(&seed) % 497);
+    }
+    for(i = 0; i < count; i += 2)
+    {
+        zm_free(live[i]);
+        live[i] = NULL;
+    }
+    return live;
+}
+
+static void bench_shuffle(unsigned int n)
+{
+    unsigned int seed = 88172645u;
+    unsigned int i;
+
+    for(i = 0; i < n; i++)
+    {
+        benchPerm[i] = i;
+    }
+    for(i = n - 1; i > 0; i--)
+    {
+        unsigned int j = bench_rand(&seed) % (i + 1);
+        unsigned int t = benchPerm[i];
+
+        benchPerm[i] = benchPerm[j];
+        benchPerm[j] = t;
+    }
+}
+
+static double bench_single(zm_size_t size, unsigned int n, unsigned long rounds)
+{
+    double begin = bench_now();
+    unsigned long round;
+    unsigned int i;
+
+    for(round = 0; round < rounds; round++)
+    {
+        for(i = 0; i < n; i++)
+        {
+            benchPtrs[i] = zm_malloc(size);
+        }
+        for(i = 0; i < n; i++)
+        {
+            benchOrder[i] = benchPtrs[benchPerm[i]];
+        }
+        for(i = 0; i < n; i++)
+        {
+            zm_free(benchOrder[i]);
+        }
+    }
+    return bench_now() - begin;
+}
+
+static double bench_batch(zm_size_t size, unsigned int n, unsigned long rounds)
+{
+    double begin = bench_now();
+    unsigned long round;
+    unsigned int i;
+
+    for(round = 0; round < rounds; round++)
+    {
+        zm_mallocBatch(size, n, benchPtrs);
+        for(i = 0; i < n; i++)
+        {
+            benchOrder[i] = benchPtrs[benchPerm[i]];
+        }
+        zm_freeBatch(benchOrder, n);
+    }
+    return bench_now() - begin;
+}
+/*************************************************************************************************************************
+ *                                                   PUBLIC FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+int main(int argc, char *argv[])
+{
+    zm_size_t size = argc > 1 ? (zm_size_t)strtoul(argv[1], NULL, 0) : 64;
+    unsigned long objects = argc > 2 ? strtoul(argv[2], NULL, 0) : 8000000;
+    unsigned long background = argc > 3 ? strtoul(argv[3], NULL, 0) : 100000;
+    static const unsigned int bursts[] = {1, 8, 32, 64, 128, 256};
+    void **live;
+    unsigned int k;
+
+    zm_memoryMgrInit();
+    live = bench_background(background);
+
+    printf("%u byte objects, %lu per test, %lu background blocks\n", (unsigned)size, objects, background);
+    printf("burst   single ns/obj   batch ns/obj   speedup\n");
+
+    for(k = 0; k < sizeof(bursts) / sizeof(bursts[0]); k++)
+    {
+        unsigned int n = bursts[k];
+        unsigned long rounds = objects / n;
+        double single, batch;
+
+        bench_shuffle(n);
+        single = bench_single(size, n, rounds) * 1e9 / (rounds * n);
+        batch = bench_batch(size, n, rounds) * 1e9 / (rounds * n);
+
+        printf("%5u   %13.1f   %12.1f   %6.2fx\n", n, single, batch, single / batch);
+    }
+
+    for(k = 0; k < background; k++)
+    {
+        zm_free(live[k]);
+    }
+    free(live);
+
+    printf("zm used after run: %u\n", (unsigned)zm_getMemUsed());
+    return 0;
+}
+/****************************************************** END OF FILE ******************************************************/
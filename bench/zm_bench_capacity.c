@@ -0,0 +1,97 @@
+/*****************************************************************
+* Copyright (C) 2021 zm. All rights reserved.                    *
+******************************************************************
+* zm_bench_capacity.c
+*
+* DESCRIPTION:
+*     zm heap capacity for small objects.
+*     A heap is filled with objects of one size, or of random sizes in
+*     8..24 bytes, until zm_heapMalloc fails. Reports how many objects fit
+*     and which share of the heap their payload takes.
+*     Build both header formats on Linux from this directory and compare:
+*     gcc -O2 -I.. -DZM_MEM_COMPACT=0 zm_bench_capacity.c ../ZM_Memory.c -o zm_cap_classic
+*     gcc -O2 -I.. -DZM_MEM_COMPACT=1 zm_bench_capacity.c ../ZM_Memory.c -o zm_cap_compact
+*     ./zm_cap_classic [heap size]
+* AUTHOR:
+*     zm
+* CREATED DATE:
+*     2023/3/3
+* REVISION:
+*     v0.1
+*
+* MODIFICATION HISTORY
+* --------------------
+* $Log:$
+*
+*****************************************************************/
+
+/*************************************************************************************************************************
+ *                                                       INCLUDES                                                        *
+ *************************************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include "ZM_Memory.h"
+
+/*************************************************************************************************************************
+ *                                                    LOCAL FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+static unsigned int bench_rand(unsigned int *seed)
+{
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+/* size 0: random sizes in 8..24 */
+static void bench_fill(void *mem, size_t memSize, zm_size_t size)
+{
+    zm_heap_t *heap = zm_heapInit(mem, (char *)mem + memSize);
+    unsigned int seed = 2463534242u;
+    unsigned long count = 0;
+    unsigned long long payload = 0;
+
+    while(1)
+    {
+        zm_size_t n = size ? size : 8 + bench_rand(&seed) % 17;
+
+        if(zm_heapMalloc(heap, n) == NULL) break;
+        count++;
+        payload += n;
+    }
+
+    if(size)
+    {
+        printf("%5u B   ", (unsigned)size);
+    }
+    else
+    {
+        printf("8..24 B  ");
+    }
+    printf("%10lu  %9.1f%%  %10.1f\n", count, 100.0 * payload / memSize, (double)memSize / count);
+}
+/*************************************************************************************************************************
+ *                                                   PUBLIC FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+int main(int argc, char *argv[])
+{
+    size_t memSize = argc > 1 ? strtoul(argv[1], NULL, 0) : 1024 * 1024;
+    static const zm_size_t sizes[] = {8, 12, 16, 24, 0};
+    void *mem = malloc(memSize);
+    unsigned int k;
+
+    if(mem == NULL) return 1;
+
+    printf("%s header, ZM_ALIGN_SIZE %d, heap %zu bytes\n", ZM_MEM_COMPACT ? "compact" : "classic",
+           ZM_ALIGN_SIZE, memSize);
+    printf("object       objects    payload   bytes/obj\n");
+
+    for(k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++)
+    {
+        bench_fill(mem, memSize, sizes[k]);
+    }
+
+    free(mem);
+    return 0;
+}
+/****************************************************** END OF FILE ******************************************************/
@@ -0,0 +1,198 @@
+/*****************************************************************
+* Copyright (C) 2021 zm. All rights reserved.                    *
+******************************************************************
+* zm_bench_huge.c
+*
+* DESCRIPTION:
+*     zm huge page benchmark for large heaps.
+*     A heap created with zm_heapCreate is filled with blocks of 64..4096
+*     bytes, half of them freed at random, after a 256 KiB block in the
+*     first huge page was freed, trimmed and allocated again. Then
+*     blocks are freed and allocated again at random places, each
+*     touching its neighbours' headers and the free lists, and all live
+*     blocks are read in random order. Reports ns per operation and dTLB load misses
+*     (perf_event_open, "n/a" when the kernel does not allow it).
+*     Build the page modes on Linux from this directory and compare:
+*     gcc -O2 -I.. -DZM_MEM_USE_MMAP=1 -DZM_MEM_HUGE=0 zm_bench_huge.c ../ZM_Memory.c -o zm_huge_off
+*     gcc -O2 -I.. -DZM_MEM_USE_MMAP=1 -DZM_MEM_HUGE=1 zm_bench_huge.c ../ZM_Memory.c -o zm_huge_thp
+*     gcc -O2 -I.. -DZM_MEM_USE_MMAP=1 -DZM_MEM_HUGE=2 zm_bench_huge.c ../ZM_Memory.c -o zm_huge_tlb
+*     ./zm_huge_off [heap MiB] [operations]
+*     zm_huge_tlb needs pool pages: echo 1024 > /proc/sys/vm/nr_hugepages
+* AUTHOR:
+*     zm
+* CREATED DATE:
+*     2023/3/3
+* REVISION:
+*     v0.1
+*
+* MODIFICATION HISTORY
+* --------------------
+* $Log:$
+*
+*****************************************************************/
+
+/*************************************************************************************************************************
+ *                                                       INCLUDES                                                        *
+ *************************************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "ZM_Memory.h"
+
+/*************************************************************************************************************************
+ *                                                    LOCAL FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+static unsigned int bench_rand(unsigned int *seed)
+{
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* dTLB load miss counter of this thread, -1 when not available */
+static int bench_tlbOpen(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long bench_tlbRead(int fd)
+{
+    long long count;
+
+    if(fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count)) return -1;
+    return count;
+}
+
+static void bench_report(const char *name, double seconds, unsigned long ops, long long misses)
+{
+    printf("%-8s %10.1f", name, seconds * 1e9 / ops);
+    if(misses < 0)
+    {
+        printf("          n/a\n");
+    }
+    else
+    {
+        printf("   %10.3f\n", (double)misses / ops);
+    }
+}
+/*************************************************************************************************************************
+ *                                                   PUBLIC FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+int main(int argc, char *argv[])
+{
+    static const char *modes[] = {"normal", "transparent huge", "hugetlb"};
+    unsigned long heapMb = argc > 1 ? strtoul(argv[1], NULL, 0) : 1024;
+    unsigned long ops = argc > 2 ? strtoul(argv[2], NULL, 0) : 4000000;
+    unsigned long count = (heapMb << 20) / 2200;
+    unsigned int seed = 2463534242u;
+    zm_memStatsEx_t stats;
+    zm_heap_t *heap;
+    void **live;
+    double begin;
+    long long misses;
+    unsigned long i;
+    unsigned long sum = 0;
+    int fd;
+
+    heap = zm_heapCreate((zm_size_t)((heapMb + heapMb / 4) << 20));
+    live = calloc(count, sizeof(void *));
+    if(heap == NULL || live == NULL) return 1;
+
+    // a large run inside the first huge page, which starts before the heap
+    // area: purging it must round to the heap start, not below it.
+    live[0] = zm_heapMalloc(heap, 256u << 10);
+    if(live[0] == NULL) return 1;
+    memset(live[0], 1, 256u << 10);
+    zm_heapFree(heap, live[0]);
+#if ZM_MEM_PURGE
+    zm_heapTrim(heap);
+#endif
+    live[0] = zm_heapMalloc(heap, 256u << 10);
+    if(live[0] == NULL) return 1;
+    memset(live[0], 2, 256u << 10);
+    zm_heapFree(heap, live[0]);
+    live[0] = NULL;
+
+    for(i = 0; i < count; i++)
+    {
+        live[i] = zm_heapMalloc(heap, 64 + bench_rand(&seed) % 4033);
+        if(live[i] == NULL) break;
+        memset(live[i], 1, 64);
+    }
+    count = i;
+    for(i = 0; i < count; i++)
+    {
+        if(bench_rand(&seed) & 1)
+        {
+            zm_heapFree(heap, live[i]);
+            live[i] = NULL;
+        }
+    }
+
+    zm_heapGetStatsEx(heap, &stats);
+    printf("%s pages, heap %lu MiB, %lu blocks\n", modes[stats.hugeMode],
+           (unsigned long)(stats.totalSize >> 20), count);
+    printf("phase       ns/op   dTLB miss/op\n");
+
+    fd = bench_tlbOpen();
+
+    misses = bench_tlbRead(fd);
+    begin = bench_now();
+    for(i = 0; i < ops; i++)
+    {
+        unsigned long k = bench_rand(&seed) % count;
+
+        if(live[k])
+        {
+            zm_heapFree(heap, live[k]);
+            live[k] = NULL;
+        }
+        else
+        {
+            live[k] = zm_heapMalloc(heap, 64 + bench_rand(&seed) % 4033);
+            if(live[k]) *(unsigned long *)live[k] = k;
+        }
+    }
+    bench_report("churn", bench_now() - begin, ops, misses < 0 ? -1 : bench_tlbRead(fd) - misses);
+
+    misses = bench_tlbRead(fd);
+    begin = bench_now();
+    for(i = 0; i < ops; i++)
+    {
+        unsigned long k = bench_rand(&seed) % count;
+
+        if(live[k]) sum += *(unsigned long *)live[k];
+    }
+    bench_report("read", bench_now() - begin, ops, misses < 0 ? -1 : bench_tlbRead(fd) - misses);
+
+    zm_heapGetStatsEx(heap, &stats);
+    printf("mode at end: %s, checksum %lu\n", modes[stats.hugeMode], sum);
+
+    zm_heapDestroy(heap);
+    free(live);
+    return 0;
+}
+/****************************************************** END OF FILE ******************************************************/
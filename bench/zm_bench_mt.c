@@ -0,0 +1,203 @@
+/*****************************************************************
+* Copyright (C) 2021 zm. All rights reserved.                    *
+******************************************************************
+* zm_bench_mt.c
+*
+* DESCRIPTION:
+*     zm multi-thread alloc/free scaling benchmark.
+*     Every thread runs a random malloc/free mix (8..256 bytes) over
+*     its own working set. Throughput is reported from 1 to N threads for:
+*         tcache : zm_malloc/zm_free, thread caches over the arenas.
+*         locked : zm_heapMalloc/zm_heapFree on one heap, one lock.
+*         libc   : malloc/free.
+*     Build on Linux from this directory:
+*     gcc -O2 -I.. -DZM_MEM_THREAD_CACHE=1 -DZM_MEM_USE_HEAP=0 \
+*         "-DZM_MEM_SIZE=(512u << 20)" zm_bench_mt.c ../ZM_Memory.c -lpthread -o zm_bench_mt
+*     ./zm_bench_mt [max threads] [ops per thread]
+* AUTHOR:
+*     zm
+* CREATED DATE:
+*     2023/2/24
+* REVISION:
+*     v0.1
+*
+* MODIFICATION HISTORY
+* --------------------
+* $Log:$
+*
+*****************************************************************/
+
+/*************************************************************************************************************************
+ *                                                       INCLUDES                                                        *
+ *************************************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include "ZM_Memory.h"
+
+/*************************************************************************************************************************
+ *                                                        MACROS                                                         *
+ *************************************************************************************************************************/
+#define BENCH_SLOTS             1024
+#define BENCH_LOCKED_SIZE       (64u << 20)
+/*************************************************************************************************************************
+ *                                                       TYPEDEFS                                                        *
+ *************************************************************************************************************************/
+typedef struct
+{
+    const char *name;
+    void *(*alloc)(zm_size_t size);
+    void (*release)(void *ptr);
+}benchAlloc_t;
+
+typedef struct
+{
+    const benchAlloc_t *alloc;
+    unsigned long ops;
+    unsigned int seed;
+    pthread_barrier_t *start;
+}benchArg_t;
+/*************************************************************************************************************************
+ *                                                    LOCAL VARIABLES                                                    *
+ *************************************************************************************************************************/
+static zm_heap_t *lockedHeap;
+/*************************************************************************************************************************
+ *                                                    LOCAL FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+static void *locked_malloc(zm_size_t size)
+{
+    return zm_heapMalloc(lockedHeap, size);
+}
+
+static void locked_free(void *ptr)
+{
+    zm_heapFree(lockedHeap, ptr);
+}
+
+static void *libc_malloc(zm_size_t size)
+{
+    return malloc(size);
+}
+
+static const benchAlloc_t benchAllocs[] =
+{
+    {"tcache", zm_malloc, zm_free},
+    {"locked", locked_malloc, locked_free},
+    {"libc", libc_malloc, free},
+};
+
+static unsigned int bench_rand(unsigned int *seed)
+{
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *bench_thread(void *param)
+{
+    benchArg_t *arg = (benchArg_t *)param;
+    void *slot[BENCH_SLOTS] = {0};
+    unsigned long i;
+
+    pthread_barrier_wait(arg->start);
+
+    for(i = 0; i < arg->ops; i++)
+    {
+        unsigned int r = bench_rand(&arg->seed);
+        unsigned int idx = r % BENCH_SLOTS;
+
+        if(slot[idx])
+        {
+            arg->alloc->release(slot[idx]);
+            slot[idx] = NULL;
+        }
+        else
+        {
+            slot[idx] = arg->alloc->alloc(8 + (r >> 16) % 249);
+            if(slot[idx]) *(char *)slot[idx] = 1;
+        }
+    }
+
+    for(i = 0; i < BENCH_SLOTS; i++)
+    {
+        arg->alloc->release(slot[i]);
+    }
+    return NULL;
+}
+
+static double bench_run(const benchAlloc_t *alloc, int threads, unsigned long ops)
+{
+    pthread_t tid[threads];
+    benchArg_t arg[threads];
+    pthread_barrier_t start;
+    double begin;
+    int i;
+
+    pthread_barrier_init(&start, NULL, threads + 1);
+
+    for(i = 0; i < threads; i++)
+    {
+        arg[i].alloc = alloc;
+        arg[i].ops = ops;
+        arg[i].seed = 2463534242u + i * 7919u;
+        arg[i].start = &start;
+        pthread_create(&tid[i], NULL, bench_thread, &arg[i]);
+    }
+
+    begin = bench_now();
+    pthread_barrier_wait(&start);
+
+    for(i = 0; i < threads; i++)
+    {
+        pthread_join(tid[i], NULL);
+    }
+
+    pthread_barrier_destroy(&start);
+
+    return (double)ops * threads / (bench_now() - begin) / 1e6;
+}
+/*************************************************************************************************************************
+ *                                                   PUBLIC FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+int main(int argc, char *argv[])
+{
+    int maxThreads = argc > 1 ? atoi(argv[1]) : 8;
+    unsigned long ops = argc > 2 ? strtoul(argv[2], NULL, 0) : 2000000;
+    static char lockedMem[BENCH_LOCKED_SIZE];
+    unsigned int k;
+    int n;
+
+    zm_memoryMgrInit();
+    lockedHeap = zm_heapInit(lockedMem, lockedMem + sizeof(lockedMem));
+
+    printf("threads");
+    for(k = 0; k < sizeof(benchAllocs) / sizeof(benchAllocs[0]); k++)
+    {
+        printf("  %10s", benchAllocs[k].name);
+    }
+    printf("   (Mops/s, alloc + free)\n");
+
+    for(n = 1; n <= maxThreads; n *= 2)
+    {
+        printf("%7d", n);
+        for(k = 0; k < sizeof(benchAllocs) / sizeof(benchAllocs[0]); k++)
+        {
+            printf("  %10.2f", bench_run(&benchAllocs[k], n, ops));
+        }
+        printf("\n");
+    }
+
+    printf("zm used after run: %u\n", (unsigned)zm_getMemUsed());
+    return 0;
+}
+/****************************************************** END OF FILE ******************************************************/
@@ -0,0 +1,204 @@
+/*****************************************************************
+* Copyright (C) 2021 zm. All rights reserved.                    *
+******************************************************************
+* zm_bench_realloc.c
+*
+* DESCRIPTION:
+*     zm realloc growth benchmark for vector-like buffers.
+*     A set of buffers grows round-robin, so neighbours interleave, until
+*     each one reaches the final size, then all are freed. Growth is
+*     either linear (+64 bytes) or geometric (x1.5). Compared:
+*         zm     : zm_realloc, grows in place when a neighbour is free.
+*         copy   : zm_malloc + memcpy + zm_free, realloc that never
+*                  grows in place.
+*         libc   : realloc.
+*     A realloc that returns another address counts as a move, its old
+*     size as bytes copied.
+*     Build on Linux from this directory:
+*     gcc -O2 -I.. -DZM_MEM_USE_HEAP=0 "-DZM_MEM_SIZE=(256u << 20)" \
+*         zm_bench_realloc.c ../ZM_Memory.c -o zm_bench_realloc
+*     ./zm_bench_realloc [buffers] [final size] [rounds]
+* AUTHOR:
+*     zm
+* CREATED DATE:
+*     2023/3/3
+* REVISION:
+*     v0.1
+*
+* MODIFICATION HISTORY
+* --------------------
+* $Log:$
+*
+*****************************************************************/
+
+/*************************************************************************************************************************
+ *                                                       INCLUDES                                                        *
+ *************************************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ZM_Memory.h"
+
+/*************************************************************************************************************************
+ *                                                        MACROS                                                         *
+ *************************************************************************************************************************/
+#define BENCH_LINEAR_STEP       64
+/*************************************************************************************************************************
+ *                                                       TYPEDEFS                                                        *
+ *************************************************************************************************************************/
+typedef struct
+{
+    const char *name;
+    void *(*resize)(void *ptr, zm_size_t oldSize, zm_size_t size);
+    void (*release)(void *ptr);
+}benchAlloc_t;
+
+typedef struct
+{
+    unsigned long reallocs;
+    unsigned long moves;
+    unsigned long long copied;
+    unsigned long failed;
+    double seconds;
+}benchResult_t;
+/*************************************************************************************************************************
+ *                                                    LOCAL FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+static void *zm_resize(void *ptr, zm_size_t oldSize, zm_size_t size)
+{
+    (void)oldSize;
+    return zm_realloc(ptr, size);
+}
+
+static void *copy_resize(void *ptr, zm_size_t oldSize, zm_size_t size)
+{
+    void *newMem = zm_malloc(size);
+
+    if(newMem && ptr)
+    {
+        memcpy(newMem, ptr, oldSize);
+        zm_free(ptr);
+    }
+    return newMem;
+}
+
+static void *libc_resize(void *ptr, zm_size_t oldSize, zm_size_t size)
+{
+    (void)oldSize;
+    return realloc(ptr, size);
+}
+
+static const benchAlloc_t benchAllocs[] =
+{
+    {"zm", zm_resize, zm_free},
+    {"copy", copy_resize, zm_free},
+    {"libc", libc_resize, free},
+};
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static zm_size_t bench_grow(zm_size_t size, int geometric)
+{
+    if(geometric) return size < 16 ? 16 : size + size / 2;
+    return size + BENCH_LINEAR_STEP;
+}
+
+static void bench_run(const benchAlloc_t *alloc, int buffers, zm_size_t finalSize,
+                      int rounds, int geometric, benchResult_t *res)
+{
+    void **buf = calloc(buffers, sizeof(void *));
+    zm_size_t *size = calloc(buffers, sizeof(zm_size_t));
+    double begin;
+    int round, i, growing;
+
+    memset(res, 0, sizeof(benchResult_t));
+    begin = bench_now();
+
+    for(round = 0; round < rounds; round++)
+    {
+        do
+        {
+            growing = 0;
+            for(i = 0; i < buffers; i++)
+            {
+                zm_size_t newSize;
+                void *newMem;
+
+                if(size[i] >= finalSize) continue;
+
+                newSize = bench_grow(size[i], geometric);
+                if(newSize > finalSize) newSize = finalSize;
+
+                newMem = alloc->resize(buf[i], size[i], newSize);
+                res->reallocs++;
+                if(newMem == NULL)
+                {
+                    res->failed++;
+                    continue;
+                }
+                if(buf[i] && newMem != buf[i])
+                {
+                    res->moves++;
+                    res->copied += size[i];
+                }
+                // touch the new tail like a push_back would.
+                memset((char *)newMem + size[i], (int)i, newSize - size[i]);
+
+                buf[i] = newMem;
+                size[i] = newSize;
+                growing = 1;
+            }
+        }while(growing);
+
+        for(i = 0; i < buffers; i++)
+        {
+            alloc->release(buf[i]);
+            buf[i] = NULL;
+            size[i] = 0;
+        }
+    }
+
+    res->seconds = bench_now() - begin;
+    free(buf);
+    free(size);
+}
+/*************************************************************************************************************************
+ *                                                   PUBLIC FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+int main(int argc, char *argv[])
+{
+    int buffers = argc > 1 ? atoi(argv[1]) : 16;
+    zm_size_t finalSize = argc > 2 ? (zm_size_t)strtoul(argv[2], NULL, 0) : 64 * 1024;
+    int rounds = argc > 3 ? atoi(argv[3]) : 20;
+    int geometric;
+    unsigned int k;
+
+    zm_memoryMgrInit();
+
+    printf("%d buffers grown to %u bytes, %d rounds\n", buffers, (unsigned)finalSize, rounds);
+    printf("growth     alloc    reallocs     moves   MB copied    failed   Mrealloc/s\n");
+
+    for(geometric = 0; geometric <= 1; geometric++)
+    {
+        for(k = 0; k < sizeof(benchAllocs) / sizeof(benchAllocs[0]); k++)
+        {
+            benchResult_t res;
+
+            bench_run(&benchAllocs[k], buffers, finalSize, rounds, geometric, &res);
+            printf("%-9s  %-5s  %10lu  %8lu  %10.1f  %8lu  %11.2f\n", geometric ? "x1.5" : "+64",
+                   benchAllocs[k].name, res.reallocs, res.moves, res.copied / 1048576.0,
+                   res.failed, res.reallocs / res.seconds / 1e6);
+        }
+    }
+
+    printf("zm used after run: %u\n", (unsigned)zm_getMemUsed());
+    return 0;
+}
+/****************************************************** END OF FILE ******************************************************/
@@ -0,0 +1,407 @@
+/*****************************************************************
+* Copyright (C) 2021 zm. All rights reserved.                    *
+******************************************************************
+* zm_replay.c
+*
+* DESCRIPTION:
+*     zm allocation trace replay benchmark.
+*     Replays a trace written by ZM_MemTrace (ZM_MEM_TRACE = 1) against
+*     zm_malloc/zm_calloc/zm_realloc/zm_free, and optionally against libc.
+*     Reports ns/op percentiles per operation, the peak zm_getMemMaxUsed
+*     and the fragmentation of the heap at the end of the run:
+*         1 - largest free block / free size.
+*     Build on Linux from this directory:
+*     gcc -O2 -I.. -DZM_MEM_USE_HEAP=0 "-DZM_MEM_SIZE=(256u << 20)" \
+*         zm_replay.c ../ZM_Memory.c -o zm_replay
+*     ./zm_replay [-l] trace.bin     replay, -l also against libc.
+*     ./zm_replay -g ops trace.bin   write a synthetic mixed trace.
+* AUTHOR:
+*     zm
+* CREATED DATE:
+*     2023/2/24
+* REVISION:
+*     v0.1
+*
+* MODIFICATION HISTORY
+* --------------------
+* $Log:$
+*
+*****************************************************************/
+
+/*************************************************************************************************************************
+ *                                                       INCLUDES                                                        *
+ *************************************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ZM_Memory.h"
+#include "ZM_MemTrace.h"
+
+/*************************************************************************************************************************
+ *                                                        MACROS                                                         *
+ *************************************************************************************************************************/
+#define REPLAY_OPS              5
+#define REPLAY_HASH(id)         ((id) * 2654435761u)
+/*************************************************************************************************************************
+ *                                                       TYPEDEFS                                                        *
+ *************************************************************************************************************************/
+typedef struct
+{
+    const char *name;
+    void *(*alloc)(zm_size_t size);
+    void *(*zalloc)(zm_size_t count, zm_size_t size);
+    void *(*resize)(void *ptr, zm_size_t size);
+    void (*release)(void *ptr);
+}replayAlloc_t;
+
+/** id -> live pointer, open addressing with linear probing */
+typedef struct
+{
+    zm_uint32_t *id;
+    void **ptr;
+    size_t mask;
+}replayMap_t;
+/*************************************************************************************************************************
+ *                                                    LOCAL VARIABLES                                                    *
+ *************************************************************************************************************************/
+static const char *opName[REPLAY_OPS] = {"", "malloc", "calloc", "realloc", "free"};
+/*************************************************************************************************************************
+ *                                                    LOCAL FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+static void *libc_malloc(zm_size_t size)
+{
+    return malloc(size);
+}
+
+static void *libc_calloc(zm_size_t count, zm_size_t size)
+{
+    return calloc(count, size);
+}
+
+static void *libc_realloc(void *ptr, zm_size_t size)
+{
+    return realloc(ptr, size);
+}
+
+static const replayAlloc_t zmAlloc = {"zm", zm_malloc, zm_calloc, zm_realloc, zm_free};
+static const replayAlloc_t libcAlloc = {"libc", libc_malloc, libc_calloc, libc_realloc, free};
+
+static void map_init(replayMap_t *map, size_t live)
+{
+    size_t cap = 1024;
+
+    while(cap < live * 2) cap <<= 1;
+
+    map->id = calloc(cap, sizeof(*map->id));
+    map->ptr = calloc(cap, sizeof(*map->ptr));
+    map->mask = cap - 1;
+}
+
+static size_t map_find(replayMap_t *map, zm_uint32_t id)
+{
+    size_t idx = REPLAY_HASH(id) & map->mask;
+
+    while(map->id[idx] && map->id[idx] != id)
+    {
+        idx = (idx + 1) & map->mask;
+    }
+    return idx;
+}
+
+static void map_put(replayMap_t *map, zm_uint32_t id, void *ptr)
+{
+    size_t idx = map_find(map, id);
+
+    map->id[idx] = id;
+    map->ptr[idx] = ptr;
+}
+
+static void *map_take(replayMap_t *map, zm_uint32_t id)
+{
+    size_t idx = map_find(map, id);
+    size_t next;
+    void *ptr = map->ptr[idx];
+
+    if(map->id[idx] == 0) return NULL;
+
+    // backward shift deletion keeps probe chains intact.
+    map->id[idx] = 0;
+    for(next = (idx + 1) & map->mask; map->id[next]; next = (next + 1) & map->mask)
+    {
+        size_t home = REPLAY_HASH(map->id[next]) & map->mask;
+
+        if(((next - home) & map->mask) >= ((next - idx) & map->mask))
+        {
+            map->id[idx] = map->id[next];
+            map->ptr[idx] = map->ptr[next];
+            map->id[next] = 0;
+            idx = next;
+        }
+    }
+    return ptr;
+}
+
+static long long replay_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    zm_uint32_t x = *(const zm_uint32_t *)a;
+    zm_uint32_t y = *(const zm_uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void replay_run(const replayAlloc_t *alloc, const zmTraceRec_t *rec, size_t num)
+{
+    zm_uint32_t *lat[REPLAY_OPS];
+    size_t cnt[REPLAY_OPS] = {0};
+    size_t failed = 0;
+    replayMap_t map;
+    size_t i;
+    int op;
+
+    map_init(&map, num);
+    for(op = 0; op < REPLAY_OPS; op++)
+    {
+        lat[op] = malloc(num * sizeof(zm_uint32_t));
+    }
+
+    for(i = 0; i < num; i++)
+    {
+        const zmTraceRec_t *r = &rec[i];
+        void *ptr = NULL;
+        void *old;
+        long long t0, t1;
+
+        if(r->op == 0 || r->op >= REPLAY_OPS) continue;
+
+        switch(r->op)
+        {
+        case ZM_TRACE_MALLOC:
+            t0 = replay_ns();
+            ptr = alloc->alloc(r->size);
+            t1 = replay_ns();
+            break;
+        case ZM_TRACE_CALLOC:
+            t0 = replay_ns();
+            ptr = alloc->zalloc(1, r->size);
+            t1 = replay_ns();
+            break;
+        case ZM_TRACE_REALLOC:
+            old = r->oldId ? map_take(&map, r->oldId) : NULL;
+            t0 = replay_ns();
+            ptr = alloc->resize(old, r->size);
+            t1 = replay_ns();
+            // a failed realloc keeps the old block alive.
+            if(ptr == NULL && old && r->size) map_put(&map, r->oldId, old);
+            break;
+        default:
+            old = r->id ? map_take(&map, r->id) : NULL;
+            t0 = replay_ns();
+            alloc->release(old);
+            t1 = replay_ns();
+            break;
+        }
+
+        if(r->op != ZM_TRACE_FREE && r->id)
+        {
+            if(ptr)
+            {
+                map_put(&map, r->id, ptr);
+            }
+            else if(r->size)
+            {
+                failed++;
+            }
+        }
+        lat[r->op][cnt[r->op]++] = (zm_uint32_t)(t1 - t0);
+    }
+
+    printf("[%s]\n%-8s %10s %8s %8s %8s %8s %8s %10s\n", alloc->name,
+           "op", "count", "mean", "p50", "p90", "p99", "p99.9", "max(ns)");
+    for(op = 1; op < REPLAY_OPS; op++)
+    {
+        double sum = 0;
+        size_t n = cnt[op];
+        size_t k;
+
+        if(n == 0) continue;
+
+        for(k = 0; k < n; k++) sum += lat[op][k];
+        qsort(lat[op], n, sizeof(zm_uint32_t), cmp_u32);
+        printf("%-8s %10zu %8.0f %8u %8u %8u %8u %10u\n", opName[op], n, sum / n,
+               lat[op][n / 2], lat[op][n * 90 / 100], lat[op][n * 99 / 100],
+               lat[op][n * 999 / 1000], lat[op][n - 1]);
+    }
+    printf("failed allocations: %zu\n", failed);
+
+    if(alloc == &zmAlloc)
+    {
+        zm_memStatsEx_t stats;
+        zm_size_t freeSize;
+
+        zm_getMemStatsEx(&stats);
+        freeSize = stats.totalSize - stats.usedSize;
+
+        printf("peak used: %zu of %zu\n", (size_t)stats.maxSize, (size_t)stats.totalSize);
+        printf("end used: %zu, free: %zu in %zu blocks, largest free: %zu, fragmentation: %.3f\n",
+               (size_t)stats.usedSize, (size_t)freeSize, (size_t)stats.freeBlocks,
+               (size_t)stats.largestFree, freeSize ? 1.0 - (double)stats.largestFree / freeSize : 0.0);
+    }
+
+    // leave the allocator empty for the next run.
+    for(i = 0; i <= map.mask; i++)
+    {
+        if(map.id[i]) alloc->release(map.ptr[i]);
+    }
+    for(op = 0; op < REPLAY_OPS; op++)
+    {
+        free(lat[op]);
+    }
+    free(map.id);
+    free(map.ptr);
+}
+
+/*****************************************************************
+* FUNCTION: replay_generate
+*
+* DESCRIPTION:
+*     Write a synthetic trace: short-lived small objects, long-lived
+*     buffers of mixed sizes and growing buffers.
+* INPUTS:
+*     path : Output file.
+*     ops : Number of records.
+* RETURNS:
+*     0 : success.
+* NOTE:
+*     null
+*****************************************************************/
+static int replay_generate(const char *path, size_t ops)
+{
+    enum { LIVE = 8192 };
+    static zm_uint32_t live[LIVE];
+    static zm_uint32_t liveSize[LIVE];
+    zm_uint32_t nextId = 1;
+    unsigned int seed = 12345;
+    zmTraceRec_t rec;
+    FILE *file = fopen(path, "wb");
+    size_t i;
+
+    if(file == NULL) return -1;
+
+    memset(&rec, 0, sizeof(rec));
+
+    for(i = 0; i < ops; i++)
+    {
+        unsigned int r, slot;
+
+        seed = seed * 1103515245u + 12345u;
+        r = seed >> 8;
+        slot = r % LIVE;
+
+        rec.time = (zm_uint32_t)i;
+        rec.oldId = 0;
+
+        if(live[slot] && (r & 0x30) != 0)
+        {
+            if((r & 0x300) == 0 && liveSize[slot] < 65536)
+            {
+                rec.op = ZM_TRACE_REALLOC;
+                rec.oldId = live[slot];
+                rec.size = liveSize[slot] + liveSize[slot] / 2 + 16;
+                rec.id = nextId++;
+                live[slot] = rec.id;
+                liveSize[slot] = rec.size;
+            }
+            else
+            {
+                rec.op = ZM_TRACE_FREE;
+                rec.size = 0;
+                rec.id = live[slot];
+                live[slot] = 0;
+            }
+        }
+        else if(!live[slot])
+        {
+            rec.op = (r & 0x7) == 0 ? ZM_TRACE_CALLOC : ZM_TRACE_MALLOC;
+            rec.size = (r & 0xF00) == 0 ? 512 + (r >> 12) % 16384 : 8 + (r >> 12) % 120;
+            rec.id = nextId++;
+            live[slot] = rec.id;
+            liveSize[slot] = rec.size;
+        }
+        else
+        {
+            continue;
+        }
+        fwrite(&rec, sizeof(rec), 1, file);
+    }
+
+    fclose(file);
+    return 0;
+}
+/*************************************************************************************************************************
+ *                                                   PUBLIC FUNCTIONS                                                    *
+ *************************************************************************************************************************/
+int main(int argc, char *argv[])
+{
+    zmTraceRec_t *rec;
+    FILE *file;
+    long len;
+    int withLibc = 0;
+    int arg = 1;
+
+    if(argc > 3 && strcmp(argv[1], "-g") == 0)
+    {
+        return replay_generate(argv[3], strtoul(argv[2], NULL, 0));
+    }
+
+    if(argc > 2 && strcmp(argv[1], "-l") == 0)
+    {
+        withLibc = 1;
+        arg++;
+    }
+
+    if(arg >= argc)
+    {
+        fprintf(stderr, "usage: %s [-l] trace.bin | -g ops trace.bin\n", argv[0]);
+        return 1;
+    }
+
+    file = fopen(argv[arg], "rb");
+    if(file == NULL)
+    {
+        perror(argv[arg]);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    rec = malloc(len);
+    if(rec == NULL || fread(rec, 1, len, file) != (size_t)len)
+    {
+        fprintf(stderr, "can not read %s\n", argv[arg]);
+        return 1;
+    }
+    fclose(file);
+
+    zm_memoryMgrInit();
+    printf("%zu records, heap %zu bytes\n", len / sizeof(zmTraceRec_t), (size_t)zm_getMemTotal());
+
+    replay_run(&zmAlloc, rec, len / sizeof(zmTraceRec_t));
+    if(withLibc)
+    {
+        replay_run(&libcAlloc, rec, len / sizeof(zmTraceRec_t));
+    }
+
+    free(rec);
+    return 0;
+}
+/****************************************************** END OF FILE ******************************************************/